@@ -27,10 +27,16 @@ struct kline_ {
   char *reason;
   char *setby;
 
+  hostmask_t usermask;
+  hostmask_t hostmask;
+  mowgli_node_t node;  /* in klnlist */
+  mowgli_node_t inode; /* in the AKILL index, see node.c */
+
   unsigned long number;
   long duration;
   time_t settime;
   time_t expires;
+  expiry_node_t expnode;
 };
 
 /* xline list struct */
@@ -43,6 +49,8 @@ struct xline_ {
   long duration;
   time_t settime;
   time_t expires;
+  expiry_node_t expnode;
+  mowgli_node_t node; /* in xlnlist */
 };
 
 /* qline list struct */
@@ -55,6 +63,8 @@ struct qline_ {
   long duration;
   time_t settime;
   time_t expires;
+  expiry_node_t expnode;
+  mowgli_node_t node; /* in qlnlist */
 };
 
 /* services ignore struct */
@@ -161,6 +171,9 @@ struct mychan_
 
   channel_t *chan;
   mowgli_list_t chanacs;
+  mowgli_patricia_t *chanacs_users; /* account entries, by entity id */
+  mowgli_list_t chanacs_hosts;      /* hostmask entries */
+  mowgli_list_t chanacs_validated;  /* other entity entries, matched by their validator */
   time_t registered;
   time_t used;
 
@@ -192,6 +205,7 @@ struct mychan_
 #define MC_MLOCK_CHECK 0x40000000 /* we need to check mode locks */
 #define MC_FORCEVERBOSE 0x20000000 /* fantasy cmd in progress, be verbose */
 #define MC_RECREATED   0x10000000 /* created with new channelTS */
+#define MC_BURSTJOIN   0x08000000 /* members from a burst wait for chanserv */
 
 #define MC_VERBOSE_MASK (MC_VERBOSE | MC_VERBOSE_OPS)
 
@@ -203,11 +217,14 @@ struct chanacs_
 	myentity_t *entity;
 	mychan_t *mychan;
 	char     *host;
+	hostmask_t hostmask;	/* compiled from host */
 	unsigned int  level;
 	time_t    tmodified;
 
 	mowgli_node_t    cnode;
 	mowgli_node_t    unode;
+	mowgli_node_t    inode;	/* in mychan->chanacs_hosts or chanacs_validated */
+	chanacs_t       *inext;	/* next entry in mychan->chanacs_users with the same entity id */
 
 	stringref setter;
 };
@@ -367,6 +384,7 @@ E kline_t *kline_add_with_id(const char *user, const char *host, const char *rea
 E kline_t *kline_add(const char *user, const char *host, const char *reason, long duration, const char *setby);
 E kline_t *kline_add_user(user_t *user, const char *reason, long duration, const char *setby);
 E void kline_delete(kline_t *k);
+E void kline_settime(kline_t *k, time_t settime);
 E kline_t *kline_find(const char *user, const char *host);
 E kline_t *kline_find_num(unsigned long number);
 E kline_t *kline_find_user(user_t *u);
@@ -376,6 +394,7 @@ E mowgli_list_t xlnlist;
 
 E xline_t *xline_add(const char *realname, const char *reason, long duration, const char *setby);
 E void xline_delete(const char *realname);
+E void xline_settime(xline_t *x, time_t settime);
 E xline_t *xline_find(const char *realname);
 E xline_t *xline_find_num(unsigned int number);
 E xline_t *xline_find_user(user_t *u);
@@ -385,6 +404,7 @@ E mowgli_list_t qlnlist;
 
 E qline_t *qline_add(const char *mask, const char *reason, long duration, const char *setby);
 E void qline_delete(const char *mask);
+E void qline_settime(qline_t *q, time_t settime);
 E qline_t *qline_find(const char *mask);
 E qline_t *qline_find_num(unsigned int number);
 E qline_t *qline_find_user(user_t *u);
@@ -404,6 +424,7 @@ E void myuser_delete(myuser_t *mu);
 //inline myuser_t *myuser_find(const char *name);
 E void myuser_rename(myuser_t *mu, const char *name);
 E void myuser_set_email(myuser_t *mu, const char *newemail);
+E void myuser_journal(myuser_t *mu);
 E myuser_t *myuser_find_ext(const char *name);
 E void myuser_notice(const char *from, myuser_t *target, const char *fmt, ...) PRINTFLIKE(3, 4);
 
@@ -435,6 +456,8 @@ E myuser_t *mychan_pick_successor(mychan_t *mc);
 E const char *mychan_get_mlock(mychan_t *mc);
 E const char *mychan_get_sts_mlock(mychan_t *mc);
 
+E void metadata_journal(void *target, const char *name, const char *value);
+
 E chanacs_t *chanacs_add(mychan_t *mychan, myentity_t *myuser, unsigned int level, time_t ts, myentity_t *setter);
 E chanacs_t *chanacs_add_host(mychan_t *mychan, const char *host, unsigned int level, time_t ts, myentity_t *setter);
 
@@ -27,6 +27,9 @@
 #include "atheme_memory.h"
 #include "table.h"
 #include "servers.h"
+#include "match.h"
+#include "hostmask.h"
+#include "expiry.h"
 #include "channels.h"
 #include "module.h"
 #include "crypto.h"
@@ -34,7 +37,6 @@
 #include "base64.h"
 #include "md5.h"
 #include "sasl.h"
-#include "match.h"
 #include "sysconf.h"
 #include "account.h"
 #include "auth.h"
@@ -56,6 +58,7 @@
 #include "inline/account.h"
 #include "inline/channels.h"
 #include "inline/connection.h"
+#include "inline/hook.h"
 
 #endif /* ATHEME_H */
 
@@ -15,6 +15,31 @@ E bool verify_password(myuser_t *mu, const char *password);
 E bool auth_module_loaded;
 E bool (*auth_user_custom)(myuser_t *mu, const char *password);
 
+/* a password check or change waiting on the crypto worker threads */
+typedef struct password_req_ password_req_t;
+typedef void (*password_cb_t)(password_req_t *req, bool ok);
+
+struct password_req_ {
+	sourceinfo_t *si;	/* NULL if none was given or the user quit meanwhile */
+	myuser_t *mu;		/* NULL if the account was dropped meanwhile */
+	void *priv;
+
+	password_cb_t cb;
+	bool set;		/* storing a new password rather than checking one */
+	bool stale;		/* another password was set since */
+	bool queued;		/* waiting for an earlier check from the same source */
+	const void *source;	/* the user, or the account if there is none */
+	char *password;
+	crypt_job_t *job;
+
+	mowgli_node_t node;
+};
+
+E password_req_t *verify_password_async(sourceinfo_t *si, myuser_t *mu, const char *password, password_cb_t cb, void *priv);
+E password_req_t *set_password_async(sourceinfo_t *si, myuser_t *mu, const char *password, password_cb_t cb, void *priv);
+E void password_req_cancel(password_req_t *req);
+E void password_req_cancel_all(password_cb_t cb);
+
 #endif
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
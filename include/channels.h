@@ -48,12 +48,14 @@ struct chanuser_
   unsigned int modes;
   mowgli_node_t unode;
   mowgli_node_t cnode;
+  chanuser_t *hnext; /* next in the same chanuser_find() bucket */
 };
 
 struct chanban_
 {
   channel_t *chan;
   char *mask;
+  hostmask_t hostmask; /* compiled from mask */
   int type; /* 'b', 'e', 'I', etc -- jilles */
   mowgli_node_t node; /* for channel_t.bans */
   unsigned int flags;
@@ -72,6 +74,7 @@ struct chanban_
 
 /* channel_t.flags */
 #define CHAN_LOG        0x00000001 /* logs sent to here */
+#define CHAN_SPLIT      0x00000002 /* losing members in a netsplit, see server_delete() */
 
 /* chanuser_t.modes */
 #define CSTATUS_OP      0x00000001
@@ -169,6 +172,7 @@ E void channel_delete(channel_t *c);
 
 E chanuser_t *chanuser_add(channel_t *chan, const char *user);
 E void chanuser_delete(channel_t *chan, user_t *user);
+E void chanuser_delete_split(channel_t *chan);
 E chanuser_t *chanuser_find(channel_t *chan, user_t *user);
 
 E chanban_t *chanban_add(channel_t *chan, const char *mask, int type);
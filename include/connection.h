@@ -32,12 +32,20 @@ union sockaddr_any_
 
 typedef struct connection_ connection_t;
 
+/* data received but not yet handled, see datastream.c */
+typedef struct {
+	char *buf;
+	size_t size;
+	size_t head;	/* offset of the first byte not yet handled */
+	size_t tail;	/* offset just past the last byte received */
+} recvq_t;
+
 struct connection_
 {
 	char name[HOSTLEN];
 	char hbuf[BUFSIZE + 1];
 
-	mowgli_list_t recvq;
+	recvq_t recvq;
 	mowgli_list_t sendq;
 
 	int fd;
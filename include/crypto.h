@@ -18,14 +18,39 @@ typedef struct {
 	const char *(*crypt)(const char *key, const char *salt);
 	const char *(*salt)(void);
 
+	/* optional reentrant crypt(), which lets the worker threads run this scheme */
+	bool (*crypt_r)(const char *key, const char *salt, char *buf, size_t buflen);
+
 	mowgli_node_t node;
 } crypt_impl_t;
 
 E void crypt_register(crypt_impl_t *impl);
 E void crypt_unregister(crypt_impl_t *impl);
 E const crypt_impl_t *crypt_verify_password(const char *user_input, const char *pass);
+E const crypt_impl_t *crypt_verify_password_skip(const char *user_input, const char *pass, const crypt_impl_t *skip);
 E const crypt_impl_t *crypt_get_default_provider(void);
 
+/* a crypt_r() call handed to the worker threads */
+typedef struct crypt_job_ crypt_job_t;
+typedef void (*crypt_job_cb_t)(crypt_job_t *job);
+
+struct crypt_job_ {
+	const crypt_impl_t *ci;
+	char *key;
+	char salt[PASSLEN];
+	char result[PASSLEN];
+	bool ok;		/* did crypt_r() succeed? */
+
+	crypt_job_cb_t cb;	/* called from the event loop, unless cancelled */
+	void *priv;
+	bool cancelled;
+
+	mowgli_node_t node;
+};
+
+E crypt_job_t *crypt_job_submit(const crypt_impl_t *ci, const char *key, const char *salt, crypt_job_cb_t cb, void *priv);
+E void crypt_job_cancel(crypt_job_t *job);
+
 #endif
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
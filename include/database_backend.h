@@ -39,9 +39,15 @@ typedef struct {
 
 typedef enum {
 	DB_READ,
-	DB_WRITE
+	DB_WRITE,
+	DB_SNAPSHOT,	/* DB_WRITE from a forked child; no db_saved hook, failed commit exits non-zero */
+	DB_JOURNAL,	/* append to the file in place; every committed row is flushed */
+	DB_REPLAY	/* DB_READ of a journal; a row torn by a crash is cut off rather than fatal */
 } database_transaction_t;
 
+#define DB_JOURNAL_FILE		"services.db.journal"
+#define DB_JOURNAL_OLD_FILE	"services.db.journal.old"
+
 struct database_handle_ {
 	void *priv;
 	database_vtable_t *vt;
@@ -88,8 +94,13 @@ typedef void (*database_handler_f)(database_handle_t *db, const char *type);
 
 E void db_register_type_handler(const char *type, database_handler_f fun);
 E void db_unregister_type_handler(const char *type);
+E database_handler_f db_find_type_handler(const char *type);
 E void db_process(database_handle_t *db, const char *type);
 E void db_init(void);
 E database_module_t *db_mod;
 
+E bool db_journal_enabled;
+E database_handle_t *db_journal_row(const char *type);
+E void db_journal_close(void);
+
 #endif
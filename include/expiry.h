@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2014 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * Queues of objects ordered by when they expire.
+ *
+ */
+
+#ifndef ATHEME_EXPIRY_H
+#define ATHEME_EXPIRY_H
+
+/* embedded in the object that is to expire */
+typedef struct {
+	time_t when;
+	void *data;
+	unsigned int slot;	/* position in the queue plus one, 0 if not queued */
+} expiry_node_t;
+
+/* a binary min-heap on expiry_node_t.when */
+typedef struct {
+	expiry_node_t **nodes;
+	unsigned int count;
+	unsigned int size;
+} expiry_queue_t;
+
+E void expiry_queue_set(expiry_queue_t *q, expiry_node_t *n, void *data, time_t when);
+E void expiry_queue_delete(expiry_queue_t *q, expiry_node_t *n);
+E void *expiry_queue_pop(expiry_queue_t *q, time_t now);
+
+#endif
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
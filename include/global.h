@@ -80,6 +80,10 @@ struct ConfOption
   unsigned int kline_time;          /* default expire for klines  */
   unsigned int clone_time;          /* default expire for clone exemptions */
   unsigned int commit_interval;     /* interval between commits   */
+  bool db_snapshot;                 /* fork to write periodic commits? */
+  bool db_journal;                  /* journal changes between commits? */
+  unsigned int crypt_threads;       /* password hashing worker threads */
+  unsigned int db_load_threads;     /* threads tokenizing the database at startup */
 
   bool silent;               /* stop sending WALLOPS?      */
   bool join_chans;           /* join registered channels?  */
@@ -136,6 +140,7 @@ struct cnt
   unsigned int node;
   unsigned int bin;
   unsigned int bout;
+  unsigned int bwrites;
   unsigned int uplink;
   unsigned int operclass;
   unsigned int myuser_access;
@@ -13,7 +13,17 @@ typedef void (*hookfn_t)(void *data);
 
 struct hook_ {
 	stringref name;
-	mowgli_list_t hooks;
+
+	/* handlers in calling order; an entry removed while the hook is
+	 * running is set to NULL and squeezed out afterwards */
+	hookfn_t *fns;
+	unsigned int count;
+	unsigned int size;
+
+	unsigned int running;	/* hook_run() calls in progress */
+	unsigned int shifted;	/* handlers inserted at the front so far */
+	bool dirty;		/* fns has NULL entries */
+	bool builtin;		/* one of the handles from hooktypes.in */
 };
 
 E hook_t *hook_add_event(const char *);
@@ -23,6 +33,10 @@ E void hook_add_hook(const char *, hookfn_t);
 E void hook_add_hook_first(const char *, hookfn_t);
 E void hook_call_event(const char *, void *);
 
+E void hook_add_handle(hook_t *, hookfn_t, bool first);
+E void hook_del_handle(hook_t *, hookfn_t);
+E void hook_run(hook_t *, void *);
+
 E void hook_stop(void);
 E void hook_continue(void *newptr);
 
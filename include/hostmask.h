@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2014 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * Precompiled hostmasks.
+ *
+ */
+
+#ifndef ATHEME_HOSTMASK_H
+#define ATHEME_HOSTMASK_H
+
+/* a run of literal characters between '*'s, as an offset into the mask */
+typedef struct {
+	unsigned short off;
+	unsigned short len;
+} hostmask_seg_t;
+
+/*
+ * A mask as understood by match(), split up once so that matching it does
+ * not have to interpret it again.  Masks made up of literal text and '*'
+ * are matched segment by segment; anything using the other wildcards is
+ * left to match().  The mask string itself belongs to the caller and must
+ * outlive the hostmask_t.
+ */
+typedef struct {
+	const char *mask;
+	bool glob;		/* needs match() */
+	bool anchor_start;	/* does not start with '*' */
+	bool anchor_end;	/* does not end with '*' */
+	unsigned int nsegs;
+	hostmask_seg_t *segs;
+
+	/* nick!user@address/bits, for CIDR bans */
+	char *cidruser;
+	cidr_mask_t cidr;
+} hostmask_t;
+
+/*
+ * The forms of a user's nick!user@host that bans and access entries are
+ * checked against, kept in the user_t by hostmask_target_get().  The real
+ * host, if it differs from the others, is the last of hosts[].
+ */
+#define HOSTMASK_TARGET_MAX	4
+
+typedef struct {
+	char nickuser[NICKLEN + USERLEN + 2];
+	char hosts[HOSTMASK_TARGET_MAX][NICKLEN + USERLEN + HOSTLEN];
+	unsigned int nhosts;
+	unsigned int nvisible;	/* hosts[] without the real host */
+
+	cidr_addr_t ip;
+
+	/* what hosts[] was built from, referenced so that a changed field never compares equal */
+	stringref nick;
+	stringref user;
+	stringref host;
+	stringref vhost;
+	stringref chost;
+} hostmask_target_t;
+
+E void hostmask_compile(hostmask_t *hm, const char *mask);
+E void hostmask_free(hostmask_t *hm);
+E bool hostmask_match(const hostmask_t *hm, const char *name);
+E bool hostmask_match_ip(const hostmask_t *hm, const cidr_addr_t *addr);
+
+E const hostmask_target_t *hostmask_target_get(user_t *u);
+E void hostmask_target_free(user_t *u);
+E bool hostmask_match_target(const hostmask_t *hm, const hostmask_target_t *t, bool realhost, bool cidr);
+
+#endif
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
@@ -0,0 +1,26 @@
+#ifndef INLINE_HOOK_H
+#define INLINE_HOOK_H
+
+/*
+ * hook_call_handle(hook_t *hook, void *dptr)
+ *
+ * Calls the handlers of a hook, which is what the hook_call_<name>()
+ * macros expand to.
+ *
+ * Inputs:
+ *     - the hook
+ *     - data for the handlers
+ *
+ * Outputs:
+ *     - none
+ *
+ * Side Effects:
+ *     - a hook with no handlers costs a single test
+ */
+static inline void hook_call_handle(hook_t *hook, void *dptr)
+{
+	if (hook->count != 0)
+		hook_run(hook, dptr);
+}
+
+#endif
@@ -11,8 +11,29 @@
 #define ATHEME_MATCH_H
 
 /* cidr.c */
+
+/* an IPv4 or IPv6 address, parsed once by cidr_parse_addr() */
+typedef struct {
+	bool valid;
+	bool ip6;
+	unsigned char addr[16];
+} cidr_addr_t;
+
+/* an address/bits mask, parsed once by cidr_parse_mask() */
+typedef struct {
+	cidr_addr_t addr;
+	int bits;		/* 0 if the mask is not valid */
+} cidr_mask_t;
+
 E int match_ips(const char *mask, const char *address);
+E int match_ips_addr(const char *mask, const cidr_addr_t *addr);
 E int match_cidr(const char *mask, const char *address);
+E int match_cidr_addr(const char *mask, const char *address, const cidr_addr_t *addr);
+E bool cidr_parse_ip(const char *ip, unsigned char *addr, bool *ip6);
+E bool cidr_match_addr(const unsigned char *addr, const unsigned char *mask, int bits);
+E bool cidr_parse_addr(const char *ip, cidr_addr_t *addr);
+E bool cidr_parse_mask(const char *s, cidr_mask_t *mask);
+E bool cidr_match(const cidr_mask_t *mask, const cidr_addr_t *addr);
 
 /* match.c */
 #define MATCH_RFC1459   0
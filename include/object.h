@@ -9,19 +9,35 @@
 #ifndef ATHEME_OBJECT_H
 #define ATHEME_OBJECT_H
 
+typedef struct metadata_key_ metadata_key_t;
+
 struct metadata_ {
 	stringref name;
 	char *value;
+	metadata_key_t *key;
 };
 
 typedef struct metadata_ metadata_t;
 
+/*
+ * A metadata name, shared by every entry spelled like it in any case.
+ * Modules looking up the same name often can register it once with
+ * metadata_key_register() and use metadata_find_key().
+ */
+struct metadata_key_ {
+	stringref name;
+	unsigned int refcount;
+};
+
 typedef void (*destructor_t)(void *);
 
 typedef struct {
 	int refcount;
 	destructor_t destructor;
-	mowgli_patricia_t *metadata;
+	metadata_t **metadata;		/* sorted by name; NULL until something is added */
+	unsigned int mdcount;
+	unsigned int mdsize;
+	char mdtype;			/* 'U', 'C', 'A', 'G' or 'N' if the metadata is saved as MDU/MDC/MDA/MDG/MDN */
 	mowgli_patricia_t *privatedata;
 #ifdef OBJECT_DEBUG
 	mowgli_node_t dnode;
@@ -39,8 +55,22 @@ E void object_dispose(void *);
 E metadata_t *metadata_add(void *target, const char *name, const char *value);
 E void metadata_delete(void *target, const char *name);
 E metadata_t *metadata_find(void *target, const char *name);
+E metadata_t *metadata_find_key(void *target, metadata_key_t *key);
 E void metadata_delete_all(void *target);
 
+E metadata_key_t *metadata_key_register(const char *name);
+
+typedef struct {
+	unsigned int pos;
+	metadata_t *last;
+} metadata_iteration_state_t;
+
+E metadata_t *metadata_next(void *target, metadata_iteration_state_t *state);
+
+/* walks an object's metadata in name order; the current entry may be deleted */
+#define METADATA_FOREACH(md, state, target) \
+	for ((state)->pos = 0, (state)->last = NULL; ((md) = metadata_next((target), (state))) != NULL; )
+
 E void *privatedata_get(void *target, const char *key);
 E void privatedata_set(void *target, const char *key, void *data);
 
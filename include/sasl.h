@@ -24,6 +24,10 @@ struct sasl_session_ {
   char *username;
   char *certfp;
   char *authzid;
+
+  mowgli_node_t mechnode;	/* in mechptr->sessions */
+  mowgli_node_t wheelnode;	/* in the expiry wheel slot below */
+  unsigned int slot;
 };
 
 struct sasl_message_ {
@@ -38,6 +42,8 @@ struct sasl_mechanism_ {
   int (*mech_start) (struct sasl_session_ *sptr, char **buffer, size_t *buflen);
   int (*mech_step) (struct sasl_session_ *sptr, char *message, size_t length, char **buffer, size_t *buflen);
   void (*mech_finish) (struct sasl_session_ *sptr);
+
+  mowgli_list_t sessions;	/* owned by saslserv/main */
 };
 
 typedef struct {
@@ -49,14 +55,16 @@ typedef struct {
 typedef struct {
 	void (*mech_register) (struct sasl_mechanism_ *mech);
 	void (*mech_unregister) (struct sasl_mechanism_ *mech);
+	void (*mech_step_done) (struct sasl_session_ *sptr, int rc);
 } sasl_mech_register_func_t;
 
 #define ASASL_FAIL 0 /* client supplied invalid credentials / screwed up their formatting */
 #define ASASL_MORE 1 /* everything looks good so far, but we're not done yet */
 #define ASASL_DONE 2 /* client successfully authenticated */
+#define ASASL_PENDING 3 /* result follows through mech_step_done(), e.g. after hashing a password */
 
-#define ASASL_MARKED_FOR_DELETION   1 /* see delete_stale() in saslserv/main.c */
 #define ASASL_NEED_LOG              2 /* user auth success needs to be logged still */
+#define ASASL_STEP_PENDING          4 /* waiting for mech_step_done() */
 
 #endif
 
@@ -50,6 +50,15 @@ typedef struct {
 	/* space for reason etc here */
 } hook_server_delete_t;
 
+/* everything that goes away when a server splits, see server_delete() */
+typedef struct {
+	server_t *s;		/* the server that split; its children go too */
+	user_t **users;		/* every user behind it, all with UF_SPLIT set */
+	unsigned int nusers;
+	channel_t **channels;	/* channels that lose members, each listed once */
+	unsigned int nchannels;
+} hook_users_split_t;
+
 #define SERVER_NAME(serv)	((serv)->sid ? (serv)->sid : (serv)->name)
 #define ME			(ircd->uses_uid ? me.numeric : me.name)
 
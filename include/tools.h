@@ -49,10 +49,12 @@ struct logfile_ {
 
 	log_write_func_t write_func;
 	log_type_t log_type;
+	time_t flushed;		/* last fflush() of log_file */
 };
 
 E char *log_path; /* contains path to default log. */
 E int log_force;
+E unsigned int log_level_mask;
 
 E logfile_t *logfile_new(const char *log_path_, unsigned int log_mask);
 E void logfile_register(logfile_t *lf);
@@ -97,9 +99,17 @@ E void logfile_unregister(logfile_t *lf);
 E void log_open(void);
 E void log_shutdown(void);
 E bool log_debug_enabled(void);
+E void log_flush(void *arg);
 E void log_master_set_mask(unsigned int mask);
 E logfile_t *logfile_find_mask(unsigned int log_mask);
 E void slog(unsigned int level, const char *fmt, ...) PRINTFLIKE(2, 3);
+
+/* whether anything is listening for any of the given levels */
+#define log_level_enabled(level) (log_force || ((level) & log_level_mask) != 0)
+
+/* the arguments to a message nobody logs are not even evaluated */
+#define slog(level, ...) \
+	(log_level_enabled(level) ? slog((level), __VA_ARGS__) : (void)0)
 E void logcommand(sourceinfo_t *si, int level, const char *fmt, ...) PRINTFLIKE(3, 4);
 E void logcommand_user(service_t *svs, user_t *source, int level, const char *fmt, ...) PRINTFLIKE(4, 5);
 E void logcommand_external(service_t *svs, const char *type, connection_t *source, const char *sourcedesc, myuser_t *login, int level, const char *fmt, ...) PRINTFLIKE(7, 8);
@@ -11,8 +11,25 @@
 typedef struct {
 	void (*uid_init)(const char *sid);
 	const char *(*uid_get)(void);
+
+	/* optional; packs a SID or UID of the protocol's form into a nonzero
+	 * integer, or returns false for anything else (such as a nick) */
+	bool (*uid_decode)(const char *id, uint64_t *key);
 } uid_provider_t;
 
 extern uid_provider_t *uid_provider_impl;
 
+/* an open-addressed table of users or servers by decoded UID or SID */
+typedef struct {
+	uint64_t *keys;
+	void **values;
+	unsigned int size;
+	unsigned int count;
+} uid_index_t;
+
+extern bool uid_index_key(const char *id, uint64_t *key);
+extern void uid_index_add(uid_index_t *idx, uint64_t key, void *value);
+extern void uid_index_delete(uid_index_t *idx, uint64_t key);
+extern void *uid_index_find(const uid_index_t *idx, uint64_t key);
+
 #endif
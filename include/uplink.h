@@ -51,7 +51,21 @@ E void (*parse)(char *line);
 E void irc_handle_connect(connection_t *cptr);
 
 /* send.c */
+#define STSLINE_MAX	510
+
+typedef struct {
+	char buf[STSLINE_MAX + 3];	/* room for \r\n\0 */
+	size_t len;
+} stsline_t;
+
 E int sts(const char *fmt, ...) PRINTFLIKE(1, 2);
+E void stsline_init(stsline_t *l);
+E void stsline_cat(stsline_t *l, const char *s);
+E void stsline_source(stsline_t *l, const char *source);
+E void stsline_add(stsline_t *l, const char *word);
+E void stsline_add_uint(stsline_t *l, unsigned long n);
+E void stsline_text(stsline_t *l, const char *text);
+E void stsline_send(stsline_t *l);
 E void io_loop(void);
 
 #endif
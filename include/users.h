@@ -21,6 +21,8 @@ struct user_
 	stringref vhost; /* Visible host */
 	stringref uid; /* Used for TS6, P10, IRCNet ircd. */
 	stringref ip;
+	cidr_addr_t ipaddr; /* ip, parsed by user_add() */
+	hostmask_target_t *hmtarget; /* built on first use by hostmask_target_get() */
 
 	mowgli_list_t channels;
 
@@ -55,6 +57,7 @@ struct user_
 #define UF_WASENFORCED 0x00002000 /* this user was FNCed once already */
 #define UF_DEAF        0x00004000 /* user does not receive channel msgs */
 #define UF_SERVICE     0x00008000 /* user is a service (e.g. +S on charybdis) */
+#define UF_SPLIT       0x00010000 /* user is leaving in a netsplit, see server_delete() */
 
 #define CLIENT_NAME(user)	((user)->uid != NULL ? (user)->uid : (user)->nick)
 
@@ -75,6 +75,39 @@ void init_accounts(void)
 	certfplist = mowgli_patricia_create(strcasecanon);
 }
 
+/*
+ * myuser_journal_row(myuser_t *mu, unsigned int flags)
+ *
+ * Appends an account's core fields to the database journal, if enabled.
+ * Accounts that do not have an entity ID yet are still being created
+ * and are journaled by myuser_add_id() once they do.
+ */
+static void myuser_journal_row(myuser_t *mu, unsigned int flags)
+{
+	database_handle_t *db;
+
+	if (!db_journal_enabled || *entity(mu)->id == '\0')
+		return;
+
+	if ((db = db_journal_row("JMU")) == NULL)
+		return;
+
+	db_write_word(db, entity(mu)->id);
+	db_write_word(db, entity(mu)->name);
+	db_write_word(db, mu->pass);
+	db_write_word(db, mu->email);
+	db_write_time(db, mu->registered);
+	db_write_uint(db, flags);
+	db_commit_row(db);
+}
+
+void myuser_journal(myuser_t *mu)
+{
+	return_if_fail(mu != NULL);
+
+	myuser_journal_row(mu, mu->flags);
+}
+
 /*
  * myuser_add(const char *name, const char *pass, const char *email,
  * unsigned int flags)
@@ -123,6 +156,7 @@ myuser_t *myuser_add_id(const char *id, const char *name, const char *pass, cons
 
 	mu = mowgli_heap_alloc(myuser_heap);
 	object_init(object(mu), name, (destructor_t) myuser_delete);
+	object(mu)->mdtype = 'U';
 
 	entity(mu)->type = ENT_USER;
 	entity(mu)->name = strshare_get(name);
@@ -171,6 +205,9 @@ myuser_t *myuser_add_id(const char *id, const char *name, const char *pass, cons
 
 	cnt.myuser++;
 
+	/* MU_ENFORCE became metadata above, but replaying it needs the flag */
+	myuser_journal_row(mu, mu->flags | (flags & MU_ENFORCE));
+
 	return mu;
 }
 
@@ -197,6 +234,7 @@ void myuser_delete(myuser_t *mu)
 	mowgli_node_t *n, *tn;
 	mymemo_t *memo;
 	chanacs_t *ca;
+	database_handle_t *db;
 	char nicks[200];
 
 	return_if_fail(mu != NULL);
@@ -206,6 +244,12 @@ void myuser_delete(myuser_t *mu)
 
 	myuser_name_remember(entity(mu)->name, mu);
 
+	if ((db = db_journal_row("JMUD")) != NULL)
+	{
+		db_write_word(db, entity(mu)->name);
+		db_commit_row(db);
+	}
+
 	hook_call_myuser_delete(mu);
 
 	/* log them out */
@@ -356,6 +400,7 @@ void myuser_rename(myuser_t *mu, const char *name)
 	mowgli_node_t *n, *tn;
 	user_t *u;
 	hook_user_rename_t data;
+	database_handle_t *db;
 	stringref newname;
 	char nb[NICKLEN];
 
@@ -380,6 +425,13 @@ void myuser_rename(myuser_t *mu, const char *name)
 	entity(mu)->name = newname;
 
 	myentity_put(entity(mu));
+	if ((db = db_journal_row("JMUR")) != NULL)
+	{
+		db_write_word(db, nb);
+		db_write_word(db, entity(mu)->name);
+		db_commit_row(db);
+	}
+
 	if (authservice_loaded)
 	{
 		MOWGLI_ITER_FOREACH(n, mu->logins.head)
@@ -419,6 +471,8 @@ void myuser_set_email(myuser_t *mu, const char *newemail)
 
 	mu->email = strshare_get(newemail);
 	mu->email_canonical = canonicalize_email(newemail);
+
+	myuser_journal(mu);
 }
 
 /*
@@ -543,7 +597,7 @@ myuser_access_verify(user_t *u, myuser_t *mu)
 	{
 		char *entry = (char *) n->data;
 
-		if (!match(entry, buf) || !match(entry, buf2) || !match(entry, buf3) || !match(entry, buf4) || !match_cidr(entry, buf3))
+		if (!match(entry, buf) || !match(entry, buf2) || !match(entry, buf3) || !match(entry, buf4) || !match_cidr_addr(entry, buf3, &u->ipaddr))
 			return true;
 	}
 
@@ -765,6 +819,7 @@ myuser_name_t *myuser_name_add(const char *name)
 
 	mun = mowgli_heap_alloc(myuser_name_heap);
 	object_init(object(mun), name, (destructor_t) myuser_name_delete);
+	object(mun)->mdtype = 'N';
 
 	mowgli_strlcpy(mun->name, name, NICKLEN);
 
@@ -791,11 +846,19 @@ myuser_name_t *myuser_name_add(const char *name)
  */
 static void myuser_name_delete(myuser_name_t *mun)
 {
+	database_handle_t *db;
+
 	return_if_fail(mun != NULL);
 
 	if (!(runflags & RF_STARTING))
 		slog(LG_DEBUG, "myuser_name_delete(): %s", mun->name);
 
+	if ((db = db_journal_row("JNAMD")) != NULL)
+	{
+		db_write_word(db, mun->name);
+		db_commit_row(db);
+	}
+
 	mowgli_patricia_delete(oldnameslist, mun->name);
 
 	metadata_delete_all(mun);
@@ -866,7 +929,7 @@ void myuser_name_restore(const char *name, myuser_t *mu)
 {
 	myuser_name_t *mun;
 	metadata_t *md, *md2;
-	mowgli_patricia_iteration_state_t state;
+	metadata_iteration_state_t state;
 	char *copy;
 
 	mun = myuser_name_find(name);
@@ -891,7 +954,7 @@ void myuser_name_restore(const char *name, myuser_t *mu)
 
 	if (object(mun)->metadata)
 	{
-		MOWGLI_PATRICIA_FOREACH(md, &state, object(mun)->metadata)
+		METADATA_FOREACH(md, &state, mun)
 		{
 			/* prefer current metadata to saved */
 			if (!metadata_find(mu, md->name))
@@ -965,12 +1028,19 @@ mycertfp_t *mycertfp_find(const char *certfp)
 static void mychan_delete(mychan_t *mc)
 {
 	mowgli_node_t *n, *tn;
+	database_handle_t *db;
 
 	return_if_fail(mc != NULL);
 
 	if (!(runflags & RF_STARTING))
 		slog(LG_DEBUG, "mychan_delete(): %s", mc->name);
 
+	if ((db = db_journal_row("JMCD")) != NULL)
+	{
+		db_write_word(db, mc->name);
+		db_commit_row(db);
+	}
+
 	if (mc->chan != NULL)
 		mc->chan->mychan = NULL;
 
@@ -978,6 +1048,9 @@ static void mychan_delete(mychan_t *mc)
 	MOWGLI_ITER_FOREACH_SAFE(n, tn, mc->chanacs.head)
 		object_unref(n->data);
 
+	if (mc->chanacs_users != NULL)
+		mowgli_patricia_destroy(mc->chanacs_users, NULL, NULL);
+
 	metadata_delete_all(mc);
 
 	mowgli_patricia_delete(mclist, mc->name);
@@ -992,6 +1065,7 @@ static void mychan_delete(mychan_t *mc)
 mychan_t *mychan_add(char *name)
 {
 	mychan_t *mc;
+	database_handle_t *db;
 
 	return_val_if_fail(name != NULL, NULL);
 	return_val_if_fail((mc = mychan_find(name)) == NULL, mc);
@@ -1002,6 +1076,7 @@ mychan_t *mychan_add(char *name)
 	mc = mowgli_heap_alloc(mychan_heap);
 
 	object_init(object(mc), name, (destructor_t) mychan_delete);
+	object(mc)->mdtype = 'C';
 	mc->name = strshare_get(name);
 	mc->registered = CURRTIME;
 	mc->chan = channel_find(name);
@@ -1013,6 +1088,13 @@ mychan_t *mychan_add(char *name)
 
 	cnt.mychan++;
 
+	if ((db = db_journal_row("JMC")) != NULL)
+	{
+		db_write_word(db, mc->name);
+		db_write_time(db, mc->registered);
+		db_commit_row(db);
+	}
+
 	return mc;
 }
 
@@ -1342,17 +1424,112 @@ const char *mychan_get_sts_mlock(mychan_t *mc)
  * C H A N A C S *
  *****************/
 
+/*
+ * Besides mychan->chanacs, which keeps every entry in the order shown to
+ * users, entries are indexed by how they can match: account entries only
+ * ever match that account and are looked up by entity id, hostmask entries
+ * are globbed, and everything else (groups, exttargets) has to ask the
+ * entity's validator.
+ */
+static inline bool chanacs_is_indexed(myentity_t *mt)
+{
+	return isuser(mt) && *mt->id != '\0';
+}
+
+static void chanacs_index_add(chanacs_t *ca)
+{
+	mychan_t *mc = ca->mychan;
+	chanacs_t *ca2;
+
+	ca->inext = NULL;
+
+	if (ca->entity == NULL)
+		mowgli_node_add(ca, &ca->inode, &mc->chanacs_hosts);
+	else if (!chanacs_is_indexed(ca->entity))
+		mowgli_node_add(ca, &ca->inode, &mc->chanacs_validated);
+	else
+	{
+		if (mc->chanacs_users == NULL)
+			mc->chanacs_users = mowgli_patricia_create(NULL);
+
+		/*
+		 * duplicate entries, and entries of different entities that
+		 * share an id, are chained behind the first in list order
+		 */
+		if ((ca2 = mowgli_patricia_retrieve(mc->chanacs_users, ca->entity->id)) == NULL)
+			mowgli_patricia_add(mc->chanacs_users, ca->entity->id, ca);
+		else
+		{
+			while (ca2->inext != NULL)
+				ca2 = ca2->inext;
+			ca2->inext = ca;
+		}
+	}
+}
+
+static void chanacs_index_delete(chanacs_t *ca)
+{
+	mychan_t *mc = ca->mychan;
+	chanacs_t *ca2;
+
+	if (ca->entity == NULL)
+		mowgli_node_delete(&ca->inode, &mc->chanacs_hosts);
+	else if (!chanacs_is_indexed(ca->entity))
+		mowgli_node_delete(&ca->inode, &mc->chanacs_validated);
+	else if ((ca2 = mowgli_patricia_retrieve(mc->chanacs_users, ca->entity->id)) == ca)
+	{
+		mowgli_patricia_delete(mc->chanacs_users, ca->entity->id);
+		if (ca->inext != NULL)
+			mowgli_patricia_add(mc->chanacs_users, ca->entity->id, ca->inext);
+	}
+	else
+	{
+		while (ca2 != NULL && ca2->inext != ca)
+			ca2 = ca2->inext;
+		if (ca2 != NULL)
+			ca2->inext = ca->inext;
+	}
+
+	ca->inext = NULL;
+}
+
+/* appends an access entry with the given flags to the database journal; level 0 removes it on replay */
+static void chanacs_journal(chanacs_t *ca, unsigned int level)
+{
+	database_handle_t *db;
+
+	if (!db_journal_enabled)
+		return;
+
+	/* entries of a dying channel or account go away with it on replay */
+	if (object(ca->mychan)->refcount < 0 || (ca->entity != NULL && object(ca->entity)->refcount < 0))
+		return;
+
+	if ((db = db_journal_row("JCA")) == NULL)
+		return;
+
+	db_write_word(db, ca->mychan->name);
+	db_write_word(db, ca->entity != NULL ? ca->entity->name : ca->host);
+	db_write_word(db, bitmask_to_flags(level));
+	db_write_time(db, ca->tmodified);
+	db_write_word(db, ca->setter != NULL ? ca->setter : "*");
+	db_commit_row(db);
+}
+
 /* private destructor for chanacs_t */
 static void chanacs_delete(chanacs_t *ca)
 {
 	return_if_fail(ca != NULL);
 	return_if_fail(ca->mychan != NULL);
 
+	chanacs_journal(ca, 0);
+
 	if (!(runflags & RF_STARTING))
 		slog(LG_DEBUG, "chanacs_delete(): %s -> %s [%s]", ca->mychan->name,
 			ca->entity != NULL ? entity(ca->entity)->name : ca->host,
 			ca->entity != NULL ? "entity" : "hostmask");
 	mowgli_node_delete(&ca->cnode, &ca->mychan->chanacs);
+	chanacs_index_delete(ca);
 
 	if (ca->entity != NULL)
 	{
@@ -1368,13 +1545,78 @@ static void chanacs_delete(chanacs_t *ca)
 	metadata_delete_all(ca);
 
 	if (ca->host != NULL)
+	{
+		hostmask_free(&ca->hostmask);
 		free(ca->host);
+	}
 
 	mowgli_heap_free(chanacs_heap, ca);
 
 	cnt.chanacs--;
 }
 
+/*
+ * metadata_journal(void *target, const char *name, const char *value)
+ *
+ * Appends a metadata change on an account, channel, access entry, group or
+ * old name to the database journal; a NULL value records a deletion.  The
+ * kind of owner is taken from the object's mdtype, set when it was created;
+ * objects without one have no metadata of their own in the database.
+ */
+void metadata_journal(void *target, const char *name, const char *value)
+{
+	object_t *obj = object(target);
+	database_handle_t *db;
+	chanacs_t *ca = NULL;
+	char kind[2];
+
+	if (!db_journal_enabled || obj->refcount < 0)
+		return;
+
+	switch (obj->mdtype)
+	{
+	case 'U':
+		/* accounts still being created are journaled as a whole later */
+		if (*entity(target)->id == '\0')
+			return;
+		break;
+	case 'C':
+	case 'G':
+	case 'N':
+		break;
+	case 'A':
+		ca = target;
+		if (object(ca->mychan)->refcount < 0 || (ca->entity != NULL && object(ca->entity)->refcount < 0))
+			return;
+		break;
+	default:
+		return;
+	}
+
+	if ((db = db_journal_row(value != NULL ? "JMD" : "JMDD")) == NULL)
+		return;
+
+	kind[0] = obj->mdtype;
+	kind[1] = '\0';
+
+	db_write_word(db, kind);
+	if (ca != NULL)
+	{
+		db_write_word(db, ca->mychan->name);
+		db_write_word(db, ca->entity != NULL ? ca->entity->name : ca->host);
+	}
+	else if (obj->mdtype == 'U' || obj->mdtype == 'G')
+		db_write_word(db, entity(target)->name);
+	else if (obj->mdtype == 'N')
+		db_write_word(db, ((myuser_name_t *)target)->name);
+	else
+		db_write_word(db, ((mychan_t *)target)->name);
+	db_write_word(db, name);
+	if (value != NULL)
+		db_write_str(db, value);
+	db_commit_row(db);
+}
+
 /*
  * chanacs_add(mychan_t *mychan, myuser_t *myuser, unsigned int level, time_t ts, myentity_t *setter)
  *
@@ -1410,6 +1652,7 @@ chanacs_t *chanacs_add(mychan_t *mychan, myentity_t *mt, unsigned int level, tim
 	ca = mowgli_heap_alloc(chanacs_heap);
 
 	object_init(object(ca), mt->name, (destructor_t) chanacs_delete);
+	object(ca)->mdtype = 'A';
 	ca->mychan = mychan;
 	ca->entity = isdynamic(mt) ? object_ref(mt) : mt;
 	ca->host = NULL;
@@ -1419,9 +1662,12 @@ chanacs_t *chanacs_add(mychan_t *mychan, myentity_t *mt, unsigned int level, tim
 
 	mowgli_node_add(ca, &ca->cnode, &mychan->chanacs);
 	mowgli_node_add(ca, &ca->unode, &mt->chanacs);
+	chanacs_index_add(ca);
 
 	cnt.chanacs++;
 
+	chanacs_journal(ca, ca->level);
+
 	return ca;
 }
 
@@ -1460,17 +1706,22 @@ chanacs_t *chanacs_add_host(mychan_t *mychan, const char *host, unsigned int lev
 	ca = mowgli_heap_alloc(chanacs_heap);
 
 	object_init(object(ca), host, (destructor_t) chanacs_delete);
+	object(ca)->mdtype = 'A';
 	ca->mychan = mychan;
 	ca->entity = NULL;
 	ca->host = sstrdup(host);
+	hostmask_compile(&ca->hostmask, ca->host);
 	ca->level = level & ca_all;
 	ca->tmodified = ts;
 	ca->setter = setter != NULL ? strshare_ref(setter->name) : NULL;
 
 	mowgli_node_add(ca, &ca->cnode, &mychan->chanacs);
+	chanacs_index_add(ca);
 
 	cnt.chanacs++;
 
+	chanacs_journal(ca, ca->level);
+
 	return ca;
 }
 
@@ -1484,15 +1735,13 @@ chanacs_t *chanacs_find(mychan_t *mychan, myentity_t *mt, unsigned int level)
 	if ((ca = chanacs_find_literal(mychan, mt, level)) != NULL)
 		return ca;
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	/* account entries match only their own account, found above */
+	MOWGLI_ITER_FOREACH(n, mychan->chanacs_validated.head)
 	{
 		entity_chanacs_validation_vtable_t *vt;
 
 		ca = (chanacs_t *)n->data;
 
-		if (ca->entity == NULL)
-			continue;
-
 		vt = myentity_get_chanacs_validator(ca->entity);
 		if (level != 0x0)
 		{
@@ -1514,14 +1763,19 @@ unsigned int chanacs_entity_flags(mychan_t *mychan, myentity_t *mt)
 
 	return_val_if_fail(mychan != NULL && mt != NULL, 0);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	if (chanacs_is_indexed(mt) && mychan->chanacs_users != NULL)
+	{
+		for (ca = mowgli_patricia_retrieve(mychan->chanacs_users, mt->id); ca != NULL; ca = ca->inext)
+			if (ca->entity == mt)
+				result |= ca->level;
+	}
+
+	MOWGLI_ITER_FOREACH(n, mychan->chanacs_validated.head)
 	{
 		entity_chanacs_validation_vtable_t *vt;
 
 		ca = (chanacs_t *)n->data;
 
-		if (ca->entity == NULL)
-			continue;
 		if (ca->entity == mt)
 			result |= ca->level;
 		else
@@ -1544,7 +1798,20 @@ chanacs_t *chanacs_find_literal(mychan_t *mychan, myentity_t *mt, unsigned int l
 
 	return_val_if_fail(mychan != NULL && mt != NULL, NULL);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	if (chanacs_is_indexed(mt))
+	{
+		if (mychan->chanacs_users == NULL)
+			return NULL;
+
+		/* another entity may carry the same id */
+		for (ca = mowgli_patricia_retrieve(mychan->chanacs_users, mt->id); ca != NULL; ca = ca->inext)
+			if (ca->entity == mt && (ca->level & level) == level)
+				return ca;
+
+		return NULL;
+	}
+
+	MOWGLI_ITER_FOREACH(n, mychan->chanacs_validated.head)
 	{
 		ca = (chanacs_t *)n->data;
 
@@ -1567,16 +1834,16 @@ chanacs_t *chanacs_find_host(mychan_t *mychan, const char *host, unsigned int le
 
 	return_val_if_fail(mychan != NULL && host != NULL, NULL);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	MOWGLI_ITER_FOREACH(n, mychan->chanacs_hosts.head)
 	{
 		ca = (chanacs_t *)n->data;
 
 		if (level != 0x0)
 		{
-			if ((ca->entity == NULL) && (!match(ca->host, host)) && ((ca->level & level) == level))
+			if ((ca->entity == NULL) && hostmask_match(&ca->hostmask, host) && ((ca->level & level) == level))
 				return ca;
 		}
-		else if ((ca->entity == NULL) && (!match(ca->host, host)))
+		else if ((ca->entity == NULL) && hostmask_match(&ca->hostmask, host))
 			return ca;
 	}
 
@@ -1591,11 +1858,11 @@ unsigned int chanacs_host_flags(mychan_t *mychan, const char *host)
 
 	return_val_if_fail(mychan != NULL && host != NULL, 0);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	MOWGLI_ITER_FOREACH(n, mychan->chanacs_hosts.head)
 	{
 		ca = (chanacs_t *)n->data;
 
-		if (ca->entity == NULL && !match(ca->host, host))
+		if (ca->entity == NULL && hostmask_match(&ca->hostmask, host))
 			result |= ca->level;
 	}
 
@@ -1610,7 +1877,7 @@ chanacs_t *chanacs_find_host_literal(mychan_t *mychan, const char *host, unsigne
 	if ((!mychan) || (!host))
 		return NULL;
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	MOWGLI_ITER_FOREACH(n, mychan->chanacs_hosts.head)
 	{
 		ca = (chanacs_t *)n->data;
 
@@ -1633,7 +1900,7 @@ chanacs_t *chanacs_find_host_by_user(mychan_t *mychan, user_t *u, unsigned int l
 
 	return_val_if_fail(mychan != NULL && u != NULL, 0);
 
-	for (n = next_matching_host_chanacs(mychan, u, mychan->chanacs.head); n != NULL; n = next_matching_host_chanacs(mychan, u, n->next))
+	for (n = next_matching_host_chanacs(mychan, u, mychan->chanacs_hosts.head); n != NULL; n = next_matching_host_chanacs(mychan, u, n->next))
 	{
 		ca = n->data;
 		if ((ca->level & level) == level)
@@ -1651,7 +1918,7 @@ static unsigned int chanacs_host_flags_by_user(mychan_t *mychan, user_t *u)
 
 	return_val_if_fail(mychan != NULL && u != NULL, 0);
 
-	for (n = next_matching_host_chanacs(mychan, u, mychan->chanacs.head); n != NULL; n = next_matching_host_chanacs(mychan, u, n->next))
+	for (n = next_matching_host_chanacs(mychan, u, mychan->chanacs_hosts.head); n != NULL; n = next_matching_host_chanacs(mychan, u, n->next))
 	{
 		ca = n->data;
 		result |= ca->level;
@@ -1708,15 +1975,13 @@ static unsigned int chanacs_entity_flags_by_user(mychan_t *mychan, user_t *u)
 	return_val_if_fail(mychan != NULL, 0);
 	return_val_if_fail(u != NULL, 0);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	/* account entries use the linear validator, which cannot match users */
+	MOWGLI_ITER_FOREACH(n, mychan->chanacs_validated.head)
 	{
 		chanacs_t *ca = n->data;
 		myentity_t *mt;
 		entity_chanacs_validation_vtable_t *vt;
 
-		if (ca->entity == NULL)
-			continue;
-
 		mt = ca->entity;
 		vt = myentity_get_chanacs_validator(mt);
 
@@ -1823,6 +2088,8 @@ bool chanacs_modify(chanacs_t *ca, unsigned int *addflags, unsigned int *removef
 	ca->level = (ca->level | *addflags) & ~*removeflags;
 	ca->tmodified = CURRTIME;
 
+	chanacs_journal(ca, ca->level);
+
 	return true;
 }
 
@@ -1885,6 +2152,7 @@ bool chanacs_change(mychan_t *mychan, myentity_t *mt, const char *hostmask, unsi
 				return false;
 			ca->level = (ca->level | *addflags) & ~*removeflags;
 			ca->tmodified = CURRTIME;
+			chanacs_journal(ca, ca->level);
 			if (ca->level == 0)
 				object_unref(ca);
 		}
@@ -1921,6 +2189,7 @@ bool chanacs_change(mychan_t *mychan, myentity_t *mt, const char *hostmask, unsi
 				return false;
 			ca->level = (ca->level | *addflags) & ~*removeflags;
 			ca->tmodified = CURRTIME;
+			chanacs_journal(ca, ca->level);
 			if (ca->level == 0)
 				object_unref(ca);
 		}
@@ -115,6 +115,7 @@ static void daemonize(int *daemonize_pipe)
 			slog(LG_ERROR, "can't create a pipe");
 			exit(EXIT_FAILURE);
 		}
+		log_flush(NULL);
 		if ((i = fork()) < 0)
 		{
 			slog(LG_ERROR, "can't fork into the background");
@@ -443,6 +444,9 @@ int atheme_main(int argc, char *argv[])
 	/* reseed rng a little every five minutes */
 	mowgli_timer_add(base_eventloop, "rng_reseed", rng_reseed, NULL, 293);
 
+	/* write out buffered log lines every second */
+	mowgli_timer_add(base_eventloop, "log_flush", log_flush, NULL, 1);
+
 	me.connected = false;
 	uplink_connect();
 
@@ -469,6 +473,7 @@ int atheme_main(int argc, char *argv[])
 		slog(LG_INFO, "main(): restarting");
 
 #ifdef HAVE_EXECVE
+		log_flush(NULL);
 		execv(BINDIR "/atheme-services", argv);
 #endif
 	}
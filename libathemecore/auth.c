@@ -26,11 +26,44 @@
 bool auth_module_loaded = false;
 bool (*auth_user_custom)(myuser_t *mu, const char *password);
 
+static mowgli_list_t password_reqs = { NULL, NULL, 0 };
+
+/* a newer password must not be overwritten by an older one still being hashed */
+static void password_req_supersede(myuser_t *mu)
+{
+	mowgli_node_t *n;
+
+	MOWGLI_ITER_FOREACH(n, password_reqs.head)
+	{
+		password_req_t *req = n->data;
+
+		if (req->set && req->mu == mu)
+			req->stale = true;
+	}
+}
+
+static bool password_req_set_pending(myuser_t *mu)
+{
+	mowgli_node_t *n;
+
+	MOWGLI_ITER_FOREACH(n, password_reqs.head)
+	{
+		password_req_t *req = n->data;
+
+		if (req->set && req->mu == mu && !req->stale)
+			return true;
+	}
+
+	return false;
+}
+
 void set_password(myuser_t *mu, const char *newpassword)
 {
 	if (mu == NULL || newpassword == NULL)
 		return;
 
+	password_req_supersede(mu);
+
 	/* if we can, try to crypt it */
 	if (crypto_module_loaded)
 	{
@@ -42,6 +75,8 @@ void set_password(myuser_t *mu, const char *newpassword)
 		mu->flags &= ~MU_CRYPTPASS;			/* just in case */
 		mowgli_strlcpy(mu->pass, newpassword, PASSLEN);
 	}
+
+	myuser_journal(mu);
 }
 
 bool verify_password(myuser_t *mu, const char *password)
@@ -84,3 +119,378 @@ bool verify_password(myuser_t *mu, const char *password)
 		return (strcmp(mu->pass, password) == 0);
 }
 
+static void password_req_finish(password_req_t *req, bool ok);
+
+static void password_req_user_delete(user_t *u)
+{
+	mowgli_node_t *n, *tn;
+
+	MOWGLI_ITER_FOREACH(n, password_reqs.head)
+	{
+		password_req_t *req = n->data;
+
+		if (req->si != NULL && req->si->su == u)
+		{
+			object_unref(req->si);
+			req->si = NULL;
+		}
+	}
+
+	/* nobody is waiting for the checks that have not started yet */
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, password_reqs.head)
+	{
+		password_req_t *req = n->data;
+
+		if (req->queued && req->source == u)
+			password_req_finish(req, false);
+	}
+}
+
+static void password_req_myuser_delete(myuser_t *mu)
+{
+	mowgli_node_t *n;
+
+	MOWGLI_ITER_FOREACH(n, password_reqs.head)
+	{
+		password_req_t *req = n->data;
+
+		if (req->mu == mu)
+			req->mu = NULL;
+	}
+}
+
+/* IRC users can wait for their answer, RPC clients and fantasy commands cannot */
+static bool password_req_can_defer(sourceinfo_t *si)
+{
+	return si == NULL || (si->su != NULL && si->c == NULL);
+}
+
+static password_req_t *password_req_create(sourceinfo_t *si, myuser_t *mu, const char *password, password_cb_t cb, void *priv)
+{
+	static bool hooked = false;
+	password_req_t *req;
+
+	if (!hooked)
+	{
+		hook_add_user_delete(password_req_user_delete);
+		hook_add_myuser_delete(password_req_myuser_delete);
+		hooked = true;
+	}
+
+	req = smalloc(sizeof *req);
+	req->si = si;
+	if (si != NULL)
+		object_ref(si);
+	req->mu = mu;
+	req->source = si != NULL && si->su != NULL ? (const void *) si->su : (const void *) mu;
+	req->password = sstrdup(password);
+	req->cb = cb;
+	req->priv = priv;
+
+	mowgli_node_add(req, &req->node, &password_reqs);
+
+	return req;
+}
+
+static void password_req_free(password_req_t *req)
+{
+	mowgli_node_delete(&req->node, &password_reqs);
+
+	if (req->si != NULL)
+		object_unref(req->si);
+
+	memset(req->password, 0, strlen(req->password));
+	free(req->password);
+	free(req);
+}
+
+static bool verify_password_start(password_req_t *req);
+
+/* is a check from this request's source already running or waiting? */
+static bool password_req_busy(password_req_t *req)
+{
+	mowgli_node_t *n;
+
+	MOWGLI_ITER_FOREACH(n, password_reqs.head)
+	{
+		password_req_t *req2 = n->data;
+
+		if (req2 != req && !req2->set && req2->source == req->source)
+			return true;
+	}
+
+	return false;
+}
+
+/* starts the oldest check queued behind one from the same source that has finished */
+static void password_req_start_next(const void *source)
+{
+	static bool starting = false;
+	mowgli_node_t *n;
+	password_req_t *req;
+
+	/* a check finished straight away below; the loop takes care of the next */
+	if (starting)
+		return;
+
+	starting = true;
+
+	do
+	{
+		req = NULL;
+
+		MOWGLI_ITER_FOREACH(n, password_reqs.head)
+		{
+			password_req_t *req2 = n->data;
+
+			if (req2->queued && req2->source == source)
+			{
+				req = req2;
+				break;
+			}
+		}
+
+		if (req == NULL)
+			break;
+
+		req->queued = false;
+	} while (!verify_password_start(req));
+
+	starting = false;
+}
+
+static void password_req_finish(password_req_t *req, bool ok)
+{
+	const void *source = req->source;
+	bool started = !req->set && !req->queued;
+
+	/* the user may have logged in or out while we were hashing */
+	if (req->si != NULL && req->si->su != NULL)
+		req->si->smu = req->si->su->myuser;
+
+	if (req->cb != NULL)
+		req->cb(req, ok);
+
+	password_req_free(req);
+
+	if (started)
+		password_req_start_next(source);
+}
+
+static void verify_password_done(crypt_job_t *job)
+{
+	password_req_t *req = job->priv;
+	myuser_t *mu = req->mu;
+	const crypt_impl_t *ci;
+
+	req->job = NULL;
+
+	/* cancelled, or the account was dropped meanwhile */
+	if (req->cb == NULL || mu == NULL)
+	{
+		password_req_finish(req, false);
+		return;
+	}
+
+	/* the password or the crypto modules changed meanwhile, start over */
+	if (strcmp(job->salt, mu->pass) || !(mu->flags & MU_CRYPTPASS) || job->ci != crypt_get_default_provider())
+	{
+		verify_password_start(req);
+		return;
+	}
+
+	/* any other schemes are legacy ones, cheap enough to try here */
+	if (job->ok && !strcmp(job->result, mu->pass))
+		ci = job->ci;
+	else
+		ci = crypt_verify_password_skip(req->password, mu->pass, job->ci);
+
+	if (ci == NULL)
+	{
+		password_req_finish(req, false);
+		return;
+	}
+
+	if (ci != job->ci && !password_req_set_pending(mu))
+	{
+		slog(LG_INFO, "verify_password(): transitioning from crypt scheme '%s' to '%s' for account '%s'",
+			      ci->id, job->ci->id, entity(mu)->name);
+
+		set_password_async(NULL, mu, req->password, NULL, NULL);
+	}
+
+	password_req_finish(req, true);
+}
+
+/* returns false if the request was finished straight away */
+static bool verify_password_start(password_req_t *req)
+{
+	myuser_t *mu = req->mu;
+
+	if (mu != NULL && password_req_can_defer(req->si) && !(auth_module_loaded && auth_user_custom) &&
+			(mu->flags & MU_CRYPTPASS) && crypto_module_loaded)
+	{
+		req->job = crypt_job_submit(crypt_get_default_provider(), req->password, mu->pass, verify_password_done, req);
+		if (req->job != NULL)
+			return true;
+	}
+
+	password_req_finish(req, verify_password(mu, req->password));
+	return false;
+}
+
+/*
+ * verify_password_async(sourceinfo_t *si, myuser_t *mu, const char *password,
+ *                       password_cb_t cb, void *priv)
+ *
+ * Checks a password like verify_password(), on the crypto worker threads
+ * if possible.
+ *
+ * Inputs:
+ *       - the source waiting for the answer, or NULL (SASL)
+ *       - the account to check against
+ *       - the password
+ *       - a callback to report the result to
+ *       - opaque data for the callback, as req->priv
+ *
+ * Outputs:
+ *       - the pending request, or NULL if the callback was already called
+ *
+ * Side Effects:
+ *       - the callback is called exactly once, unless the request is
+ *         cancelled with password_req_cancel(); req->si and req->mu must be
+ *         checked there, as the user may have quit and the account may
+ *         have been dropped in the meantime
+ *       - only one check per user (per account for SASL) is hashed at a
+ *         time; later ones wait for it, so one client cannot fill the
+ *         worker queue
+ *       - the password may be rehashed with the default crypt scheme
+ */
+password_req_t *verify_password_async(sourceinfo_t *si, myuser_t *mu, const char *password, password_cb_t cb, void *priv)
+{
+	password_req_t *req;
+
+	return_val_if_fail(mu != NULL, NULL);
+	return_val_if_fail(password != NULL, NULL);
+	return_val_if_fail(cb != NULL, NULL);
+
+	req = password_req_create(si, mu, password, cb, priv);
+
+	if (password_req_can_defer(si) && password_req_busy(req))
+	{
+		req->queued = true;
+		return req;
+	}
+
+	return verify_password_start(req) ? req : NULL;
+}
+
+static void set_password_done(crypt_job_t *job)
+{
+	password_req_t *req = job->priv;
+	myuser_t *mu = req->mu;
+
+	req->job = NULL;
+
+	if (mu != NULL && !req->stale)
+	{
+		if (job->ok && job->ci == crypt_get_default_provider())
+		{
+			mu->flags |= MU_CRYPTPASS;
+			mowgli_strlcpy(mu->pass, job->result, PASSLEN);
+			myuser_journal(mu);
+		}
+		else
+			set_password(mu, req->password);
+	}
+
+	password_req_finish(req, mu != NULL);
+}
+
+/*
+ * set_password_async(sourceinfo_t *si, myuser_t *mu, const char *password,
+ *                    password_cb_t cb, void *priv)
+ *
+ * Sets a password like set_password(), hashing it on the crypto worker
+ * threads if possible.  The old password stays in place until then.
+ *
+ * Inputs and Outputs are as for verify_password_async(); the callback
+ * may be NULL.  The password is stored even if the request is cancelled
+ * or the user quits, but not over one set after it.
+ */
+password_req_t *set_password_async(sourceinfo_t *si, myuser_t *mu, const char *password, password_cb_t cb, void *priv)
+{
+	password_req_t *req;
+	const crypt_impl_t *ci;
+
+	return_val_if_fail(mu != NULL, NULL);
+	return_val_if_fail(password != NULL, NULL);
+
+	password_req_supersede(mu);
+
+	req = password_req_create(si, mu, password, cb, priv);
+	req->set = true;
+
+	if (password_req_can_defer(si) && crypto_module_loaded)
+	{
+		ci = crypt_get_default_provider();
+		req->job = crypt_job_submit(ci, password, ci->salt(), set_password_done, req);
+		if (req->job != NULL)
+			return req;
+	}
+
+	set_password(mu, password);
+	password_req_finish(req, true);
+
+	return NULL;
+}
+
+/*
+ * password_req_cancel(password_req_t *req)
+ *
+ * Makes sure the callback of a pending request is never called, for
+ * callers going away before it is done.
+ */
+void password_req_cancel(password_req_t *req)
+{
+	return_if_fail(req != NULL);
+
+	req->cb = NULL;
+
+	/* a new password is still stored, a check not yet started can simply be dropped */
+	if (req->queued)
+	{
+		password_req_free(req);
+		return;
+	}
+
+	/*
+	 * a running check is left to finish, so that its source cannot cancel
+	 * and resubmit to get around the one-at-a-time limit
+	 */
+
+	if (req->si != NULL)
+	{
+		object_unref(req->si);
+		req->si = NULL;
+	}
+}
+
+/*
+ * password_req_cancel_all(password_cb_t cb)
+ *
+ * Cancels every pending request with the given callback, for modules
+ * being unloaded.
+ */
+void password_req_cancel_all(password_cb_t cb)
+{
+	mowgli_node_t *n, *tn;
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, password_reqs.head)
+	{
+		password_req_t *req = n->data;
+
+		if (req->cb == cb)
+			password_req_cancel(req);
+	}
+}
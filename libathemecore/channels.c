@@ -29,6 +29,78 @@ mowgli_heap_t *chan_heap;
 mowgli_heap_t *chanuser_heap;
 mowgli_heap_t *chanban_heap;
 
+/*
+ * Every chanuser_t is also in a hash table on its (channel, user) pair,
+ * so chanuser_find() does not depend on how many channels the user is in
+ * or how many members the channel has.  The table doubles whenever it
+ * holds as many entries as it has buckets.
+ */
+static chanuser_t **chanuser_hash;
+static unsigned int chanuser_hash_size;
+static unsigned int chanuser_hash_count;
+
+static inline unsigned int chanuser_hash_bucket(channel_t *chan, user_t *user)
+{
+	uintptr_t h;
+
+	h = ((uintptr_t)chan >> 3) * 0x9E3779B1U + ((uintptr_t)user >> 3);
+	h ^= h >> 16;
+	h *= 0x85EBCA6BU;
+	h ^= h >> 13;
+
+	return h & (chanuser_hash_size - 1);
+}
+
+static void chanuser_hash_resize(unsigned int size)
+{
+	chanuser_t **old = chanuser_hash, *cu, *next;
+	unsigned int oldsize = chanuser_hash_size, i, b;
+
+	chanuser_hash = scalloc(size, sizeof(chanuser_t *));
+	chanuser_hash_size = size;
+
+	for (i = 0; i < oldsize; i++)
+	{
+		for (cu = old[i]; cu != NULL; cu = next)
+		{
+			next = cu->hnext;
+			b = chanuser_hash_bucket(cu->chan, cu->user);
+			cu->hnext = chanuser_hash[b];
+			chanuser_hash[b] = cu;
+		}
+	}
+
+	free(old);
+}
+
+static void chanuser_hash_add(chanuser_t *cu)
+{
+	unsigned int b;
+
+	if (chanuser_hash_count >= chanuser_hash_size)
+		chanuser_hash_resize(chanuser_hash_size * 2);
+
+	b = chanuser_hash_bucket(cu->chan, cu->user);
+	cu->hnext = chanuser_hash[b];
+	chanuser_hash[b] = cu;
+	chanuser_hash_count++;
+}
+
+static void chanuser_hash_delete(chanuser_t *cu)
+{
+	chanuser_t **cup;
+
+	for (cup = &chanuser_hash[chanuser_hash_bucket(cu->chan, cu->user)]; *cup != NULL; cup = &(*cup)->hnext)
+	{
+		if (*cup == cu)
+		{
+			*cup = cu->hnext;
+			chanuser_hash_count--;
+			return;
+		}
+	}
+}
+
 /*
  * init_channels()
  *
@@ -56,6 +128,7 @@ void init_channels(void)
 	}
 
 	chanlist = mowgli_patricia_create(irccasecanon);
+	chanuser_hash_resize(1024);
 }
 
 /*
@@ -170,6 +243,7 @@ void channel_delete(channel_t *c)
 		soft_assert(is_internal_client(cu->user) && !me.connected);
 		mowgli_node_delete(&cu->cnode, &c->members);
 		mowgli_node_delete(&cu->unode, &cu->user->channels);
+		chanuser_hash_delete(cu);
 		mowgli_heap_free(chanuser_heap, cu);
 		cnt.chanuser--;
 	}
@@ -244,6 +318,7 @@ chanban_t *chanban_add(channel_t *chan, const char *mask, int type)
 
 	c->chan = chan;
 	c->mask = sstrdup(mask);
+	hostmask_compile(&c->hostmask, c->mask);
 	c->type = type;
 
 	mowgli_node_add(c, &c->node, &chan->bans);
@@ -271,6 +346,7 @@ void chanban_delete(chanban_t * c)
 
 	mowgli_node_delete(&c->node, &c->chan->bans);
 
+	hostmask_free(&c->hostmask);
 	free(c->mask);
 	mowgli_heap_free(chanban_heap, c);
 }
@@ -403,6 +479,7 @@ chanuser_t *chanuser_add(channel_t *chan, const char *nick)
 
 	mowgli_node_add(cu, &cu->cnode, &chan->members);
 	mowgli_node_add(cu, &cu->unode, &u->channels);
+	chanuser_hash_add(cu);
 
 	cnt.chanuser++;
 
@@ -453,6 +530,7 @@ void chanuser_delete(channel_t *chan, user_t *user)
 
 	mowgli_node_delete(&cu->cnode, &chan->members);
 	mowgli_node_delete(&cu->unode, &user->channels);
+	chanuser_hash_delete(cu);
 
 	mowgli_heap_free(chanuser_heap, cu);
 
@@ -468,6 +546,58 @@ void chanuser_delete(channel_t *chan, user_t *user)
 	}
 }
 
+/*
+ * chanuser_delete_split(channel_t *chan)
+ *
+ * Removes all members of a channel that are leaving in a netsplit in one
+ * pass over the member list.
+ *
+ * Inputs:
+ *     - a channel listed in a users_split hook
+ *
+ * Outputs:
+ *     - nothing
+ *
+ * Side Effects:
+ *     - the memberships of all users with UF_SPLIT are destroyed; the
+ *       channel_part hook is not called, users_split was called instead
+ *     - CHAN_SPLIT is cleared
+ *     - if this empties the channel and the channel is not set permanent
+ *       (ircd->perm_mode), channel_delete() is called (q.v.)
+ */
+void chanuser_delete_split(channel_t *chan)
+{
+	mowgli_node_t *n, *tn;
+	chanuser_t *cu;
+	unsigned int count = 0;
+
+	return_if_fail(chan != NULL);
+
+	chan->flags &= ~CHAN_SPLIT;
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, chan->members.head)
+	{
+		cu = n->data;
+		if (!(cu->user->flags & UF_SPLIT))
+			continue;
+
+		mowgli_node_delete(&cu->cnode, &chan->members);
+		mowgli_node_delete(&cu->unode, &cu->user->channels);
+		chanuser_hash_delete(cu);
+
+		mowgli_heap_free(chanuser_heap, cu);
+		count++;
+	}
+
+	chan->nummembers -= count;
+	cnt.chanuser -= count;
+
+	slog(LG_DEBUG, "chanuser_delete_split(): %s lost %u members (%u left)", chan->name, count, chan->nummembers);
+
+	if (chan->nummembers == 0 && !(chan->modes & ircd->perm_mode))
+		channel_delete(chan);
+}
+
 /*
  * chanuser_find(channel_t *chan, user_t *user)
  *
@@ -486,33 +616,14 @@ void chanuser_delete(channel_t *chan, user_t *user)
  */
 chanuser_t *chanuser_find(channel_t *chan, user_t *user)
 {
-	mowgli_node_t *n;
 	chanuser_t *cu;
 
 	return_val_if_fail(chan != NULL, NULL);
 	return_val_if_fail(user != NULL, NULL);
 
-	/* choose shortest list to search -- jilles */
-	if (MOWGLI_LIST_LENGTH(&user->channels) < MOWGLI_LIST_LENGTH(&chan->members))
-	{
-		MOWGLI_ITER_FOREACH(n, user->channels.head)
-		{
-			cu = (chanuser_t *)n->data;
-
-			if (cu->chan == chan)
-				return cu;
-		}
-	}
-	else
-	{
-		MOWGLI_ITER_FOREACH(n, chan->members.head)
-		{
-			cu = (chanuser_t *)n->data;
-
-			if (cu->user == user)
-				return cu;
-		}
-	}
+	for (cu = chanuser_hash[chanuser_hash_bucket(chan, user)]; cu != NULL; cu = cu->hnext)
+		if (cu->chan == chan && cu->user == user)
+			return cu;
 
 	return NULL;
 }
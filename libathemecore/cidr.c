@@ -252,50 +252,34 @@ inet_pton6(const char *src, u_char *dst)
  */
 int match_ips(const char *s1, const char *s2)
 {
-	unsigned char ipaddr[IN6ADDRSZ], maskaddr[IN6ADDRSZ];
-	char ipmask[BUFSIZE];
-	char ip[HOSTLEN + 1];
-	char *len;
-	int cidrlen;
+	cidr_addr_t addr;
 
 	if (s1 == NULL || s2 == NULL)
 		return 1;
 
-	mowgli_strlcpy(ipmask, s1, sizeof ipmask);
-	mowgli_strlcpy(ip, s2, sizeof ip);
-
-	len = strrchr(ipmask, '/');
-	if (len == NULL)
+	if (!cidr_parse_addr(s2, &addr))
 		return 1;
 
-	*len++ = '\0';
+	return match_ips_addr(s1, &addr);
+}
 
-	cidrlen = atoi(len);
-	if (cidrlen == 0)
+/*
+ * match_ips_addr()
+ *
+ * Input - cidr ip mask, address parsed by cidr_parse_addr()
+ * Output - 0 = Matched 1 = Did not match, as match_ips()
+ */
+int match_ips_addr(const char *s1, const cidr_addr_t *addr)
+{
+	cidr_mask_t mask;
+
+	if (s1 == NULL || addr == NULL || !addr->valid)
 		return 1;
 
-	if (strchr(ip, ':') && strchr(ipmask, ':'))
-	{
-		if (cidrlen > 128)
-			return 1;
-		if (!inet_pton6(ip, ipaddr))
-			return 1;
-		if (!inet_pton6(ipmask, maskaddr))
-			return 1;
-		return !comp_with_mask(ipaddr, maskaddr, cidrlen);
-	}
-	else if (!strchr(ip, ':') && !strchr(ipmask, ':'))
-	{
-		if (cidrlen > 32)
-			return 1;
-		if (!inet_pton4(ip, ipaddr))
-			return 1;
-		if (!inet_pton4(ipmask, maskaddr))
-			return 1;
-		return !comp_with_mask(ipaddr, maskaddr, cidrlen);
-	}
-	else
+	if (!cidr_parse_mask(s1, &mask))
 		return 1;
+
+	return !cidr_match(&mask, addr);
 }
 
 /* match_cidr()
@@ -307,19 +291,45 @@ int match_ips(const char *s1, const char *s2)
 int
 match_cidr(const char *s1, const char *s2)
 {
-	unsigned char ipaddr[IN6ADDRSZ], maskaddr[IN6ADDRSZ];
+	cidr_addr_t addr;
+	const char *ip;
+
+	return_val_if_fail(s1 != NULL, 1);
+	return_val_if_fail(s2 != NULL, 1);
+
+	ip = strrchr(s2, '@');
+	if (ip == NULL)
+		return 1;
+
+	if (!cidr_parse_addr(ip + 1, &addr))
+		return 1;
+
+	return match_cidr_addr(s1, s2, &addr);
+}
+
+/* match_cidr_addr()
+ *
+ * Input - mask n!u@i/c, address n!u@i, and i as parsed by cidr_parse_addr()
+ * Output - 0 = Matched 1 = Did not match, as match_cidr()
+ */
+int
+match_cidr_addr(const char *s1, const char *s2, const cidr_addr_t *addr)
+{
+	cidr_mask_t cidr;
 	char mask[BUFSIZE];
 	char address[NICKLEN + USERLEN + HOSTLEN + 6];
 	char *ipmask;
 	char *ip;
-	char *len;
-	int cidrlen;
 
 	return_val_if_fail(s1 != NULL, 1);
 	return_val_if_fail(s2 != NULL, 1);
+	return_val_if_fail(addr != NULL, 1);
+
+	/* most masks and many users have nothing to compare */
+	if (!addr->valid || strchr(s1, '/') == NULL)
+		return 1;
 
 	mowgli_strlcpy(mask, s1, sizeof mask);
-	mowgli_strlcpy(address, s2, sizeof address);
 
 	ipmask = strrchr(mask, '@');
 	if (ipmask == NULL)
@@ -327,45 +337,115 @@ match_cidr(const char *s1, const char *s2)
 
 	*ipmask++ = '\0';
 
+	if (!cidr_parse_mask(ipmask, &cidr) || !cidr_match(&cidr, addr))
+		return 1;
+
+	mowgli_strlcpy(address, s2, sizeof address);
+
 	ip = strrchr(address, '@');
 	if (ip == NULL)
 		return 1;
-	*ip++ = '\0';
+	*ip = '\0';
 
-	len = strrchr(ipmask, '/');
-	if (len == NULL)
-		return 1;
+	return match(mask, address);
+}
 
-	*len++ = '\0';
+/* cidr_parse_ip()
+ *
+ * Input - IPv4 or IPv6 address, buffer of IN6ADDRSZ bytes
+ * Output - true if the address was valid; *ip6 says which family it is
+ */
+bool
+cidr_parse_ip(const char *ip, unsigned char *addr, bool *ip6)
+{
+	return_val_if_fail(ip != NULL, false);
 
-	cidrlen = atoi(len);
-	if (cidrlen == 0)
-		return 1;
+	*ip6 = strchr(ip, ':') != NULL;
+	return *ip6 ? inet_pton6(ip, addr) : inet_pton4(ip, addr);
+}
 
-	if (strchr(ip, ':') && strchr(ipmask, ':'))
-	{
-		if (cidrlen > 128)
-			return 1;
-		if (!inet_pton6(ip, ipaddr))
-			return 1;
-		if (!inet_pton6(ipmask, maskaddr))
-			return 1;
-		return !comp_with_mask(ipaddr, maskaddr, cidrlen) ||
-			match(mask, address);
-	}
-	else if (!strchr(ip, ':') && !strchr(ipmask, ':'))
+/* cidr_match_addr()
+ *
+ * Input - two addresses of the same family as parsed by cidr_parse_ip(),
+ *         number of leading bits to compare
+ * Output - true if the first 'bits' bits are equal
+ */
+bool
+cidr_match_addr(const unsigned char *addr, const unsigned char *mask, int bits)
+{
+	return comp_with_mask((void *)addr, (void *)mask, bits);
+}
+
+/* cidr_parse_addr()
+ *
+ * Input - IPv4 or IPv6 address or NULL, cidr_addr_t to fill in
+ * Output - true if the address was valid; addr->valid says the same
+ */
+bool
+cidr_parse_addr(const char *ip, cidr_addr_t *addr)
+{
+	return_val_if_fail(addr != NULL, false);
+
+	addr->valid = ip != NULL && cidr_parse_ip(ip, addr->addr, &addr->ip6);
+	return addr->valid;
+}
+
+/* cidr_parse_mask()
+ *
+ * Input - address/bits, cidr_mask_t to fill in
+ * Output - true if the mask was valid as match_ips() understands it;
+ *          mask->bits is 0 otherwise
+ */
+bool
+cidr_parse_mask(const char *s, cidr_mask_t *mask)
+{
+	char buf[BUFSIZE];
+	const char *slash;
+	int bits;
+
+	return_val_if_fail(mask != NULL, false);
+
+	mask->bits = 0;
+	mask->addr.valid = false;
+
+	if (s == NULL)
+		return false;
+
+	slash = strrchr(s, '/');
+	if (slash == NULL || (size_t)(slash - s) >= sizeof buf)
+		return false;
+
+	bits = atoi(slash + 1);
+	if (bits <= 0)
+		return false;
+
+	mowgli_strlcpy(buf, s, slash - s + 1);
+	if (!cidr_parse_addr(buf, &mask->addr) || bits > (mask->addr.ip6 ? 128 : 32))
 	{
-		if (cidrlen > 32)
-			return 1;
-		if (!inet_pton4(ip, ipaddr))
-			return 1;
-		if (!inet_pton4(ipmask, maskaddr))
-			return 1;
-		return !comp_with_mask(ipaddr, maskaddr, cidrlen) ||
-			match(mask, address);
+		mask->addr.valid = false;
+		return false;
 	}
-	else
-		return 1;
+
+	mask->bits = bits;
+	return true;
+}
+
+/* cidr_match()
+ *
+ * Input - mask parsed by cidr_parse_mask(), address parsed by cidr_parse_addr()
+ * Output - true if both are valid, of the same family, and the address
+ *          falls inside the mask
+ */
+bool
+cidr_match(const cidr_mask_t *mask, const cidr_addr_t *addr)
+{
+	return_val_if_fail(mask != NULL, false);
+	return_val_if_fail(addr != NULL, false);
+
+	if (mask->bits == 0 || !addr->valid || mask->addr.ip6 != addr->ip6)
+		return false;
+
+	return comp_with_mask((void *)addr->addr, (void *)mask->addr.addr, mask->bits);
 }
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
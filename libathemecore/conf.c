@@ -241,6 +241,10 @@ void init_newconf(void)
 	add_duration_conf_item("KLINE_TIME", &conf_gi_table, 0, &config_options.kline_time, "d", 0);
 	add_duration_conf_item("CLONE_TIME", &conf_gi_table, 0, &config_options.clone_time, "m", 0);
 	add_duration_conf_item("COMMIT_INTERVAL", &conf_gi_table, 0, &config_options.commit_interval, "m", 300);
+	add_bool_conf_item("DB_SNAPSHOT", &conf_gi_table, 0, &config_options.db_snapshot, false);
+	add_bool_conf_item("DB_JOURNAL", &conf_gi_table, 0, &config_options.db_journal, false);
+	add_uint_conf_item("CRYPT_THREADS", &conf_gi_table, 0, &config_options.crypt_threads, 0, 64, 2);
+	add_uint_conf_item("DB_LOAD_THREADS", &conf_gi_table, 0, &config_options.db_load_threads, 0, 64, 0);
 	/* XXX: These options should probably move into operserv/clones eventually */
 	add_uint_conf_item("DEFAULT_CLONE_WARN", &conf_gi_table, 0, &config_options.default_clone_warn, 1, INT_MAX, 5);
 	add_uint_conf_item("DEFAULT_CLONE_ALLOWED", &conf_gi_table, 0, &config_options.default_clone_allowed, 1, INT_MAX, 5);
@@ -23,9 +23,28 @@
 
 #include "atheme.h"
 
+#if defined(HAVE_PTHREAD) && !defined(MOWGLI_OS_WIN)
+# define CRYPT_USE_THREADS
+# include <pthread.h>
+# include <poll.h>
+#endif
+
+/* the most jobs handed to the workers at once; past this, callers hash synchronously */
+#define CRYPT_JOBS_MAX		1024
+
 static mowgli_list_t crypt_impl_list = { NULL, NULL, 0 };
 bool crypto_module_loaded = false;
 
+#ifdef CRYPT_USE_THREADS
+static int crypt_job_pipe[2] = { -1, -1 };
+static int crypt_done_pipe[2] = { -1, -1 };
+static connection_t *crypt_done_conn = NULL;
+static unsigned int crypt_threads = 0;
+static unsigned int crypt_jobs_queued = 0;
+static mowgli_list_t crypt_done_list = { NULL, NULL, 0 };
+static mowgli_eventloop_timer_t *crypt_dispatch_timer = NULL;
+#endif
+
 static const char *generic_crypt_string(const char *str, const char *salt)
 {
 	return str;
@@ -88,6 +107,239 @@ const char *gen_salt(void)
 	return ci->salt();
 }
 
+#ifdef CRYPT_USE_THREADS
+/*
+ * The workers block on a pipe of job pointers, run crypt_r() and pass the
+ * pointer back through a second pipe, which the event loop watches.  Only
+ * the event loop ever touches a job's list node, callback or cancelled flag.
+ */
+static void *crypt_worker(void *arg)
+{
+	crypt_job_t *job;
+	ssize_t n;
+
+	for (;;)
+	{
+		n = read(crypt_job_pipe[0], &job, sizeof job);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n != sizeof job)
+			break;
+
+		job->ok = job->ci->crypt_r(job->key, job->salt, job->result, sizeof job->result);
+
+		while (write(crypt_done_pipe[1], &job, sizeof job) < 0 && errno == EINTR)
+			;
+	}
+
+	return NULL;
+}
+
+static void crypt_job_free(crypt_job_t *job)
+{
+	memset(job->key, 0, strlen(job->key));
+	free(job->key);
+	free(job);
+}
+
+static void crypt_dispatch(void *unused)
+{
+	mowgli_node_t *n;
+	crypt_job_t *job;
+
+	crypt_dispatch_timer = NULL;
+
+	/* callbacks may submit or cancel jobs, so do not hold on to an iterator */
+	while ((n = crypt_done_list.head) != NULL)
+	{
+		job = n->data;
+		mowgli_node_delete(n, &crypt_done_list);
+
+		if (!job->cancelled)
+			job->cb(job);
+
+		crypt_job_free(job);
+	}
+}
+
+static void crypt_done_collect(void)
+{
+	crypt_job_t *jobs[64];
+	ssize_t n;
+	size_t i;
+
+	/* each write is a whole pointer, so reads come in whole pointers too */
+	while ((n = read(crypt_done_pipe[0], jobs, sizeof jobs)) > 0)
+	{
+		for (i = 0; i < n / sizeof jobs[0]; i++)
+		{
+			crypt_jobs_queued--;
+			mowgli_node_add(jobs[i], &jobs[i]->node, &crypt_done_list);
+		}
+	}
+}
+
+static void crypt_done_read(connection_t *cptr)
+{
+	crypt_done_collect();
+	crypt_dispatch(NULL);
+}
+
+static void crypt_set_cloexec(int fd)
+{
+	fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+}
+
+static void crypt_pool_start(void)
+{
+	sigset_t all, old;
+	pthread_t thread;
+
+	if (crypt_job_pipe[0] == -1)
+	{
+		if (pipe(crypt_job_pipe) < 0)
+		{
+			slog(LG_ERROR, "crypt_pool_start(): pipe() failed: %s", strerror(errno));
+			return;
+		}
+
+		if (pipe(crypt_done_pipe) < 0)
+		{
+			slog(LG_ERROR, "crypt_pool_start(): pipe() failed: %s", strerror(errno));
+			close(crypt_job_pipe[0]);
+			close(crypt_job_pipe[1]);
+			crypt_job_pipe[0] = crypt_job_pipe[1] = -1;
+			return;
+		}
+
+		crypt_set_cloexec(crypt_job_pipe[0]);
+		crypt_set_cloexec(crypt_job_pipe[1]);
+		crypt_set_cloexec(crypt_done_pipe[0]);
+		crypt_set_cloexec(crypt_done_pipe[1]);
+
+		crypt_done_conn = connection_add("crypto workers", crypt_done_pipe[0], 0, crypt_done_read, NULL);
+	}
+
+	/* signals are for the main thread to handle */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+
+	while (crypt_threads < config_options.crypt_threads)
+	{
+		if (pthread_create(&thread, NULL, crypt_worker, NULL) != 0)
+		{
+			slog(LG_ERROR, "crypt_pool_start(): cannot start a worker thread: %s", strerror(errno));
+			break;
+		}
+
+		pthread_detach(thread);
+		crypt_threads++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	slog(LG_DEBUG, "crypt_pool_start(): %u worker threads running", crypt_threads);
+}
+
+/* waits for the workers to finish everything they were given */
+static void crypt_pool_drain(void)
+{
+	struct pollfd pfd;
+
+	while (crypt_jobs_queued > 0)
+	{
+		pfd.fd = crypt_done_pipe[0];
+		pfd.events = POLLIN;
+
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+		{
+			slog(LG_ERROR, "crypt_pool_drain(): poll() failed: %s", strerror(errno));
+			break;
+		}
+
+		crypt_done_collect();
+	}
+
+	/* run the callbacks from the event loop, not from under whoever called us */
+	if (crypt_done_list.head != NULL && crypt_dispatch_timer == NULL)
+		crypt_dispatch_timer = mowgli_timer_add_once(base_eventloop, "crypt_dispatch", crypt_dispatch, NULL, 0);
+}
+#endif
+
+/*
+ * crypt_job_submit(const crypt_impl_t *ci, const char *key, const char *salt,
+ *                  crypt_job_cb_t cb, void *priv)
+ *
+ * Hands a crypt_r() call to the worker threads.
+ *
+ * Inputs:
+ *       - the crypt scheme to use
+ *       - the key and salt, which are copied
+ *       - a callback to run from the event loop once the job is done
+ *       - opaque data for the callback
+ *
+ * Outputs:
+ *       - the job, or NULL if it cannot be run in the background (no
+ *         threads, no crypt_r() for this scheme, or too much queued
+ *         already); the caller should then hash synchronously
+ *
+ * Side Effects:
+ *       - the worker threads are started on first use
+ */
+crypt_job_t *crypt_job_submit(const crypt_impl_t *ci, const char *key, const char *salt, crypt_job_cb_t cb, void *priv)
+{
+#ifdef CRYPT_USE_THREADS
+	crypt_job_t *job;
+
+	return_val_if_fail(ci != NULL, NULL);
+	return_val_if_fail(key != NULL, NULL);
+	return_val_if_fail(salt != NULL, NULL);
+	return_val_if_fail(cb != NULL, NULL);
+
+	if (ci->crypt_r == NULL || config_options.crypt_threads == 0 || crypt_jobs_queued >= CRYPT_JOBS_MAX)
+		return NULL;
+
+	if (crypt_threads < config_options.crypt_threads)
+		crypt_pool_start();
+	if (crypt_threads == 0)
+		return NULL;
+
+	job = smalloc(sizeof *job);
+	job->ci = ci;
+	job->key = sstrdup(key);
+	mowgli_strlcpy(job->salt, salt, sizeof job->salt);
+	job->cb = cb;
+	job->priv = priv;
+
+	/* CRYPT_JOBS_MAX pointers fit in the pipe, so this never blocks */
+	if (write(crypt_job_pipe[1], &job, sizeof job) != sizeof job)
+	{
+		slog(LG_ERROR, "crypt_job_submit(): write() failed: %s", strerror(errno));
+		crypt_job_free(job);
+		return NULL;
+	}
+
+	crypt_jobs_queued++;
+
+	return job;
+#else
+	return NULL;
+#endif
+}
+
+/*
+ * crypt_job_cancel(crypt_job_t *job)
+ *
+ * Makes sure the callback of a submitted job is never called.  The job
+ * itself is freed once the workers are done with it.
+ */
+void crypt_job_cancel(crypt_job_t *job)
+{
+	return_if_fail(job != NULL);
+
+	job->cancelled = true;
+}
+
 void crypt_register(crypt_impl_t *impl)
 {
 	return_if_fail(impl != NULL);
@@ -106,6 +358,12 @@ void crypt_unregister(crypt_impl_t *impl)
 {
 	return_if_fail(impl != NULL);
 
+#ifdef CRYPT_USE_THREADS
+	/* the workers may still be running code from the module going away */
+	if (impl->crypt_r != NULL)
+		crypt_pool_drain();
+#endif
+
 	mowgli_node_delete(&impl->node, &crypt_impl_list);
 
 	crypto_module_loaded = MOWGLI_LIST_LENGTH(&crypt_impl_list) > 0 ? true : false;
@@ -115,6 +373,15 @@ void crypt_unregister(crypt_impl_t *impl)
  * crypt_verify_password is a frontend to crypt_string().
  */
 const crypt_impl_t *crypt_verify_password(const char *uinput, const char *pass)
+{
+	return crypt_verify_password_skip(uinput, pass, NULL);
+}
+
+/*
+ * crypt_verify_password_skip is crypt_verify_password() without trying the
+ * given scheme, for when a worker thread has already ruled it out.
+ */
+const crypt_impl_t *crypt_verify_password_skip(const char *uinput, const char *pass, const crypt_impl_t *skip)
 {
 	mowgli_node_t *n;
 	const char *cstr;
@@ -124,6 +391,9 @@ const crypt_impl_t *crypt_verify_password(const char *uinput, const char *pass)
 		crypt_impl_t *ci;
 
 		ci = n->data;
+		if (ci == skip)
+			continue;
+
 		cstr = ci->crypt(uinput, pass);
 
 		if (!strcmp(cstr, pass))
@@ -10,6 +10,9 @@
 database_module_t *db_mod = NULL;
 mowgli_patricia_t *db_types = NULL;
 
+bool db_journal_enabled = false;
+static database_handle_t *db_journal = NULL;
+
 database_handle_t *
 db_open(const char *filename, database_transaction_t txn)
 {
@@ -257,14 +260,18 @@ db_unregister_type_handler(const char *type)
 	mowgli_patricia_delete(db_types, type);
 }
 
-void
-db_process(database_handle_t *db, const char *type)
+/*
+ * Returns the handler for a row type, or the "???" handler for unknown
+ * types.  Backends which see the same type many times may keep the result
+ * for the duration of a db_parse() instead of calling db_process().
+ */
+database_handler_f
+db_find_type_handler(const char *type)
 {
 	database_handler_f fun;
 
-	return_if_fail(db_types != NULL);
-	return_if_fail(db != NULL);
-	return_if_fail(type != NULL);
+	return_val_if_fail(db_types != NULL, NULL);
+	return_val_if_fail(type != NULL, NULL);
 
 	fun = mowgli_patricia_retrieve(db_types, type);
 
@@ -273,7 +280,18 @@ db_process(database_handle_t *db, const char *type)
 		fun = mowgli_patricia_retrieve(db_types, "???");
 	}
 
-	fun(db, type);
+	return fun;
+}
+
+void
+db_process(database_handle_t *db, const char *type)
+{
+	database_handler_f fun;
+
+	return_if_fail(db != NULL);
+
+	if ((fun = db_find_type_handler(type)) != NULL)
+		fun(db, type);
 }
 
 bool
@@ -289,6 +307,40 @@ db_write_format(database_handle_t *db, const char *fmt, ...)
 	return db_write_word(db, buf);
 }
 
+/*
+ * Starts a row in the mutation journal, opening it if needed.  Returns NULL
+ * if journaling is off; otherwise write the cells and db_commit_row().
+ *
+ * Committed rows are flushed but never fsync()ed: the journal survives a
+ * crash of services, not of the host.
+ */
+database_handle_t *
+db_journal_row(const char *type)
+{
+	if (!db_journal_enabled)
+		return NULL;
+
+	if (db_journal == NULL && (db_journal = db_open(DB_JOURNAL_FILE, DB_JOURNAL)) == NULL)
+	{
+		slog(LG_ERROR, "db-journal-row: cannot open journal; journaling disabled until the next rehash");
+		db_journal_enabled = false;
+		return NULL;
+	}
+
+	db_start_row(db_journal, type);
+	return db_journal;
+}
+
+void
+db_journal_close(void)
+{
+	if (db_journal == NULL)
+		return;
+
+	db_close(db_journal);
+	db_journal = NULL;
+}
+
 void
 db_init(void)
 {
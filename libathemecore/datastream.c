@@ -26,10 +26,15 @@
 
 #define SENDQSIZE (4096 - 40)
 
+/* how many chunks sendq_flush() hands to the kernel in one call */
+#define SENDQ_IOVMAX 64
+
 #ifdef MOWGLI_OS_WIN
 # define EWOULDBLOCK	WSAEWOULDBLOCK
 # define EALREADY	WSAEALREADY
 # define ENOBUFS	WSAENOBUFS
+#else
+# include <sys/uio.h>
 #endif
 
 /* sendq struct */
@@ -40,6 +45,30 @@ struct sendq {
 	char buf[SENDQSIZE];
 };
 
+/* chunks are shared between all connections and recycled, a burst
+ * otherwise allocates and frees thousands of them */
+static mowgli_heap_t *sendq_heap = NULL;
+
+static struct sendq *sendq_chunk_new(connection_t *cptr)
+{
+	struct sendq *sq;
+
+	if (sendq_heap == NULL)
+		sendq_heap = sharedheap_get(sizeof(struct sendq));
+
+	sq = mowgli_heap_alloc(sendq_heap);
+	sq->firstused = sq->firstfree = 0;
+	mowgli_node_add(sq, &sq->node, &cptr->sendq);
+
+	return sq;
+}
+
+static void sendq_chunk_delete(connection_t *cptr, struct sendq *sq)
+{
+	mowgli_node_delete(&sq->node, &cptr->sendq);
+	mowgli_heap_free(sendq_heap, sq);
+}
+
 void sendq_add(connection_t * cptr, char *buf, size_t len)
 {
 	mowgli_node_t *n;
@@ -67,6 +96,8 @@ void sendq_add(connection_t * cptr, char *buf, size_t len)
 		return;
 	}
 
+	/* nothing is written here; the data goes out with everything else
+	 * queued in this loop iteration once the socket polls writable */
 	if (!sendq_nonempty(cptr))
 		connection_setselect_write(cptr, sendq_flush);
 
@@ -85,9 +116,7 @@ void sendq_add(connection_t * cptr, char *buf, size_t len)
 
 	while (len > 0)
 	{
-		sq = smalloc(sizeof(struct sendq));
-		sq->firstused = sq->firstfree = 0;
-		mowgli_node_add(sq, &sq->node, &cptr->sendq);
+		sq = sendq_chunk_new(cptr);
 		l = SENDQSIZE - sq->firstfree;
 		if (l > len)
 			l = len;
@@ -112,26 +141,74 @@ void sendq_add_eof(connection_t * cptr)
 	cptr->flags |= CF_SEND_EOF;
 }
 
+/* writes as many queued chunks as possible in one system call */
+static ssize_t sendq_write(connection_t *cptr, size_t *offered)
+{
+	mowgli_node_t *n;
+	struct sendq *sq;
+#ifndef MOWGLI_OS_WIN
+	struct iovec iov[SENDQ_IOVMAX];
+	int iovcnt = 0;
+
+	*offered = 0;
+
+	MOWGLI_ITER_FOREACH(n, cptr->sendq.head)
+	{
+		sq = n->data;
+
+		if (sq->firstused == sq->firstfree || iovcnt == SENDQ_IOVMAX)
+			break;
+
+		iov[iovcnt].iov_base = sq->buf + sq->firstused;
+		iov[iovcnt].iov_len = sq->firstfree - sq->firstused;
+		*offered += iov[iovcnt].iov_len;
+		iovcnt++;
+	}
+
+	if (iovcnt == 0)
+		return 0;
+
+	cnt.bwrites++;
+	return writev(cptr->fd, iov, iovcnt);
+#else
+	*offered = 0;
+
+	n = cptr->sendq.head;
+	if (n == NULL)
+		return 0;
+
+	sq = n->data;
+	if (sq->firstused == sq->firstfree)
+		return 0;
+
+	*offered = sq->firstfree - sq->firstused;
+
+	cnt.bwrites++;
+	return send(cptr->fd, sq->buf + sq->firstused, sq->firstfree - sq->firstused, 0);
+#endif
+}
+
 void sendq_flush(connection_t * cptr)
 {
-        mowgli_node_t *n, *tn;
-        struct sendq *sq;
-        int l;
+	mowgli_node_t *n, *tn;
+	struct sendq *sq;
+	ssize_t l;
+	size_t offered;
+	int chunk;
 
 	return_if_fail(cptr != NULL);
 
-        MOWGLI_ITER_FOREACH_SAFE(n, tn, cptr->sendq.head)
-        {
-                sq = (struct sendq *)n->data;
-
-                if (sq->firstused == sq->firstfree)
-                        break;
+	for (;;)
+	{
+		l = sendq_write(cptr, &offered);
+		if (offered == 0)
+			break;
 
-                if ((l = send(cptr->fd, sq->buf + sq->firstused, sq->firstfree - sq->firstused, 0)) == -1)
-                {
-                        int err = ioerrno();
+		if (l == -1)
+		{
+			int err = ioerrno();
 
-                        if (!mowgli_eventloop_ignore_errno(err))
+			if (!mowgli_eventloop_ignore_errno(err))
 			{
 				slog(LG_DEBUG, "sendq_flush(): write error %d (%s) on connection %s[%d]",
 						err, strerror(err),
@@ -139,24 +216,39 @@ void sendq_flush(connection_t * cptr)
 				cptr->flags |= CF_DEAD;
 			}
 
-                        return;
-                }
+			return;
+		}
 
-                sq->firstused += l;
-                if (sq->firstused == sq->firstfree)
-                {
-			if (MOWGLI_LIST_LENGTH(&cptr->sendq) > 1)
+		/* drop what was written, chunk by chunk */
+		MOWGLI_ITER_FOREACH_SAFE(n, tn, cptr->sendq.head)
+		{
+			sq = n->data;
+
+			chunk = sq->firstfree - sq->firstused;
+			if (l < chunk)
 			{
-                        	mowgli_node_delete(&sq->node, &cptr->sendq);
-                        	free(sq);
+				sq->firstused += l;
+				break;
 			}
+
+			l -= chunk;
+			offered -= chunk;
+
+			if (MOWGLI_LIST_LENGTH(&cptr->sendq) > 1)
+				sendq_chunk_delete(cptr, sq);
 			else
 				/* keep one struct sendq */
 				sq->firstused = sq->firstfree = 0;
-                }
-                else
-                        return;
-        }
+
+			if (l == 0)
+				break;
+		}
+
+		/* the kernel took less than offered, wait for the next poll */
+		if (offered != 0)
+			return;
+	}
+
 	if (cptr->flags & CF_SEND_EOF)
 	{
 		/* shut down write end, kill entire connection
@@ -192,24 +284,51 @@ void sendq_set_limit(connection_t *cptr, size_t len)
 	cptr->sendq_limit = len;
 }
 
+/*
+ * The receive queue is a single buffer holding everything not yet
+ * handled, so that complete lines can be handed out where they lie.
+ * Handled data is dropped by advancing the head; what is left is only
+ * moved to the front (usually a partial line) when the end of the
+ * buffer is reached, and the buffer doubles when that is not enough.
+ */
+#define RECVQSIZE 16384
+
 int recvq_length(connection_t *cptr)
 {
-	int l = 0;
-	mowgli_node_t *n;
-	struct sendq *sq;
+	return cptr->recvq.tail - cptr->recvq.head;
+}
+
+/* makes room for at least SENDQSIZE more bytes at the end */
+static void recvq_reserve(recvq_t *rq)
+{
+	if (rq->size - rq->tail >= SENDQSIZE)
+		return;
 
-	MOWGLI_ITER_FOREACH(n, cptr->recvq.head)
+	if (rq->head > 0)
 	{
-		sq = n->data;
-		l += sq->firstfree - sq->firstused;
+		memmove(rq->buf, rq->buf + rq->head, rq->tail - rq->head);
+		rq->tail -= rq->head;
+		rq->head = 0;
 	}
-	return l;
+
+	if (rq->size - rq->tail >= SENDQSIZE)
+		return;
+
+	rq->size = rq->size != 0 ? rq->size * 2 : RECVQSIZE;
+	rq->buf = srealloc(rq->buf, rq->size);
+}
+
+/* drops count handled bytes from the front */
+static void recvq_consume(recvq_t *rq, size_t count)
+{
+	rq->head += count;
+	if (rq->head == rq->tail)
+		rq->head = rq->tail = 0;
 }
 
 void recvq_put(connection_t *cptr)
 {
-	mowgli_node_t *n;
-	struct sendq *sq = NULL;
+	recvq_t *rq;
 	int l, ll;
 
 	return_if_fail(cptr != NULL);
@@ -228,24 +347,11 @@ void recvq_put(connection_t *cptr)
 		return;
 	}
 
-	n = cptr->recvq.tail;
-	if (n != NULL)
-	{
-		sq = n->data;
-		l = SENDQSIZE - sq->firstfree;
-		if (l == 0)
-			sq = NULL;
-	}
-	if (sq == NULL)
-	{
-		sq = smalloc(sizeof(struct sendq));
-		sq->firstused = sq->firstfree = 0;
-		mowgli_node_add(sq, &sq->node, &cptr->recvq);
-		l = SENDQSIZE;
-	}
+	rq = &cptr->recvq;
+	recvq_reserve(rq);
 	errno = 0;
 
-	l = recv(cptr->fd, sq->buf + sq->firstfree, l, 0);
+	l = recv(cptr->fd, rq->buf + rq->tail, rq->size - rq->tail, 0);
 	if (l == 0 || (l < 0 && !mowgli_eventloop_ignore_errno(ioerrno())))
 	{
 		if (l == 0)
@@ -256,7 +362,7 @@ void recvq_put(connection_t *cptr)
 		return;
 	}
 	else if (l > 0)
-		sq->firstfree += l;
+		rq->tail += l;
 
 	if (cptr->recvq_handler)
 	{
@@ -266,106 +372,94 @@ void recvq_put(connection_t *cptr)
 			cptr->recvq_handler(cptr);
 			ll = l;
 			l = recvq_length(cptr);
-		} while (ll != l && l != 0);
+		} while (ll != l && l != 0 && cptr->recvq_handler != NULL);
 	}
 	return;
 }
 
 int recvq_get(connection_t *cptr, char *buf, size_t len)
 {
-	mowgli_node_t *n, *tn;
-	struct sendq *sq;
 	size_t l;
-	char *p = buf;
 
 	return_val_if_fail(cptr != NULL, 0);
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, cptr->recvq.head)
-	{
-		sq = (struct sendq *)n->data;
+	l = recvq_length(cptr);
+	if (l > len)
+		l = len;
 
-		if (sq->firstused == sq->firstfree || len <= 0)
-			break;
+	memcpy(buf, cptr->recvq.buf + cptr->recvq.head, l);
+	recvq_consume(&cptr->recvq, l);
 
-		l = sq->firstfree - sq->firstused;
-		if (l > len)
-			l = len;
-		memcpy(p, sq->buf + sq->firstused, l);
+	return l;
+}
 
-		p += l;
-		len -= l;
-		sq->firstused += l;
-		if (sq->firstused == sq->firstfree)
-		{
-			if (MOWGLI_LIST_LENGTH(&cptr->recvq) > 1)
-			{
-				mowgli_node_delete(&sq->node, &cptr->recvq);
-				free(sq);
-			}
-			else
-				/* keep one struct sendq */
-				sq->firstused = sq->firstfree = 0;
-		}
-		else
-			return p - buf;
+/*
+ * recvq_getline_ref(connection_t *cptr, size_t len, size_t *count)
+ *
+ * Like recvq_getline(), but instead of copying the line out, returns where
+ * it lies in the receive queue.  The line is consumed and stays valid
+ * until the next recvq_put().  If it ended in a newline, that is replaced
+ * by a '\0'; otherwise CF_NONEWLINE is set and the count bytes returned
+ * are not terminated.
+ *
+ * Inputs:
+ *       - the connection
+ *       - the most bytes to return if there is no newline before then
+ *       - where to store the number of bytes consumed
+ *
+ * Outputs:
+ *       - the start of the line, or NULL if there is no complete line yet
+ */
+char *recvq_getline_ref(connection_t *cptr, size_t len, size_t *count)
+{
+	recvq_t *rq;
+	char *line, *newline;
+	size_t l;
+
+	return_val_if_fail(cptr != NULL, NULL);
+	return_val_if_fail(count != NULL, NULL);
+
+	rq = &cptr->recvq;
+	line = rq->buf + rq->head;
+	l = rq->tail - rq->head;
+	if (l > len)
+		l = len;
+
+	newline = l != 0 ? memchr(line, '\n', l) : NULL;
+	if (newline == NULL && (l == 0 || l < len))
+		return NULL;
+
+	if (newline != NULL)
+	{
+		cptr->flags &= ~CF_NONEWLINE;
+		l = newline - line + 1;
+		*newline = '\0';
 	}
-	return p - buf;
+	else
+		cptr->flags |= CF_NONEWLINE;
+
+	*count = l;
+	recvq_consume(rq, l);
+
+	return line;
 }
 
 int recvq_getline(connection_t *cptr, char *buf, size_t len)
 {
-	mowgli_node_t *n, *tn;
-	struct sendq *sq, *sq2 = NULL;
-	size_t l = 0;
-	char *p = buf;
-	char *newline = NULL;
+	char *line;
+	size_t l;
 
 	return_val_if_fail(cptr != NULL, 0);
 
-	MOWGLI_ITER_FOREACH(n, cptr->recvq.head)
-	{
-		sq2 = n->data;
-		l += sq2->firstfree - sq2->firstused;
-		newline = memchr(sq2->buf + sq2->firstused, '\n', sq2->firstfree - sq2->firstused);
-		if (newline != NULL || l >= len)
-			break;
-	}
-	if (newline == NULL && l < len)
+	line = recvq_getline_ref(cptr, len, &l);
+	if (line == NULL)
 		return 0;
 
-	cptr->flags |= CF_NONEWLINE;
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, cptr->recvq.head)
-	{
-		sq = (struct sendq *)n->data;
-
-		if (sq->firstused == sq->firstfree || len <= 0)
-			break;
+	memcpy(buf, line, l);
+	if (!(cptr->flags & CF_NONEWLINE))
+		buf[l - 1] = '\n';
 
-		l = sq->firstfree - sq->firstused;
-		if (l > len)
-			l = len;
-		if (sq == sq2 && l >= (size_t) (newline - sq->buf - sq->firstused + 1))
-			cptr->flags &= ~CF_NONEWLINE, l = newline - sq->buf - sq->firstused + 1;
-		memcpy(p, sq->buf + sq->firstused, l);
-
-		p += l;
-		len -= l;
-		sq->firstused += l;
-		if (sq->firstused == sq->firstfree)
-		{
-			if (MOWGLI_LIST_LENGTH(&cptr->recvq) > 1)
-			{
-				mowgli_node_delete(&sq->node, &cptr->recvq);
-				free(sq);
-			}
-			else
-				/* keep one struct sendq */
-				sq->firstused = sq->firstfree = 0;
-		}
-		else
-			return p - buf;
-	}
-	return p - buf;
+	return l;
 }
 
 void sendqrecvq_free(connection_t *cptr)
@@ -373,20 +467,15 @@ void sendqrecvq_free(connection_t *cptr)
 	mowgli_node_t *nptr, *nptr2;
 	struct sendq *sq;
 
-	MOWGLI_ITER_FOREACH_SAFE(nptr, nptr2, cptr->recvq.head)
-	{
-		sq = nptr->data;
-
-		mowgli_node_delete(&sq->node, &cptr->recvq);
-		free(sq);
-	}
+	free(cptr->recvq.buf);
+	cptr->recvq.buf = NULL;
+	cptr->recvq.size = cptr->recvq.head = cptr->recvq.tail = 0;
 
 	MOWGLI_ITER_FOREACH_SAFE(nptr, nptr2, cptr->sendq.head)
 	{
 		sq = nptr->data;
 
-		mowgli_node_delete(&sq->node, &cptr->sendq);
-		free(sq);
+		sendq_chunk_delete(cptr, sq);
 	}
 }
 
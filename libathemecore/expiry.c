@@ -0,0 +1,170 @@
+/*
+ * atheme-services: A collection of minimalist IRC services
+ * expiry.c: Queues of objects ordered by when they expire.
+ *
+ * Copyright (c) 2014 Atheme Project (http://www.atheme.org)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "atheme.h"
+
+static inline void expiry_queue_place(expiry_queue_t *q, expiry_node_t *n, unsigned int i)
+{
+	q->nodes[i] = n;
+	n->slot = i + 1;
+}
+
+static void expiry_queue_up(expiry_queue_t *q, unsigned int i)
+{
+	expiry_node_t *n = q->nodes[i];
+
+	while (i > 0 && q->nodes[(i - 1) / 2]->when > n->when)
+	{
+		expiry_queue_place(q, q->nodes[(i - 1) / 2], i);
+		i = (i - 1) / 2;
+	}
+
+	expiry_queue_place(q, n, i);
+}
+
+static void expiry_queue_down(expiry_queue_t *q, unsigned int i)
+{
+	expiry_node_t *n = q->nodes[i];
+	unsigned int child;
+
+	while ((child = 2 * i + 1) < q->count)
+	{
+		if (child + 1 < q->count && q->nodes[child + 1]->when < q->nodes[child]->when)
+			child++;
+		if (q->nodes[child]->when >= n->when)
+			break;
+
+		expiry_queue_place(q, q->nodes[child], i);
+		i = child;
+	}
+
+	expiry_queue_place(q, n, i);
+}
+
+/*
+ * expiry_queue_set(expiry_queue_t *q, expiry_node_t *n, void *data, time_t when)
+ *
+ * Queues an object to expire at the given time, or moves it if it is
+ * already queued.
+ *
+ * Inputs:
+ *       - the queue
+ *       - the expiry_node_t embedded in the object
+ *       - the object, which expiry_queue_pop() will return
+ *       - when the object expires
+ *
+ * Outputs:
+ *       - nothing
+ */
+void expiry_queue_set(expiry_queue_t *q, expiry_node_t *n, void *data, time_t when)
+{
+	time_t old;
+
+	return_if_fail(q != NULL);
+	return_if_fail(n != NULL);
+
+	old = n->when;
+	n->when = when;
+	n->data = data;
+
+	if (n->slot != 0)
+	{
+		if (when < old)
+			expiry_queue_up(q, n->slot - 1);
+		else
+			expiry_queue_down(q, n->slot - 1);
+		return;
+	}
+
+	if (q->count == q->size)
+	{
+		q->size = q->size != 0 ? q->size * 2 : 64;
+		q->nodes = srealloc(q->nodes, q->size * sizeof(expiry_node_t *));
+	}
+
+	q->nodes[q->count++] = n;
+	expiry_queue_up(q, q->count - 1);
+}
+
+/*
+ * expiry_queue_delete(expiry_queue_t *q, expiry_node_t *n)
+ *
+ * Takes an object off the queue; nothing happens if it is not queued.
+ */
+void expiry_queue_delete(expiry_queue_t *q, expiry_node_t *n)
+{
+	unsigned int i;
+	expiry_node_t *last;
+
+	return_if_fail(q != NULL);
+	return_if_fail(n != NULL);
+
+	if (n->slot == 0)
+		return;
+
+	i = n->slot - 1;
+	n->slot = 0;
+
+	last = q->nodes[--q->count];
+	if (last == n)
+		return;
+
+	expiry_queue_place(q, last, i);
+	if (i > 0 && q->nodes[(i - 1) / 2]->when > last->when)
+		expiry_queue_up(q, i);
+	else
+		expiry_queue_down(q, i);
+}
+
+/*
+ * expiry_queue_pop(expiry_queue_t *q, time_t now)
+ *
+ * Takes the object that expires first off the queue, if it has expired.
+ *
+ * Inputs:
+ *       - the queue
+ *       - the current time
+ *
+ * Outputs:
+ *       - the object, or NULL if nothing has expired by now
+ */
+void *expiry_queue_pop(expiry_queue_t *q, time_t now)
+{
+	expiry_node_t *n;
+
+	return_val_if_fail(q != NULL, NULL);
+
+	if (q->count == 0 || q->nodes[0]->when > now)
+		return NULL;
+
+	n = q->nodes[0];
+	expiry_queue_delete(q, n);
+
+	return n->data;
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
@@ -712,6 +712,7 @@ int sendemail(user_t *u, myuser_t *mu, const char *type, const char *email, cons
 		fclose(in);
 		return 0;
 	}
+	log_flush(NULL);
 	switch (pid = fork())
 	{
 		case -1:
@@ -26,7 +26,7 @@
 #include "internal.h"
 
 mowgli_patricia_t *hooks;
-static mowgli_heap_t *hook_heap, *hook_privfn_heap;
+static mowgli_heap_t *hook_heap;
 
 typedef struct {
 	hook_t *hook;
@@ -35,27 +35,40 @@ typedef struct {
 	unsigned int flags;
 } hook_run_ctx_t;
 
-typedef struct {
-	hookfn_t hookfn;
-	mowgli_node_t node;
-} hook_privfn_ctx_t;
-
 #define HF_RUN		0x1
 #define HF_STOP		0x2
 
 static mowgli_list_t hook_run_stack = { NULL, NULL, 0 };
 
+/* the hooks from hooktypes.in are plain globals, so that calling one does
+ * not need a lookup by name; they are still entered in the hooks tree so
+ * that hook_add_hook() and friends find them */
+#define HOOK_DEFINE(name) hook_t hook_handle_##name;
+HOOKTYPES_FOREACH(HOOK_DEFINE)
+#undef HOOK_DEFINE
+
+static void hook_register_builtin(hook_t *h, const char *name)
+{
+	h->name = strshare_get(name);
+	h->builtin = true;
+
+	mowgli_patricia_add(hooks, h->name, h);
+}
+
 void hooks_init(void)
 {
 	hooks = mowgli_patricia_create(strcasecanon);
 	hook_heap = sharedheap_get(sizeof(hook_t));
-	hook_privfn_heap = sharedheap_get(sizeof(hook_privfn_ctx_t));
 
-	if (hook_heap == NULL || hook_privfn_heap == NULL || hooks == NULL)
+	if (hook_heap == NULL || hooks == NULL)
 	{
 		slog(LG_INFO, "hooks_init(): block allocator failed.");
 		exit(EXIT_SUCCESS);
 	}
+
+#define HOOK_REGISTER(name) hook_register_builtin(&hook_handle_##name, #name);
+	HOOKTYPES_FOREACH(HOOK_REGISTER)
+#undef HOOK_REGISTER
 }
 
 static inline hook_t *hook_find(const char *name)
@@ -78,32 +91,60 @@ hook_t *hook_add_event(const char *name)
 	return nh;
 }
 
-static inline void hook_destroy(hook_t *hook, hook_privfn_ctx_t *priv)
+/* squeezes out the handlers that were removed while the hook was running */
+static void hook_compact(hook_t *h)
 {
-	mowgli_node_delete(&priv->node, &hook->hooks);
-	mowgli_heap_free(hook_privfn_heap, priv);
+	unsigned int i, j;
+
+	for (i = j = 0; i < h->count; i++)
+		if (h->fns[i] != NULL)
+			h->fns[j++] = h->fns[i];
+
+	h->count = j;
+	h->dirty = false;
 }
 
 void hook_del_event(const char *name)
 {
 	hook_t *h;
-	mowgli_node_t *n, *tn;
 
 	if ((h = hook_find(name)) == NULL)
 		return;
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, h->hooks.head)
-		hook_destroy(h, n->data);
+	/* the handles from hooktypes.in are shared by everyone and stay */
+	if (h->builtin)
+		return;
 
 	mowgli_patricia_delete(hooks, h->name);
 	strshare_unref(h->name);
 
+	free(h->fns);
 	mowgli_heap_free(hook_heap, h);
 }
 
+void hook_del_handle(hook_t *h, hookfn_t handler)
+{
+	unsigned int i;
+
+	return_if_fail(h != NULL);
+	return_if_fail(handler != NULL);
+
+	for (i = 0; i < h->count; i++)
+	{
+		if (h->fns[i] != handler)
+			continue;
+
+		/* a running hook_run() walks fns by index, don't move anything */
+		h->fns[i] = NULL;
+		h->dirty = true;
+	}
+
+	if (h->dirty && h->running == 0)
+		hook_compact(h);
+}
+
 void hook_del_hook(const char *event, hookfn_t handler)
 {
-	mowgli_node_t *n, *n2;
 	hook_t *h;
 
 	return_if_fail(event != NULL);
@@ -113,36 +154,35 @@ void hook_del_hook(const char *event, hookfn_t handler)
 	if (h == NULL)
 		return;
 
-	MOWGLI_ITER_FOREACH_SAFE(n, n2, h->hooks.head)
-	{
-		hook_privfn_ctx_t *priv = n->data;
-
-		if (handler == priv->hookfn)
-			hook_destroy(h, n->data);
-	}
+	hook_del_handle(h, handler);
 }
 
-static inline hook_privfn_ctx_t *hook_create_and_add(hook_t *hook, hookfn_t handler,
-	void (*addfn)(void *data, mowgli_node_t *node, mowgli_list_t *list))
+void hook_add_handle(hook_t *h, hookfn_t handler, bool first)
 {
-	hook_privfn_ctx_t *priv;
-
-	return_val_if_fail(hook != NULL, NULL);
-	return_val_if_fail(handler != NULL, NULL);
-	return_val_if_fail(addfn != NULL, NULL);
+	return_if_fail(h != NULL);
+	return_if_fail(handler != NULL);
 
-	priv = mowgli_heap_alloc(hook_privfn_heap);
-	priv->hookfn = handler;
+	if (h->count == h->size)
+	{
+		h->size = h->size != 0 ? h->size * 2 : 4;
+		h->fns = srealloc(h->fns, h->size * sizeof(hookfn_t));
+	}
 
-	addfn(priv, &priv->node, &hook->hooks);
+	if (first)
+	{
+		memmove(h->fns + 1, h->fns, h->count * sizeof(hookfn_t));
+		h->fns[0] = handler;
+		h->shifted++;
+	}
+	else
+		h->fns[h->count] = handler;
 
-	return priv;
+	h->count++;
 }
 
 void hook_add_hook(const char *event, hookfn_t handler)
 {
 	hook_t *h;
-	hook_privfn_ctx_t *priv;
 
 	return_if_fail(event != NULL);
 	return_if_fail(handler != NULL);
@@ -151,7 +191,7 @@ void hook_add_hook(const char *event, hookfn_t handler)
 	if (h == NULL)
 		h = hook_add_event(event);
 
-	hook_create_and_add(h, handler, mowgli_node_add);
+	hook_add_handle(h, handler, false);
 }
 
 void hook_add_hook_first(const char *event, hookfn_t handler)
@@ -165,39 +205,70 @@ void hook_add_hook_first(const char *event, hookfn_t handler)
 	if (h == NULL)
 		h = hook_add_event(event);
 
-	hook_create_and_add(h, handler, mowgli_node_add_head);
+	hook_add_handle(h, handler, true);
 }
 
-void hook_call_event(const char *event, void *dptr)
+/*
+ * hook_run(hook_t *hook, void *dptr)
+ *
+ * Calls every handler of a hook in turn until one of them calls hook_stop().
+ * Handlers may add and remove handlers of the same hook as they run.
+ */
+void hook_run(hook_t *hook, void *dptr)
 {
 	hook_run_ctx_t ctx;
-	mowgli_node_t *n, *tn;
-	void (*func)(void *data);
-
-	return_if_fail(event != NULL);
+	hookfn_t fn;
+	unsigned int i, shifted;
 
-	ctx.hook = hook_find(event);
-	if (ctx.hook == NULL)
-		return;
+	return_if_fail(hook != NULL);
 
+	ctx.hook = hook;
 	ctx.dptr = dptr;
 	ctx.flags = HF_RUN;
 
 	mowgli_node_add_head(&ctx, &ctx.node, &hook_run_stack);
+	hook->running++;
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, ctx.hook->hooks.head)
+	shifted = hook->shifted;
+
+	for (i = 0; i < hook->count; i++)
 	{
-		hook_privfn_ctx_t *priv = n->data;
+		/* handlers inserted at the front push the rest along */
+		i += hook->shifted - shifted;
+		shifted = hook->shifted;
+
+		if (i >= hook->count)
+			break;
+
+		fn = hook->fns[i];
+		if (fn == NULL)
+			continue;
 
-		priv->hookfn(ctx.dptr);
+		fn(ctx.dptr);
 		if (ctx.flags & HF_STOP)
-			goto out;
+			break;
 	}
 
-out:
+	hook->running--;
+	if (hook->running == 0 && hook->dirty)
+		hook_compact(hook);
+
 	mowgli_node_delete(&ctx.node, &hook_run_stack);
 }
 
+void hook_call_event(const char *event, void *dptr)
+{
+	hook_t *h;
+
+	return_if_fail(event != NULL);
+
+	h = hook_find(event);
+	if (h == NULL)
+		return;
+
+	hook_call_handle(h, dptr);
+}
+
 static inline hook_run_ctx_t *hook_run_stack_highest(void)
 {
 	if (hook_run_stack.head == NULL)
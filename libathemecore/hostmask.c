@@ -0,0 +1,402 @@
+/*
+ * atheme-services: A collection of minimalist IRC services
+ * hostmask.c: Precompiled hostmasks.
+ *
+ * Copyright (c) 2014 Atheme Project (http://www.atheme.org)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "atheme.h"
+
+/* the characters other than '*' that match() treats specially */
+#define HOSTMASK_GLOBCHARS	"?&#%\\"
+
+static void hostmask_compile_cidr(hostmask_t *hm, const char *mask)
+{
+	const char *at, *addr;
+
+	at = strrchr(mask, '@');
+	addr = at != NULL ? at + 1 : mask;
+
+	if (!cidr_parse_mask(addr, &hm->cidr))
+		return;
+
+	hm->cidruser = at != NULL ? sstrndup(mask, at - mask) : NULL;
+}
+
+/*
+ * hostmask_compile(hostmask_t *hm, const char *mask)
+ *
+ * Prepares a mask for matching with hostmask_match() and friends.
+ *
+ * Inputs:
+ *       - a hostmask_t to fill in
+ *       - the mask, which must stay valid until hostmask_free()
+ *
+ * Outputs:
+ *       - nothing
+ *
+ * Side Effects:
+ *       - memory is allocated which must be released with hostmask_free()
+ */
+void hostmask_compile(hostmask_t *hm, const char *mask)
+{
+	const char *p, *start;
+	unsigned int i;
+	size_t len;
+
+	return_if_fail(hm != NULL);
+	return_if_fail(mask != NULL);
+
+	hm->mask = mask;
+	hm->nsegs = 0;
+	hm->segs = NULL;
+	hm->cidruser = NULL;
+	hm->cidr.bits = 0;
+
+	hostmask_compile_cidr(hm, mask);
+
+	len = strlen(mask);
+	hm->glob = strpbrk(mask, HOSTMASK_GLOBCHARS) != NULL || len > USHRT_MAX;
+	if (hm->glob)
+		return;
+
+	hm->anchor_start = *mask != '*';
+	hm->anchor_end = len == 0 || mask[len - 1] != '*';
+
+	for (p = mask; *p != '\0'; p++)
+		if (*p != '*' && (p == mask || p[-1] == '*'))
+			hm->nsegs++;
+
+	if (hm->nsegs == 0)
+		return;
+
+	hm->segs = scalloc(hm->nsegs, sizeof(hostmask_seg_t));
+
+	for (i = 0, p = mask; *p != '\0'; )
+	{
+		if (*p == '*')
+		{
+			p++;
+			continue;
+		}
+
+		for (start = p; *p != '\0' && *p != '*'; p++)
+			;
+
+		hm->segs[i].off = start - mask;
+		hm->segs[i].len = p - start;
+		i++;
+	}
+}
+
+/*
+ * hostmask_free(hostmask_t *hm)
+ *
+ * Releases the memory held by a compiled mask.  It is safe to call this
+ * on a zeroed hostmask_t that was never compiled.
+ */
+void hostmask_free(hostmask_t *hm)
+{
+	return_if_fail(hm != NULL);
+
+	free(hm->segs);
+	free(hm->cidruser);
+
+	hm->segs = NULL;
+	hm->cidruser = NULL;
+	hm->nsegs = 0;
+	hm->cidr.bits = 0;
+}
+
+static inline bool hostmask_seg_equal(const char *seg, const char *s, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if (ToLower((unsigned char)seg[i]) != ToLower((unsigned char)s[i]))
+			return false;
+
+	return true;
+}
+
+/* finds the leftmost occurrence of seg in s[0..slen) */
+static const char *hostmask_seg_find(const char *seg, size_t len, const char *s, size_t slen)
+{
+	const char *p, *last;
+	int c, lc;
+
+	if (slen < len)
+		return NULL;
+
+	c = (unsigned char)*seg;
+	lc = ToLower(c);
+	last = s + (slen - len);
+
+	/* a character without case, like '.' or a digit, can be found with memchr() */
+	if (lc == c && ToUpper(c) == c)
+	{
+		for (p = s; p <= last; p++)
+		{
+			p = memchr(p, c, last - p + 1);
+			if (p == NULL)
+				return NULL;
+			if (hostmask_seg_equal(seg + 1, p + 1, len - 1))
+				return p;
+		}
+
+		return NULL;
+	}
+
+	for (p = s; p <= last; p++)
+		if (ToLower((unsigned char)*p) == lc && hostmask_seg_equal(seg + 1, p + 1, len - 1))
+			return p;
+
+	return NULL;
+}
+
+/*
+ * hostmask_match(const hostmask_t *hm, const char *name)
+ *
+ * Checks a name against a compiled mask.
+ *
+ * Inputs:
+ *       - a compiled mask
+ *       - a name such as nick!user@host
+ *
+ * Outputs:
+ *       - true if the mask matches the name, exactly as !match() would
+ */
+bool hostmask_match(const hostmask_t *hm, const char *name)
+{
+	const char *seg;
+	size_t pos, end;
+	unsigned int first, last, i;
+
+	return_val_if_fail(hm != NULL, false);
+
+	if (name == NULL)
+		return false;
+
+	if (hm->glob)
+		return !match(hm->mask, name);
+
+	end = strlen(name);
+
+	if (hm->nsegs == 0)
+		return !hm->anchor_start ? true : end == 0;
+
+	pos = 0;
+	first = 0;
+	last = hm->nsegs;
+
+	/* no '*' at all: a plain comparison */
+	if (hm->anchor_start && hm->anchor_end && hm->nsegs == 1)
+		return end == hm->segs[0].len && hostmask_seg_equal(hm->mask, name, end);
+
+	if (hm->anchor_start)
+	{
+		seg = hm->mask + hm->segs[0].off;
+
+		if (end < hm->segs[0].len || !hostmask_seg_equal(seg, name, hm->segs[0].len))
+			return false;
+
+		pos = hm->segs[0].len;
+		first++;
+	}
+
+	if (hm->anchor_end)
+	{
+		seg = hm->mask + hm->segs[last - 1].off;
+
+		if (end - pos < hm->segs[last - 1].len)
+			return false;
+
+		end -= hm->segs[last - 1].len;
+		if (!hostmask_seg_equal(seg, name + end, hm->segs[last - 1].len))
+			return false;
+
+		last--;
+	}
+
+	/* everything in between floats; taking the leftmost match of each is enough */
+	for (i = first; i < last; i++)
+	{
+		const char *p;
+
+		seg = hm->mask + hm->segs[i].off;
+		p = hostmask_seg_find(seg, hm->segs[i].len, name + pos, end - pos);
+		if (p == NULL)
+			return false;
+
+		pos = (p - name) + hm->segs[i].len;
+	}
+
+	return true;
+}
+
+/*
+ * hostmask_match_ip(const hostmask_t *hm, const cidr_addr_t *addr)
+ *
+ * Checks an address against an address/bits mask without a user part, as
+ * match_ips() would.
+ */
+bool hostmask_match_ip(const hostmask_t *hm, const cidr_addr_t *addr)
+{
+	return_val_if_fail(hm != NULL, false);
+	return_val_if_fail(addr != NULL, false);
+
+	if (hm->cidr.bits == 0 || hm->cidruser != NULL)
+		return false;
+
+	return cidr_match(&hm->cidr, addr);
+}
+
+static void hostmask_target_add(hostmask_target_t *t, size_t prefixlen, const char *host)
+{
+	char *buf = t->hosts[t->nhosts];
+	unsigned int i;
+
+	memcpy(buf, t->nickuser, prefixlen);
+	buf[prefixlen] = '@';
+	mowgli_strlcpy(buf + prefixlen + 1, host, sizeof t->hosts[0] - prefixlen - 1);
+
+	/* vhost, chost and host are often the same, no need to match them twice */
+	for (i = 0; i < t->nhosts; i++)
+		if (!strcmp(t->hosts[i], buf))
+			return;
+
+	t->nhosts++;
+}
+
+static void hostmask_target_unref(hostmask_target_t *t)
+{
+	strshare_unref(t->nick);
+	strshare_unref(t->user);
+	strshare_unref(t->host);
+	strshare_unref(t->vhost);
+	strshare_unref(t->chost);
+}
+
+/*
+ * hostmask_target_get(user_t *u)
+ *
+ * Returns the nick!user@host forms of a user, so that a list of masks can
+ * be checked against them with hostmask_match_target().  They are built
+ * once and kept in the user_t until the nick, user or any host changes.
+ *
+ * Inputs:
+ *       - the user
+ *
+ * Outputs:
+ *       - the user's target, valid until the user changes or quits
+ *
+ * Side Effects:
+ *       - the target is allocated or rebuilt if needed
+ */
+const hostmask_target_t *hostmask_target_get(user_t *u)
+{
+	hostmask_target_t *t;
+	size_t prefixlen;
+
+	return_val_if_fail(u != NULL, NULL);
+
+	t = u->hmtarget;
+
+	/* the fields are shared strings, so the same text is the same pointer */
+	if (t != NULL && t->nick == u->nick && t->user == u->user && t->host == u->host &&
+			t->vhost == u->vhost && t->chost == u->chost)
+		return t;
+
+	if (t == NULL)
+		t = u->hmtarget = smalloc(sizeof *t);
+	else
+		hostmask_target_unref(t);
+
+	t->nick = strshare_ref(u->nick);
+	t->user = strshare_ref(u->user);
+	t->host = strshare_ref(u->host);
+	t->vhost = strshare_ref(u->vhost);
+	t->chost = strshare_ref(u->chost);
+
+	mowgli_strlcpy(t->nickuser, u->nick, sizeof t->nickuser);
+	mowgli_strlcat(t->nickuser, "!", sizeof t->nickuser);
+	mowgli_strlcat(t->nickuser, u->user, sizeof t->nickuser);
+	prefixlen = strlen(t->nickuser);
+
+	t->nhosts = 0;
+	hostmask_target_add(t, prefixlen, u->vhost);
+	hostmask_target_add(t, prefixlen, u->chost);
+	/* will be nick!user@ if ip unknown, doesn't matter */
+	hostmask_target_add(t, prefixlen, u->ip != NULL ? u->ip : "");
+	t->nvisible = t->nhosts;
+	hostmask_target_add(t, prefixlen, u->host);
+
+	t->ip = u->ipaddr;
+
+	return t;
+}
+
+/*
+ * hostmask_target_free(user_t *u)
+ *
+ * Releases the target kept for a user, if any.
+ */
+void hostmask_target_free(user_t *u)
+{
+	return_if_fail(u != NULL);
+
+	if (u->hmtarget == NULL)
+		return;
+
+	hostmask_target_unref(u->hmtarget);
+	free(u->hmtarget);
+	u->hmtarget = NULL;
+}
+
+/*
+ * hostmask_match_target(const hostmask_t *hm, const hostmask_target_t *t, bool realhost, bool cidr)
+ *
+ * Checks a compiled mask against the forms of a user returned by
+ * hostmask_target_get(), including the real host if realhost is set, and
+ * against the user's IP address in nick!user@address/bits form if cidr is
+ * set.
+ */
+bool hostmask_match_target(const hostmask_t *hm, const hostmask_target_t *t, bool realhost, bool cidr)
+{
+	unsigned int i, n;
+
+	return_val_if_fail(hm != NULL, false);
+	return_val_if_fail(t != NULL, false);
+
+	n = realhost ? t->nhosts : t->nvisible;
+	for (i = 0; i < n; i++)
+		if (hostmask_match(hm, t->hosts[i]))
+			return true;
+
+	if (!cidr || hm->cidr.bits == 0 || hm->cidruser == NULL)
+		return false;
+
+	return cidr_match(&hm->cidr, &t->ip) && !match(hm->cidruser, t->nickuser);
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
@@ -23,9 +23,17 @@
 
 #include "atheme.h"
 
+/* how often buffered log files are written out at the latest */
+#define LOG_FLUSH_INTERVAL	1
+
 static logfile_t *log_file;
 int log_force;
 
+/* the union of all log masks, so messages nobody wants are dropped before
+ * being formatted; until the main log is open, errors and info go to the
+ * terminal */
+unsigned int log_level_mask = LG_ERROR | LG_INFO;
+
 static mowgli_list_t log_files = { NULL, NULL, 0 };
 
 /* private destructor function for logfile_t. */
@@ -143,6 +151,41 @@ static void logfile_part_removed(void *unused)
  * Side Effects:
  *       - none
  */
+static void log_update_mask(void)
+{
+	mowgli_node_t *n;
+	logfile_t *lf;
+	unsigned int mask;
+
+	mask = log_file == NULL ? LG_ERROR | LG_INFO : 0;
+
+	MOWGLI_ITER_FOREACH(n, log_files.head)
+	{
+		lf = n->data;
+		mask |= lf->log_mask;
+	}
+
+	log_level_mask = mask;
+}
+
+/* the timestamp prefixed to log lines, formatted at most once a second */
+static const char *log_timestamp(time_t *now)
+{
+	static char datetime[64];
+	static time_t last = 0;
+	struct tm tm;
+
+	time(now);
+	if (*now != last)
+	{
+		tm = *localtime(now);
+		strftime(datetime, sizeof datetime, "[%d/%m/%Y %H:%M:%S]", &tm);
+		last = *now;
+	}
+
+	return datetime;
+}
+
 static const char *
 logfile_strip_control_codes(const char *buf)
 {
@@ -186,20 +229,23 @@ logfile_strip_control_codes(const char *buf)
  */
 static void logfile_write(logfile_t *lf, const char *buf)
 {
-	char datetime[BUFSIZE];
+	const char *datetime;
 	time_t t;
-	struct tm tm;
 
 	return_if_fail(lf != NULL);
 	return_if_fail(lf->log_file != NULL);
 	return_if_fail(buf != NULL);
 
-	time(&t);
-	tm = *localtime(&t);
-	strftime(datetime, sizeof datetime, "[%d/%m/%Y %H:%M:%S]", &tm);
+	datetime = log_timestamp(&t);
 
 	fprintf((FILE *) lf->log_file, "%s %s\n", datetime, logfile_strip_control_codes(buf));
-	fflush((FILE *) lf->log_file);
+
+	/* stdio buffers the rest; log_flush() picks it up within a second */
+	if (runflags & RF_STARTING || t >= lf->flushed + LOG_FLUSH_INTERVAL)
+	{
+		fflush((FILE *) lf->log_file);
+		lf->flushed = t;
+	}
 }
 
 /*
@@ -311,6 +357,7 @@ static void logfile_write_snotices(logfile_t *lf, const char *buf)
 void logfile_register(logfile_t *lf)
 {
 	mowgli_node_add(lf, &lf->node, &log_files);
+	log_update_mask();
 }
 
 /*
@@ -330,6 +377,7 @@ void logfile_register(logfile_t *lf)
 void logfile_unregister(logfile_t *lf)
 {
 	mowgli_node_delete(&lf->node, &log_files);
+	log_update_mask();
 }
 
 /*
@@ -436,6 +484,7 @@ logfile_t *logfile_new(const char *path, unsigned int log_mask)
 void log_open(void)
 {
 	log_file = logfile_new(log_path, LG_ERROR | LG_INFO | LG_CMD_ADMIN);
+	log_update_mask();
 }
 
 /*
@@ -458,36 +507,61 @@ void log_shutdown(void)
 
 	MOWGLI_ITER_FOREACH_SAFE(n, tn, log_files.head)
 		object_unref(n->data);
+
+	log_file = NULL;
+	log_update_mask();
 }
 
 /*
- * log_debug_enabled(void)
+ * log_flush(void *arg)
  *
- * Determines whether debug logging (LG_DEBUG and/or LG_RAWDATA) is enabled.
+ * Writes out whatever the log files have buffered.  This runs from a
+ * timer, and must also be called before fork() so that the child does
+ * not write the same lines again, and by a child before _exit() so that
+ * its own lines are not lost.
  *
  * Inputs:
  *       - none
  *
  * Outputs:
- *       - boolean
+ *       - none
  *
  * Side Effects:
- *       - none
+ *       - log files are flushed.
  */
-bool log_debug_enabled(void)
+void log_flush(void *arg)
 {
 	mowgli_node_t *n;
 	logfile_t *lf;
 
-	if (log_force)
-		return true;
 	MOWGLI_ITER_FOREACH(n, log_files.head)
 	{
 		lf = n->data;
-		if (lf->log_mask & (LG_DEBUG | LG_RAWDATA))
-			return true;
+		if (lf->write_func != logfile_write)
+			continue;
+
+		fflush((FILE *) lf->log_file);
+		lf->flushed = CURRTIME;
 	}
-	return false;
+}
+
+/*
+ * log_debug_enabled(void)
+ *
+ * Determines whether debug logging (LG_DEBUG and/or LG_RAWDATA) is enabled.
+ *
+ * Inputs:
+ *       - none
+ *
+ * Outputs:
+ *       - boolean
+ *
+ * Side Effects:
+ *       - none
+ */
+bool log_debug_enabled(void)
+{
+	return log_level_enabled(LG_DEBUG | LG_RAWDATA);
 }
 
 /*
@@ -510,6 +584,7 @@ void log_master_set_mask(unsigned int mask)
 	if (log_file == NULL)
 		return;
 	log_file->log_mask = mask;
+	log_update_mask();
 }
 
 /*
@@ -558,9 +633,9 @@ static void vslog_ext(log_type_t type, unsigned int level, const char *fmt,
 	static bool in_slog = false;
 	char buf[BUFSIZE];
 	mowgli_node_t *n;
-	char datetime[BUFSIZE];
-	time_t t;
-	struct tm tm;
+
+	if (!log_level_enabled(level))
+		return;
 
 	if (in_slog)
 		return;
@@ -568,10 +643,6 @@ static void vslog_ext(log_type_t type, unsigned int level, const char *fmt,
 
 	vsnprintf(buf, BUFSIZE, fmt, args);
 
-	time(&t);
-	tm = *localtime(&t);
-	strftime(datetime, sizeof datetime, "[%d/%m/%Y %H:%M:%S]", &tm);
-
 	MOWGLI_ITER_FOREACH(n, log_files.head)
 	{
 		logfile_t *lf = (logfile_t *) n->data;
@@ -593,7 +664,11 @@ static void vslog_ext(log_type_t type, unsigned int level, const char *fmt,
 	if (type != LOG_INTERACTIVE && ((runflags & (RF_LIVE | RF_STARTING) &&
 		(log_file != NULL ? log_file->log_mask : LG_ERROR | LG_INFO) & level) ||
 		(runflags & RF_LIVE && log_force)))
-		fprintf(stderr, "%s %s\n", datetime, logfile_strip_control_codes(buf));
+	{
+		time_t t;
+
+		fprintf(stderr, "%s %s\n", log_timestamp(&t), logfile_strip_control_codes(buf));
+	}
 
 	in_slog = false;
 }
@@ -626,7 +701,7 @@ static PRINTFLIKE(3, 4) void slog_ext(log_type_t type, unsigned int level,
  * Side Effects:
  *       - logfiles are updated depending on how they are configured.
  */
-void slog(unsigned int level, const char *fmt, ...)
+void (slog)(unsigned int level, const char *fmt, ...)
 {
 	va_list args;
 
@@ -658,6 +733,9 @@ void logcommand(sourceinfo_t *si, int level, const char *fmt, ...)
 	va_list args;
 	char lbuf[BUFSIZE];
 
+	if (!log_level_enabled(level))
+		return;
+
 	va_start(args, fmt);
 	vsnprintf(lbuf, BUFSIZE, fmt, args);
 	va_end(args);
@@ -692,6 +770,9 @@ void logcommand_user(service_t *svs, user_t *source, int level, const char *fmt,
 	char accountbuf[NICKLEN * 5]; /* entity name len is NICKLEN * 4, plus another for the ID */
 	bool showaccount;
 
+	if (!log_level_enabled(level))
+		return;
+
 	va_start(args, fmt);
 	vsnprintf(lbuf, BUFSIZE, fmt, args);
 	va_end(args);
@@ -744,6 +825,9 @@ void logcommand_external(service_t *svs, const char *type, connection_t *source,
 	va_list args;
 	char lbuf[BUFSIZE];
 
+	if (!log_level_enabled(level))
+		return;
+
 	va_start(args, fmt);
 	vsnprintf(lbuf, BUFSIZE, fmt, args);
 	va_end(args);
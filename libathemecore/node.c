@@ -33,6 +33,13 @@ mowgli_heap_t *kline_heap;	/* 16 */
 mowgli_heap_t *xline_heap;	/* 16 */
 mowgli_heap_t *qline_heap;	/* 16 */
 
+/* temporary K/X/Q:lines by expiry time */
+static expiry_queue_t kline_expiries;
+static expiry_queue_t xline_expiries;
+static expiry_queue_t qline_expiries;
+
+static void kline_index_init(void);
+
 /*************
  * L I S T S *
  *************/
@@ -49,6 +56,8 @@ void init_nodes(void)
 		exit(EXIT_FAILURE);
 	}
 
+	kline_index_init();
+
 	init_uplinks();
 	init_servers();
 	init_metadata();
@@ -119,26 +128,358 @@ void remove_illegals()
  * K L I N E *
  *************/
 
+/*
+ * AKILLs are indexed by the shape of their host mask, so that checking a
+ * connecting user does not have to look at every one of them:
+ *  - address/bits masks are kept in a binary trie per address family,
+ *  - masks without wildcards are looked up by the user's whole host,
+ *  - literal text followed by '*' (192.168.*) or '*' followed by literal
+ *    text (*.example.com) is looked up by every prefix or suffix of it,
+ *  - anything else goes on a list which is checked entry by entry.
+ * Where an AKILL is kept only depends on its host mask, which never
+ * changes, so kline_delete() finds it again the same way.
+ */
+typedef enum {
+	KLINE_INDEX_TRIE,
+	KLINE_INDEX_EXACT,
+	KLINE_INDEX_PREFIX,
+	KLINE_INDEX_SUFFIX,
+	KLINE_INDEX_OTHER,
+} kline_index_class_t;
+
+typedef struct kline_tnode_ kline_tnode_t;
+
+struct kline_tnode_ {
+	unsigned char addr[16];
+	int bits;
+	kline_tnode_t *child[2];
+	mowgli_list_t klines;
+};
+
+static mowgli_heap_t *kline_tnode_heap;
+static kline_tnode_t *kline_trie[2];	/* IPv4, IPv6 */
+static mowgli_patricia_t *kline_exact;
+static mowgli_patricia_t *kline_prefix;
+static mowgli_patricia_t *kline_suffix;
+static mowgli_list_t kline_other;
+
+static mowgli_patricia_t *kline_numbers;
+
+static void kline_index_init(void)
+{
+	kline_tnode_heap = sharedheap_get(sizeof(kline_tnode_t));
+	if (kline_tnode_heap == NULL)
+	{
+		slog(LG_INFO, "kline_index_init(): block allocator failed.");
+		exit(EXIT_FAILURE);
+	}
+
+	kline_exact = mowgli_patricia_create(noopcanon);
+	kline_prefix = mowgli_patricia_create(noopcanon);
+	kline_suffix = mowgli_patricia_create(noopcanon);
+	kline_numbers = mowgli_patricia_create(noopcanon);
+}
+
+static inline int kline_trie_bit(const unsigned char *addr, int bit)
+{
+	return (addr[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+/* the number of leading bits, up to bits, that a and b have in common */
+static int kline_trie_common(const unsigned char *a, const unsigned char *b, int bits)
+{
+	int i;
+
+	for (i = 0; i + 8 <= bits && a[i / 8] == b[i / 8]; i += 8)
+		;
+	for (; i < bits && kline_trie_bit(a, i) == kline_trie_bit(b, i); i++)
+		;
+
+	return i;
+}
+
+static kline_tnode_t *kline_trie_node(const unsigned char *addr, int bits)
+{
+	kline_tnode_t *n = mowgli_heap_alloc(kline_tnode_heap);
+
+	memcpy(n->addr, addr, sizeof n->addr);
+	n->bits = bits;
+
+	return n;
+}
+
+/* returns the node for addr/bits, creating it if needed */
+static kline_tnode_t *kline_trie_get(kline_tnode_t **np, const unsigned char *addr, int bits)
+{
+	kline_tnode_t *n, *mid;
+	int common;
+
+	while ((n = *np) != NULL)
+	{
+		common = kline_trie_common(n->addr, addr, n->bits < bits ? n->bits : bits);
+
+		if (common < n->bits)
+		{
+			/* addr/bits branches off above n, put a node at the fork */
+			mid = kline_trie_node(addr, common);
+			mid->child[kline_trie_bit(n->addr, common)] = n;
+			*np = mid;
+
+			if (common == bits)
+				return mid;
+
+			n = kline_trie_node(addr, bits);
+			mid->child[kline_trie_bit(addr, common)] = n;
+			return n;
+		}
+
+		if (n->bits == bits)
+			return n;
+
+		np = &n->child[kline_trie_bit(addr, n->bits)];
+	}
+
+	return *np = kline_trie_node(addr, bits);
+}
+
+/* frees the nodes on the way to addr/bits that hold nothing and fork nowhere */
+static void kline_trie_prune(kline_tnode_t **np, const unsigned char *addr, int bits)
+{
+	kline_tnode_t *n = *np;
+
+	if (n == NULL)
+		return;
+
+	if (n->bits < bits)
+		kline_trie_prune(&n->child[kline_trie_bit(addr, n->bits)], addr, bits);
+
+	if (MOWGLI_LIST_LENGTH(&n->klines) != 0)
+		return;
+	if (n->child[0] != NULL && n->child[1] != NULL)
+		return;
+
+	*np = n->child[0] != NULL ? n->child[0] : n->child[1];
+	mowgli_heap_free(kline_tnode_heap, n);
+}
+
+static kline_index_class_t kline_index_classify(kline_t *k, char *key, size_t keysize)
+{
+	const hostmask_t *hm = &k->hostmask;
+
+	if (hm->cidr.bits != 0 && hm->cidruser == NULL)
+		return KLINE_INDEX_TRIE;
+	if (hm->glob || hm->nsegs != 1 || hm->segs[0].len >= keysize)
+		return KLINE_INDEX_OTHER;
+	if (!hm->anchor_start && !hm->anchor_end)
+		return KLINE_INDEX_OTHER;
+
+	mowgli_strlcpy(key, hm->mask + hm->segs[0].off, hm->segs[0].len + 1);
+	irccasecanon(key);
+
+	if (!hm->anchor_end)
+		return KLINE_INDEX_PREFIX;
+	if (!hm->anchor_start)
+		return KLINE_INDEX_SUFFIX;
+
+	return KLINE_INDEX_EXACT;
+}
+
+static mowgli_patricia_t *kline_index_table(kline_index_class_t class)
+{
+	switch (class)
+	{
+	  case KLINE_INDEX_EXACT:
+		  return kline_exact;
+	  case KLINE_INDEX_PREFIX:
+		  return kline_prefix;
+	  case KLINE_INDEX_SUFFIX:
+		  return kline_suffix;
+	  default:
+		  return NULL;
+	}
+}
+
+static void kline_index_add(kline_t *k)
+{
+	char key[BUFSIZE], numkey[32];
+	kline_index_class_t class;
+	mowgli_patricia_t *table;
+	mowgli_list_t *l;
+
+	class = kline_index_classify(k, key, sizeof key);
+
+	if (class == KLINE_INDEX_TRIE)
+		l = &kline_trie_get(&kline_trie[k->hostmask.cidr.addr.ip6], k->hostmask.cidr.addr.addr, k->hostmask.cidr.bits)->klines;
+	else if ((table = kline_index_table(class)) != NULL)
+	{
+		if ((l = mowgli_patricia_retrieve(table, key)) == NULL)
+		{
+			l = mowgli_list_create();
+			mowgli_patricia_add(table, key, l);
+		}
+	}
+	else
+		l = &kline_other;
+
+	mowgli_node_add(k, &k->inode, l);
+
+	/* numbers ought to be unique; if they are not, the first one wins */
+	snprintf(numkey, sizeof numkey, "%lu", k->number);
+	if (mowgli_patricia_retrieve(kline_numbers, numkey) == NULL)
+		mowgli_patricia_add(kline_numbers, numkey, k);
+}
+
+static void kline_index_delete(kline_t *k)
+{
+	char key[BUFSIZE], numkey[32];
+	kline_index_class_t class;
+	mowgli_patricia_t *table;
+	mowgli_list_t *l;
+
+	class = kline_index_classify(k, key, sizeof key);
+
+	if (class == KLINE_INDEX_TRIE)
+	{
+		kline_tnode_t **root = &kline_trie[k->hostmask.cidr.addr.ip6];
+
+		l = &kline_trie_get(root, k->hostmask.cidr.addr.addr, k->hostmask.cidr.bits)->klines;
+		mowgli_node_delete(&k->inode, l);
+		kline_trie_prune(root, k->hostmask.cidr.addr.addr, k->hostmask.cidr.bits);
+	}
+	else if ((table = kline_index_table(class)) != NULL)
+	{
+		l = mowgli_patricia_retrieve(table, key);
+		return_if_fail(l != NULL);
+
+		mowgli_node_delete(&k->inode, l);
+		if (MOWGLI_LIST_LENGTH(l) == 0)
+		{
+			mowgli_patricia_delete(table, key);
+			mowgli_list_free(l);
+		}
+	}
+	else
+		mowgli_node_delete(&k->inode, &kline_other);
+
+	/* numbers come from me.kline_id and are unique */
+	snprintf(numkey, sizeof numkey, "%lu", k->number);
+	if (mowgli_patricia_retrieve(kline_numbers, numkey) == k)
+		mowgli_patricia_delete(kline_numbers, numkey);
+}
+
+/* whether a host or IP string could be an address/bits AKILL verbatim */
+static bool kline_index_cidrlike(const char *s)
+{
+	char buf[HOSTLEN];
+	unsigned char addr[16];
+	const char *slash;
+	bool ip6;
+
+	if ((slash = strrchr(s, '/')) == NULL || (size_t)(slash - s) >= sizeof buf || atoi(slash + 1) <= 0)
+		return false;
+
+	mowgli_strlcpy(buf, s, slash - s + 1);
+	return cidr_parse_ip(buf, addr, &ip6);
+}
+
+typedef struct {
+	user_t *u;
+	const cidr_addr_t *ip;
+} kline_query_t;
+
+static bool kline_matches_user(kline_t *k, const kline_query_t *q)
+{
+	if (k->duration != 0 && k->expires <= CURRTIME)
+		return false;
+	if (!hostmask_match(&k->usermask, q->u->user))
+		return false;
+
+	return hostmask_match(&k->hostmask, q->u->host) || hostmask_match(&k->hostmask, q->u->ip) ||
+		hostmask_match_ip(&k->hostmask, q->ip);
+}
+
+static kline_t *kline_find_in(mowgli_list_t *l, const kline_query_t *q)
+{
+	mowgli_node_t *n;
+
+	if (l == NULL)
+		return NULL;
+
+	MOWGLI_ITER_FOREACH(n, l->head)
+	{
+		kline_t *k = n->data;
+
+		if (kline_matches_user(k, q))
+			return k;
+	}
+
+	return NULL;
+}
+
+/* checks the AKILLs whose literal part is all, a prefix or a suffix of s */
+static kline_t *kline_find_by_string(const char *s, const kline_query_t *q)
+{
+	char buf[BUFSIZE];
+	kline_t *k;
+	size_t len, i;
+	char c;
+
+	if (s == NULL)
+		return NULL;
+
+	mowgli_strlcpy(buf, s, sizeof buf);
+	irccasecanon(buf);
+	len = strlen(buf);
+
+	if ((k = kline_find_in(mowgli_patricia_retrieve(kline_exact, buf), q)) != NULL)
+		return k;
+
+	if (mowgli_patricia_size(kline_suffix) != 0)
+		for (i = 0; i < len; i++)
+			if ((k = kline_find_in(mowgli_patricia_retrieve(kline_suffix, buf + i), q)) != NULL)
+				return k;
+
+	if (mowgli_patricia_size(kline_prefix) != 0)
+		for (i = len; i > 0; i--)
+		{
+			c = buf[i];
+			buf[i] = '\0';
+			k = kline_find_in(mowgli_patricia_retrieve(kline_prefix, buf), q);
+			buf[i] = c;
+
+			if (k != NULL)
+				return k;
+		}
+
+	return NULL;
+}
+
 kline_t *kline_add_with_id(const char *user, const char *host, const char *reason, long duration, const char *setby, unsigned long id)
 {
 	kline_t *k;
-	mowgli_node_t *n = mowgli_node_create();
+	database_handle_t *db;
 
 	slog(LG_DEBUG, "kline_add(): %s@%s -> %s (%ld)", user, host, reason, duration);
 
 	k = mowgli_heap_alloc(kline_heap);
 
-	mowgli_node_add(k, n, &klnlist);
+	mowgli_node_add(k, &k->node, &klnlist);
 
 	k->user = sstrdup(user);
 	k->host = sstrdup(host);
 	k->reason = sstrdup(reason);
 	k->setby = sstrdup(setby);
+	hostmask_compile(&k->usermask, k->user);
+	hostmask_compile(&k->hostmask, k->host);
 	k->duration = duration;
 	k->settime = CURRTIME;
 	k->expires = CURRTIME + duration;
 	k->number = id;
 
+	kline_index_add(k);
+	if (k->duration != 0)
+		expiry_queue_set(&kline_expiries, &k->expnode, k, k->expires);
+
 	cnt.kline++;
 
 
@@ -148,6 +489,18 @@ kline_t *kline_add_with_id(const char *user, const char *host, const char *reaso
 	if (me.connected)
 		kline_sts("*", user, host, duration, treason);
 
+	if ((db = db_journal_row("JKL")) != NULL)
+	{
+		db_write_uint(db, k->number);
+		db_write_word(db, k->user);
+		db_write_word(db, k->host);
+		db_write_uint(db, k->duration);
+		db_write_time(db, k->settime);
+		db_write_word(db, k->setby);
+		db_write_str(db, k->reason);
+		db_commit_row(db);
+	}
+
 	return k;
 }
 
@@ -165,20 +518,29 @@ kline_t *kline_add_user(user_t *u, const char *reason, long duration, const char
 
 void kline_delete(kline_t *k)
 {
-	mowgli_node_t *n;
+	database_handle_t *db;
 
 	return_if_fail(k != NULL);
 
 	slog(LG_DEBUG, "kline_delete(): %s@%s -> %s", k->user, k->host, k->reason);
 
+	if ((db = db_journal_row("JKLD")) != NULL)
+	{
+		db_write_uint(db, k->number);
+		db_commit_row(db);
+	}
+
 	/* only unkline if ircd has not already removed this -- jilles */
 	if (me.connected && (k->duration == 0 || k->expires > CURRTIME))
 		unkline_sts("*", k->user, k->host);
 
-	n = mowgli_node_find(k, &klnlist);
-	mowgli_node_delete(n, &klnlist);
-	mowgli_node_free(n);
+	mowgli_node_delete(&k->node, &klnlist);
+
+	kline_index_delete(k);
+	expiry_queue_delete(&kline_expiries, &k->expnode);
 
+	hostmask_free(&k->usermask);
+	hostmask_free(&k->hostmask);
 	free(k->user);
 	free(k->host);
 	free(k->reason);
@@ -189,6 +551,23 @@ void kline_delete(kline_t *k)
 	cnt.kline--;
 }
 
+/*
+ * kline_settime(kline_t *k, time_t settime)
+ *
+ * Changes when an AKILL is considered to have been set, and so when it
+ * expires; used when loading AKILLs that were set earlier.
+ */
+void kline_settime(kline_t *k, time_t settime)
+{
+	return_if_fail(k != NULL);
+
+	k->settime = settime;
+	k->expires = settime + k->duration;
+
+	if (k->duration != 0)
+		expiry_queue_set(&kline_expiries, &k->expnode, k, k->expires);
+}
+
 kline_t *kline_find(const char *user, const char *host)
 {
 	kline_t *k;
@@ -198,7 +577,7 @@ kline_t *kline_find(const char *user, const char *host)
 	{
 		k = (kline_t *)n->data;
 
-		if ((!match(k->user, user)) && (!match(k->host, host)))
+		if (hostmask_match(&k->usermask, user) && hostmask_match(&k->hostmask, host))
 			return k;
 	}
 
@@ -207,64 +586,79 @@ kline_t *kline_find(const char *user, const char *host)
 
 kline_t *kline_find_num(unsigned long number)
 {
-	kline_t *k;
-	mowgli_node_t *n;
-
-	MOWGLI_ITER_FOREACH(n, klnlist.head)
-	{
-		k = (kline_t *)n->data;
-
-		if (k->number == number)
-			return k;
-	}
+	char numkey[32];
 
-	return NULL;
+	snprintf(numkey, sizeof numkey, "%lu", number);
+	return mowgli_patricia_retrieve(kline_numbers, numkey);
 }
 
 kline_t *kline_find_user(user_t *u)
 {
+	kline_query_t q;
+	kline_tnode_t *t;
 	kline_t *k;
-	mowgli_node_t *n;
 
-	MOWGLI_ITER_FOREACH(n, klnlist.head)
-	{
-		k = (kline_t *)n->data;
+	q.u = u;
+	q.ip = &u->ipaddr;
 
-		if (k->duration != 0 && k->expires <= CURRTIME)
-			continue;
-		if (!match(k->user, u->user) && (!match(k->host, u->host) || !match(k->host, u->ip) || !match_ips(k->host, u->ip)))
-			return k;
+	/* a host that reads like address/bits may match such an AKILL by name */
+	if (kline_index_cidrlike(u->host) || (u->ip != NULL && kline_index_cidrlike(u->ip)))
+		return kline_find_in(&klnlist, &q);
+
+	if (q.ip->valid)
+	{
+		for (t = kline_trie[q.ip->ip6]; t != NULL; t = t->child[kline_trie_bit(q.ip->addr, t->bits)])
+		{
+			if (kline_trie_common(t->addr, q.ip->addr, t->bits) < t->bits)
+				break;
+			if ((k = kline_find_in(&t->klines, &q)) != NULL)
+				return k;
+			if (t->bits == (q.ip->ip6 ? 128 : 32))
+				break;
+		}
 	}
 
-	return NULL;
+	if ((k = kline_find_by_string(u->host, &q)) != NULL)
+		return k;
+	if (u->ip != NULL && strcmp(u->ip, u->host) && (k = kline_find_by_string(u->ip, &q)) != NULL)
+		return k;
+
+	return kline_find_in(&kline_other, &q);
 }
 
+/*
+ * kline_expire(), xline_expire() and qline_expire() only touch the lines
+ * that are due: popping the queue and unlinking a line (list node, index
+ * and queue node are all embedded) are O(log n) each, so keep it that way
+ * in kline_delete(), xline_destroy() and qline_destroy().
+ */
 void kline_expire(void *arg)
 {
 	kline_t *k;
 	char *reason;
-	mowgli_node_t *n, *tn;
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, klnlist.head)
+	while ((k = expiry_queue_pop(&kline_expiries, CURRTIME)) != NULL)
 	{
-		k = (kline_t *)n->data;
-
 		if (k->duration == 0)
 			continue;
 
-		if (k->expires <= CURRTIME)
+		/* changed behind our back, wait for the new time */
+		if (k->expires > CURRTIME)
 		{
-			/* TODO: determine validity of k->reason */
-			reason = k->reason ? k->reason : "(none)";
+			expiry_queue_set(&kline_expiries, &k->expnode, k, k->expires);
+			continue;
+		}
 
-			slog(LG_INFO, _("KLINE:EXPIRE: \2%s@%s\2 set \2%s\2 ago by \2%s\2 (reason: %s)"),
-				k->user, k->host, time_ago(k->settime), k->setby, reason);
+		/* TODO: determine validity of k->reason */
+		reason = k->reason ? k->reason : "(none)";
 
-			verbose_wallops(_("AKILL expired on \2%s@%s\2, set by \2%s\2 (reason: %s)"),
-				k->user, k->host, k->setby, reason);
+		slog(LG_INFO, _("KLINE:EXPIRE: \2%s@%s\2 set \2%s\2 ago by \2%s\2 (reason: %s)"),
+			k->user, k->host, time_ago(k->settime), k->setby, reason);
 
-			kline_delete(k);
-		}
+		verbose_wallops(_("AKILL expired on \2%s@%s\2, set by \2%s\2 (reason: %s)"),
+			k->user, k->host, k->setby, reason);
+
+		kline_delete(k);
 	}
 }
 
@@ -275,14 +669,13 @@ void kline_expire(void *arg)
 xline_t *xline_add(const char *realname, const char *reason, long duration, const char *setby)
 {
 	xline_t *x;
-	mowgli_node_t *n = mowgli_node_create();
 	static unsigned int xcnt = 0;
 
 	slog(LG_DEBUG, "xline_add(): %s -> %s (%ld)", realname, reason, duration);
 
 	x = mowgli_heap_alloc(xline_heap);
 
-	mowgli_node_add(x, n, &xlnlist);
+	mowgli_node_add(x, &x->node, &xlnlist);
 
 	x->realname = sstrdup(realname);
 	x->reason = sstrdup(reason);
@@ -292,6 +685,9 @@ xline_t *xline_add(const char *realname, const char *reason, long duration, cons
 	x->expires = CURRTIME + duration;
 	x->number = ++xcnt;
 
+	if (x->duration != 0)
+		expiry_queue_set(&xline_expiries, &x->expnode, x, x->expires);
+
 	cnt.xline++;
 
 	if (me.connected)
@@ -300,26 +696,17 @@ xline_t *xline_add(const char *realname, const char *reason, long duration, cons
 	return x;
 }
 
-void xline_delete(const char *realname)
+static void xline_destroy(xline_t *x)
 {
-	xline_t *x = xline_find(realname);
-	mowgli_node_t *n;
-
-	if (!x)
-	{
-		slog(LG_DEBUG, "xline_delete(): called for nonexistant xline: %s", realname);
-		return;
-	}
-
 	slog(LG_DEBUG, "xline_delete(): %s -> %s", x->realname, x->reason);
 
 	/* only unxline if ircd has not already removed this -- jilles */
 	if (me.connected && (x->duration == 0 || x->expires > CURRTIME))
 		unxline_sts("*", x->realname);
 
-	n = mowgli_node_find(x, &xlnlist);
-	mowgli_node_delete(n, &xlnlist);
-	mowgli_node_free(n);
+	mowgli_node_delete(&x->node, &xlnlist);
+
+	expiry_queue_delete(&xline_expiries, &x->expnode);
 
 	free(x->realname);
 	free(x->reason);
@@ -330,6 +717,36 @@ void xline_delete(const char *realname)
 	cnt.xline--;
 }
 
+void xline_delete(const char *realname)
+{
+	xline_t *x = xline_find(realname);
+
+	if (!x)
+	{
+		slog(LG_DEBUG, "xline_delete(): called for nonexistant xline: %s", realname);
+		return;
+	}
+
+	xline_destroy(x);
+}
+
+/*
+ * xline_settime(xline_t *x, time_t settime)
+ *
+ * Changes when an XLINE is considered to have been set, and so when it
+ * expires.
+ */
+void xline_settime(xline_t *x, time_t settime)
+{
+	return_if_fail(x != NULL);
+
+	x->settime = settime;
+	x->expires = settime + x->duration;
+
+	if (x->duration != 0)
+		expiry_queue_set(&xline_expiries, &x->expnode, x, x->expires);
+}
+
 xline_t *xline_find(const char *realname)
 {
 	xline_t *x;
@@ -384,25 +801,25 @@ xline_t *xline_find_user(user_t *u)
 void xline_expire(void *arg)
 {
 	xline_t *x;
-	mowgli_node_t *n, *tn;
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, xlnlist.head)
+	while ((x = expiry_queue_pop(&xline_expiries, CURRTIME)) != NULL)
 	{
-		x = (xline_t *)n->data;
-
 		if (x->duration == 0)
 			continue;
 
-		if (x->expires <= CURRTIME)
+		if (x->expires > CURRTIME)
 		{
-			slog(LG_INFO, _("XLINE:EXPIRE: \2%s\2 set \2%s\2 ago by \2%s\2"),
-				x->realname, time_ago(x->settime), x->setby);
+			expiry_queue_set(&xline_expiries, &x->expnode, x, x->expires);
+			continue;
+		}
 
-			verbose_wallops(_("XLINE expired on \2%s\2, set by \2%s\2"),
-				x->realname, x->setby);
+		slog(LG_INFO, _("XLINE:EXPIRE: \2%s\2 set \2%s\2 ago by \2%s\2"),
+			x->realname, time_ago(x->settime), x->setby);
 
-			xline_delete(x->realname);
-		}
+		verbose_wallops(_("XLINE expired on \2%s\2, set by \2%s\2"),
+			x->realname, x->setby);
+
+		xline_destroy(x);
 	}
 }
 
@@ -413,13 +830,12 @@ void xline_expire(void *arg)
 qline_t *qline_add(const char *mask, const char *reason, long duration, const char *setby)
 {
 	qline_t *q;
-	mowgli_node_t *n = mowgli_node_create();
 	static unsigned int qcnt = 0;
 
 	slog(LG_DEBUG, "qline_add(): %s -> %s (%ld)", mask, reason, duration);
 
 	q = mowgli_heap_alloc(qline_heap);
-	mowgli_node_add(q, n, &qlnlist);
+	mowgli_node_add(q, &q->node, &qlnlist);
 
 	q->mask = sstrdup(mask);
 	q->reason = sstrdup(reason);
@@ -429,6 +845,9 @@ qline_t *qline_add(const char *mask, const char *reason, long duration, const ch
 	q->expires = CURRTIME + duration;
 	q->number = ++qcnt;
 
+	if (q->duration != 0)
+		expiry_queue_set(&qline_expiries, &q->expnode, q, q->expires);
+
 	cnt.qline++;
 
 	if (me.connected)
@@ -437,26 +856,17 @@ qline_t *qline_add(const char *mask, const char *reason, long duration, const ch
 	return q;
 }
 
-void qline_delete(const char *mask)
+static void qline_destroy(qline_t *q)
 {
-	qline_t *q = qline_find(mask);
-	mowgli_node_t *n;
-
-	if (!q)
-	{
-		slog(LG_DEBUG, "qline_delete(): called for nonexistant qline: %s", mask);
-		return;
-	}
-
 	slog(LG_DEBUG, "qline_delete(): %s -> %s", q->mask, q->reason);
 
 	/* only unqline if ircd has not already removed this -- jilles */
 	if (me.connected && (q->duration == 0 || q->expires > CURRTIME))
 		unqline_sts("*", q->mask);
 
-	n = mowgli_node_find(q, &qlnlist);
-	mowgli_node_delete(n, &qlnlist);
-	mowgli_node_free(n);
+	mowgli_node_delete(&q->node, &qlnlist);
+
+	expiry_queue_delete(&qline_expiries, &q->expnode);
 
 	free(q->mask);
 	free(q->reason);
@@ -467,6 +877,36 @@ void qline_delete(const char *mask)
 	cnt.qline--;
 }
 
+void qline_delete(const char *mask)
+{
+	qline_t *q = qline_find(mask);
+
+	if (!q)
+	{
+		slog(LG_DEBUG, "qline_delete(): called for nonexistant qline: %s", mask);
+		return;
+	}
+
+	qline_destroy(q);
+}
+
+/*
+ * qline_settime(qline_t *q, time_t settime)
+ *
+ * Changes when a QLINE is considered to have been set, and so when it
+ * expires.
+ */
+void qline_settime(qline_t *q, time_t settime)
+{
+	return_if_fail(q != NULL);
+
+	q->settime = settime;
+	q->expires = settime + q->duration;
+
+	if (q->duration != 0)
+		expiry_queue_set(&qline_expiries, &q->expnode, q, q->expires);
+}
+
 qline_t *qline_find(const char *mask)
 {
 	qline_t *q;
@@ -540,25 +980,25 @@ qline_t *qline_find_channel(channel_t *c)
 void qline_expire(void *arg)
 {
 	qline_t *q;
-	mowgli_node_t *n, *tn;
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, qlnlist.head)
+	while ((q = expiry_queue_pop(&qline_expiries, CURRTIME)) != NULL)
 	{
-		q = (qline_t *)n->data;
-
 		if (q->duration == 0)
 			continue;
 
-		if (q->expires <= CURRTIME)
+		if (q->expires > CURRTIME)
 		{
-			slog(LG_INFO, _("QLINE:EXPIRE: \2%s\2 set \2%s\2 ago by \2%s\2"),
-				q->mask, time_ago(q->settime), q->setby);
+			expiry_queue_set(&qline_expiries, &q->expnode, q, q->expires);
+			continue;
+		}
 
-			verbose_wallops(_("QLINE expired on \2%s\2, set by \2%s\2"),
-				q->mask, q->setby);
+		slog(LG_INFO, _("QLINE:EXPIRE: \2%s\2 set \2%s\2 ago by \2%s\2"),
+			q->mask, time_ago(q->settime), q->setby);
 
-			qline_delete(q->mask);
-		}
+		verbose_wallops(_("QLINE expired on \2%s\2, set by \2%s\2"),
+			q->mask, q->setby);
+
+		qline_destroy(q);
 	}
 }
 
@@ -28,12 +28,16 @@ mowgli_list_t object_list = { NULL, NULL, 0 };
 #endif
 
 mowgli_heap_t *metadata_heap;	/* HEAP_CHANUSER */
+static mowgli_heap_t *metadata_key_heap;
+static mowgli_patricia_t *metadata_keys;
 
 void init_metadata(void)
 {
 	metadata_heap = sharedheap_get(sizeof(metadata_t));
+	metadata_key_heap = sharedheap_get(sizeof(metadata_key_t));
+	metadata_keys = mowgli_patricia_create(strcasecanon);
 
-	if (metadata_heap == NULL)
+	if (metadata_heap == NULL || metadata_key_heap == NULL)
 	{
 		slog(LG_ERROR, "init_metadata(): block allocator failure.");
 		exit(EXIT_FAILURE);
@@ -63,6 +67,7 @@ void object_init(object_t *obj, const char *name, destructor_t des)
 
 	obj->destructor = des;
 	obj->refcount = 1;
+	obj->mdtype = '\0';
 
 #ifdef OBJECT_DEBUG
 	mowgli_node_add(obj, &obj->dnode, &object_list);
@@ -180,7 +185,7 @@ void object_unref(void *obj)
 void object_dispose(void *object)
 {
 	object_t *obj;
-	mowgli_patricia_t *privatedata, *metadata;
+	mowgli_patricia_t *privatedata;
 
 	return_if_fail(object != NULL);
 	obj = object(object);
@@ -195,7 +200,6 @@ void object_dispose(void *object)
 	obj->refcount = -1;
 
 	privatedata = obj->privatedata;
-	metadata = obj->metadata;
 
 #ifdef OBJECT_DEBUG
 	mowgli_node_delete(&obj->dnode, &object_list);
@@ -211,88 +215,294 @@ void object_dispose(void *object)
 
 	if (privatedata != NULL)
 		mowgli_patricia_destroy(privatedata, NULL, NULL);
+}
+
+static metadata_key_t *metadata_key_get(const char *name)
+{
+	metadata_key_t *key;
+
+	key = mowgli_patricia_retrieve(metadata_keys, name);
+	if (key == NULL)
+	{
+		key = mowgli_heap_alloc(metadata_key_heap);
+		key->name = strshare_get(name);
+		mowgli_patricia_add(metadata_keys, key->name, key);
+	}
+
+	key->refcount++;
+
+	return key;
+}
+
+static void metadata_key_unref(metadata_key_t *key)
+{
+	if (--key->refcount > 0)
+		return;
+
+	mowgli_patricia_delete(metadata_keys, key->name);
+	strshare_unref(key->name);
+	mowgli_heap_free(metadata_key_heap, key);
+}
+
+/*
+ * metadata_key_register
+ *
+ * Looks up a metadata name once, for use with metadata_find_key().
+ *
+ * Inputs:
+ *      - the metadata name
+ *
+ * Outputs:
+ *      - a handle which stays valid until shutdown
+ *
+ * Side Effects:
+ *      - none
+ */
+metadata_key_t *metadata_key_register(const char *name)
+{
+	return_val_if_fail(name != NULL, NULL);
+
+	return metadata_key_get(name);
+}
+
+/* objects with more entries than this are searched by bisection */
+#define METADATA_LINEAR_MAX	8
+
+/* the order the strcasecanon()ed patricia used to iterate in */
+static inline int metadata_namecmp(const char *a, const char *b)
+{
+	int ca, cb;
+
+	for (;; a++, b++)
+	{
+		ca = toupper((unsigned char)*a);
+		cb = toupper((unsigned char)*b);
+
+		if (ca != cb || ca == '\0')
+			return ca - cb;
+	}
+}
+
+/*
+ * Finds the slot holding name, or the slot it would be inserted at.  Names
+ * are shared strings, so most lookups match on the pointer alone.
+ */
+static unsigned int metadata_search(object_t *obj, const char *name, bool *found)
+{
+	unsigned int lo, hi, mid;
+	int cmp;
+
+	*found = false;
+
+	if (obj->mdcount <= METADATA_LINEAR_MAX)
+	{
+		for (lo = 0; lo < obj->mdcount; lo++)
+		{
+			if (obj->metadata[lo]->name == name)
+				cmp = 0;
+			else
+				cmp = metadata_namecmp(obj->metadata[lo]->name, name);
+
+			if (cmp == 0)
+				*found = true;
+			if (cmp >= 0)
+				break;
+		}
+
+		return lo;
+	}
+
+	lo = 0;
+	hi = obj->mdcount;
+
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		cmp = metadata_namecmp(obj->metadata[mid]->name, name);
+
+		if (cmp == 0)
+		{
+			*found = true;
+			return mid;
+		}
+		else if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void metadata_remove(void *target, unsigned int pos)
+{
+	object_t *obj = object(target);
+	metadata_t *md = obj->metadata[pos];
+
+	obj->mdcount--;
+	memmove(&obj->metadata[pos], &obj->metadata[pos + 1], (obj->mdcount - pos) * sizeof(metadata_t *));
+
+	if (obj->mdcount == 0)
+	{
+		free(obj->metadata);
+		obj->metadata = NULL;
+		obj->mdsize = 0;
+	}
 
-	if (metadata != NULL)
-		mowgli_patricia_destroy(metadata, NULL, NULL);
+	metadata_journal(target, md->name, NULL);
+
+	metadata_key_unref(md->key);
+	strshare_unref(md->name);
+	free(md->value);
+
+	mowgli_heap_free(metadata_heap, md);
 }
 
 metadata_t *metadata_add(void *target, const char *name, const char *value)
 {
 	object_t *obj;
 	metadata_t *md;
+	stringref sname;
+	unsigned int pos;
+	bool found;
 
 	return_val_if_fail(name != NULL, NULL);
 	return_val_if_fail(value != NULL, NULL);
 
 	obj = object(target);
 
-	if (obj->metadata == NULL)
-		obj->metadata = mowgli_patricia_create(strcasecanon);
+	/* name may be the entry being replaced */
+	sname = strshare_get(name);
+
+	pos = metadata_search(obj, sname, &found);
+	if (found)
+		metadata_remove(target, pos);
 
-	if (metadata_find(target, name))
-		metadata_delete(target, name);
+	if (obj->mdcount == obj->mdsize)
+	{
+		obj->mdsize = obj->mdsize != 0 ? obj->mdsize * 2 : 2;
+		obj->metadata = srealloc(obj->metadata, obj->mdsize * sizeof(metadata_t *));
+	}
 
 	md = mowgli_heap_alloc(metadata_heap);
 
-	md->name = strshare_get(name);
+	md->name = sname;
 	md->value = sstrdup(value);
+	md->key = metadata_key_get(sname);
 
-	mowgli_patricia_add(obj->metadata, md->name, md);
+	memmove(&obj->metadata[pos + 1], &obj->metadata[pos], (obj->mdcount - pos) * sizeof(metadata_t *));
+	obj->metadata[pos] = md;
+	obj->mdcount++;
+
+	metadata_journal(target, md->name, md->value);
 
 	return md;
 }
 
 void metadata_delete(void *target, const char *name)
 {
-	object_t *obj;
-	metadata_t *md = metadata_find(target, name);
+	unsigned int pos;
+	bool found;
 
-	if (!md)
-		return;
+	return_if_fail(target != NULL);
+	return_if_fail(name != NULL);
 
-	obj = object(target);
+	pos = metadata_search(object(target), name, &found);
+	if (found)
+		metadata_remove(target, pos);
+}
 
-	if (obj->metadata == NULL)
-		obj->metadata = mowgli_patricia_create(strcasecanon);
+metadata_t *metadata_find(void *target, const char *name)
+{
+	object_t *obj;
+	unsigned int pos;
+	bool found;
 
-	mowgli_patricia_delete(obj->metadata, name);
+	return_val_if_fail(target != NULL, NULL);
+	return_val_if_fail(name != NULL, NULL);
 
-	strshare_unref(md->name);
-	free(md->value);
+	obj = object(target);
 
-	mowgli_heap_free(metadata_heap, md);
+	pos = metadata_search(obj, name, &found);
+
+	return found ? obj->metadata[pos] : NULL;
 }
 
-metadata_t *metadata_find(void *target, const char *name)
+/*
+ * metadata_find_key
+ *
+ * Like metadata_find(), but with a name from metadata_key_register(), so
+ * that most objects can be searched by comparing pointers.
+ */
+metadata_t *metadata_find_key(void *target, metadata_key_t *key)
 {
 	object_t *obj;
+	unsigned int i;
+	bool found;
 
 	return_val_if_fail(target != NULL, NULL);
-	return_val_if_fail(name != NULL, NULL);
+	return_val_if_fail(key != NULL, NULL);
 
 	obj = object(target);
 
-	if (obj->metadata == NULL)
-		obj->metadata = mowgli_patricia_create(strcasecanon);
+	if (obj->mdcount <= METADATA_LINEAR_MAX)
+	{
+		for (i = 0; i < obj->mdcount; i++)
+			if (obj->metadata[i]->key == key)
+				return obj->metadata[i];
 
-	return mowgli_patricia_retrieve(obj->metadata, name);
+		return NULL;
+	}
+
+	i = metadata_search(obj, key->name, &found);
+
+	return found ? obj->metadata[i] : NULL;
 }
 
 void metadata_delete_all(void *target)
 {
 	object_t *obj;
-	metadata_t *md;
-	mowgli_patricia_iteration_state_t state;
+
+	return_if_fail(target != NULL);
 
 	obj = object(target);
 
-	if (obj->metadata == NULL)
-		obj->metadata = mowgli_patricia_create(strcasecanon);
+	while (obj->mdcount > 0)
+		metadata_remove(target, obj->mdcount - 1);
+}
 
-	MOWGLI_PATRICIA_FOREACH(md, &state, obj->metadata)
-	{
-		metadata_delete(obj, md->name);
-	}
+/*
+ * metadata_next
+ *
+ * Steps a METADATA_FOREACH() loop.
+ *
+ * Inputs:
+ *      - the object being walked
+ *      - the iteration state
+ *
+ * Outputs:
+ *      - the next metadata entry, or NULL at the end
+ *
+ * Side Effects:
+ *      - none
+ */
+metadata_t *metadata_next(void *target, metadata_iteration_state_t *state)
+{
+	object_t *obj;
+
+	return_val_if_fail(target != NULL, NULL);
+	return_val_if_fail(state != NULL, NULL);
+
+	obj = object(target);
+
+	/* if the entry we returned last time is gone, the next one has moved into its slot */
+	if (state->last != NULL && state->pos < obj->mdcount && obj->metadata[state->pos] == state->last)
+		state->pos++;
+
+	if (state->pos >= obj->mdcount)
+		return state->last = NULL;
+
+	return state->last = obj->metadata[state->pos];
 }
 
 void *privatedata_get(void *target, const char *key)
@@ -36,23 +36,34 @@ static void irc_recvq_handler(connection_t *cptr)
 {
 	bool wasnonl;
 	char parsebuf[BUFSIZE + 1];
-	int count;
-
-	wasnonl = cptr->flags & CF_NONEWLINE ? true : false;
-	count = recvq_getline(cptr, parsebuf, sizeof parsebuf - 1);
-	if (count <= 0)
-		return;
-	cnt.bin += count;
-	/* ignore the excessive part of a too long line */
-	if (wasnonl)
-		return;
-	me.uplinkpong = CURRTIME;
-	if (parsebuf[count - 1] == '\n')
-		count--;
-	if (count > 0 && parsebuf[count - 1] == '\r')
-		count--;
-	parsebuf[count] = '\0';
-	parse(parsebuf);
+	char *line;
+	size_t count;
+
+	/* parse every complete line we have, in place */
+	while (!(cptr->flags & CF_DEAD))
+	{
+		wasnonl = cptr->flags & CF_NONEWLINE ? true : false;
+		line = recvq_getline_ref(cptr, sizeof parsebuf - 1, &count);
+		if (line == NULL)
+			return;
+		cnt.bin += count;
+		/* ignore the excessive part of a too long line */
+		if (wasnonl)
+			continue;
+		me.uplinkpong = CURRTIME;
+		if (cptr->flags & CF_NONEWLINE)
+		{
+			/* the start of a too long line is not terminated */
+			memcpy(parsebuf, line, count);
+			line = parsebuf;
+		}
+		else
+			count--;
+		if (count > 0 && line[count - 1] == '\r')
+			count--;
+		line[count] = '\0';
+		parse(line);
+	}
 }
 
 static void ping_uplink(void *arg)
@@ -293,22 +293,14 @@ mowgli_node_t *generic_next_matching_ban(channel_t *c, user_t *u, int type, mowg
 {
 	chanban_t *cb;
 	mowgli_node_t *n;
-	char hostbuf[NICKLEN+USERLEN+HOSTLEN];
-	char cloakbuf[NICKLEN+USERLEN+HOSTLEN];
-	char realbuf[NICKLEN+USERLEN+HOSTLEN];
-	char ipbuf[NICKLEN+USERLEN+HOSTLEN];
-
-	snprintf(hostbuf, sizeof hostbuf, "%s!%s@%s", u->nick, u->user, u->vhost);
-	snprintf(cloakbuf, sizeof cloakbuf, "%s!%s@%s", u->nick, u->user, u->chost);
-	snprintf(realbuf, sizeof realbuf, "%s!%s@%s", u->nick, u->user, u->host);
-	/* will be nick!user@ if ip unknown, doesn't matter */
-	snprintf(ipbuf, sizeof ipbuf, "%s!%s@%s", u->nick, u->user, u->ip);
+	const hostmask_target_t *target = hostmask_target_get(u);
+	bool cidr = (ircd->flags & IRCD_CIDR_BANS) != 0;
+
 	MOWGLI_ITER_FOREACH(n, first)
 	{
 		cb = n->data;
 
-		if (cb->type == type &&
-				(!match(cb->mask, hostbuf) || !match(cb->mask, cloakbuf) || !match(cb->mask, realbuf) || !match(cb->mask, ipbuf) || (ircd->flags & IRCD_CIDR_BANS && !match_cidr(cb->mask, ipbuf))))
+		if (cb->type == type && hostmask_match_target(&cb->hostmask, target, true, cidr))
 			return n;
 	}
 	return NULL;
@@ -318,14 +310,8 @@ mowgli_node_t *generic_next_matching_host_chanacs(mychan_t *mc, user_t *u, mowgl
 {
 	chanacs_t *ca;
 	mowgli_node_t *n;
-	char hostbuf[NICKLEN+USERLEN+HOSTLEN];
-	char hostbuf2[NICKLEN+USERLEN+HOSTLEN];
-	char ipbuf[NICKLEN+USERLEN+HOSTLEN];
-
-	snprintf(hostbuf, sizeof hostbuf, "%s!%s@%s", u->nick, u->user, u->vhost);
-	snprintf(hostbuf2, sizeof hostbuf2, "%s!%s@%s", u->nick, u->user, u->chost);
-	/* will be nick!user@ if ip unknown, doesn't matter */
-	snprintf(ipbuf, sizeof ipbuf, "%s!%s@%s", u->nick, u->user, u->ip);
+	const hostmask_target_t *target = hostmask_target_get(u);
+	bool cidr = (ircd->flags & IRCD_CIDR_BANS) != 0;
 
 	MOWGLI_ITER_FOREACH(n, first)
 	{
@@ -333,7 +319,7 @@ mowgli_node_t *generic_next_matching_host_chanacs(mychan_t *mc, user_t *u, mowgl
 
 		if (ca->entity != NULL)
 		       continue;
-		if (!match(ca->host, hostbuf) || !match(ca->host, hostbuf2) || !match(ca->host, ipbuf) || (ircd->flags & IRCD_CIDR_BANS && !match_cidr(ca->host, ipbuf)))
+		if (hostmask_match_target(&ca->hostmask, target, false, cidr))
 			return n;
 	}
 	return NULL;
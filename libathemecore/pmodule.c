@@ -26,6 +26,16 @@
 
 mowgli_patricia_t *pcommands;
 
+/*
+ * Dispatch table for pcommand_find(), rebuilt on the first lookup after
+ * the set of tokens changes.  The seed is chosen so that every token has
+ * a slot to itself, so a lookup is one hash and one string comparison.
+ */
+static pcommand_t **pcommand_table;
+static unsigned int pcommand_mask;
+static unsigned int pcommand_seed;
+static bool pcommand_table_stale = true;
+
 mowgli_heap_t *pcommand_heap;
 mowgli_heap_t *messagetree_heap;
 
@@ -56,7 +66,7 @@ void pcommand_add(const char *token, void (*handler) (sourceinfo_t *si, int parc
 {
 	pcommand_t *pcmd;
 
-	if (pcommand_find(token))
+	if (mowgli_patricia_retrieve(pcommands, token))
 	{
 		slog(LG_INFO, "pcommand_add(): token %s is already registered", token);
 		return;
@@ -69,28 +79,94 @@ void pcommand_add(const char *token, void (*handler) (sourceinfo_t *si, int parc
 	pcmd->sourcetype = sourcetype;
 
 	mowgli_patricia_add(pcommands, pcmd->token, pcmd);
+	pcommand_table_stale = true;
 }
 
 void pcommand_delete(const char *token)
 {
 	pcommand_t *pcmd;
 
-	if (!(pcmd = pcommand_find(token)))
+	if (!(pcmd = mowgli_patricia_retrieve(pcommands, token)))
 	{
 		slog(LG_INFO, "pcommand_delete(): token %s is not registered", token);
 		return;
 	}
 
 	mowgli_patricia_delete(pcommands, pcmd->token);
+	pcommand_table_stale = true;
 
 	free(pcmd->token);
 	pcmd->handler = NULL;
 	mowgli_heap_free(pcommand_heap, pcmd);
 }
 
+static inline unsigned int pcommand_hash(const char *token, unsigned int seed)
+{
+	unsigned int h = 2166136261U ^ seed;
+
+	while (*token != '\0')
+		h = (h ^ (unsigned char)*token++) * 16777619U;
+
+	return h ^ (h >> 15);
+}
+
+static bool pcommand_table_fill(unsigned int size, unsigned int seed)
+{
+	mowgli_patricia_iteration_state_t state;
+	pcommand_t *pcmd;
+	unsigned int slot;
+
+	memset(pcommand_table, 0, size * sizeof(pcommand_t *));
+
+	MOWGLI_PATRICIA_FOREACH(pcmd, &state, pcommands)
+	{
+		slot = pcommand_hash(pcmd->token, seed) & (size - 1);
+		if (pcommand_table[slot] != NULL)
+			return false;
+
+		pcommand_table[slot] = pcmd;
+	}
+
+	return true;
+}
+
+static void pcommand_table_build(void)
+{
+	unsigned int size, seed;
+
+	size = 16;
+	while (size < 4 * mowgli_patricia_size(pcommands))
+		size *= 2;
+
+	for (;; size *= 2)
+	{
+		pcommand_table = srealloc(pcommand_table, size * sizeof(pcommand_t *));
+
+		for (seed = 0; seed < 64; seed++)
+		{
+			if (pcommand_table_fill(size, seed))
+			{
+				pcommand_mask = size - 1;
+				pcommand_seed = seed;
+				pcommand_table_stale = false;
+				return;
+			}
+		}
+	}
+}
+
 pcommand_t *pcommand_find(const char *token)
 {
-	return mowgli_patricia_retrieve(pcommands, token);
+	pcommand_t *pcmd;
+
+	if (pcommand_table_stale)
+		pcommand_table_build();
+
+	pcmd = pcommand_table[pcommand_hash(token, pcommand_seed) & pcommand_mask];
+	if (pcmd == NULL || strcmp(pcmd->token, token))
+		return NULL;
+
+	return pcmd;
 }
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
@@ -249,6 +249,7 @@ void handle_stats(user_t *u, char req)
 #endif
 
 		  numeric_sts(me.me, 249, u, "T :bytes sent %7.2f%s", bytes(cnt.bout), sbytes(cnt.bout));
+		  numeric_sts(me.me, 249, u, "T :writes     %7u", cnt.bwrites);
 		  numeric_sts(me.me, 249, u, "T :bytes recv %7.2f%s", bytes(cnt.bin), sbytes(cnt.bin));
 		  break;
 
@@ -25,12 +25,25 @@
 #include "uplink.h"
 #include "datastream.h"
 
+/* queue a line of at most 510 bytes followed by two spare bytes for the \r\n */
+static void sts_write(char *buf, size_t len)
+{
+	buf[len++] = '\r';
+	buf[len++] = '\n';
+	buf[len] = '\0';
+
+	cnt.bout += len;
+
+	sendq_add(curr_uplink->conn, buf, len);
+
+	slog(LG_RAWDATA, "<- %.*s", (int)len, buf);
+}
+
 /* send a line to the server, append the \r\n */
 int sts(const char *fmt, ...)
 {
 	va_list ap;
 	char buf[513];
-	int len;
 
 	if (!me.connected)
 		return 0;
@@ -43,18 +56,96 @@ int sts(const char *fmt, ...)
 	vsnprintf(buf, 511, fmt, ap); /* leave two bytes for \r\n */
 	va_end(ap);
 
-	len = strlen(buf);
-	buf[len++] = '\r';
-	buf[len++] = '\n';
-	buf[len] = '\0';
+	sts_write(buf, strlen(buf));
 
-	cnt.bout += len;
+	return 0;
+}
 
-	sendq_add(curr_uplink->conn, buf, len);
+/*
+ * The stsline_*() functions build a line for the uplink piece by piece,
+ * for the messages that are sent often enough that going through
+ * vsnprintf() for each of them shows up.  A line is truncated to 510
+ * bytes just like sts() does.
+ *
+ *   stsline_t l;
+ *
+ *   stsline_init(&l);
+ *   stsline_source(&l, ME);
+ *   stsline_add(&l, "KICK");
+ *   stsline_add(&l, c->name);
+ *   stsline_add(&l, CLIENT_NAME(u));
+ *   stsline_text(&l, reason);
+ *   stsline_send(&l);
+ */
+void stsline_init(stsline_t *l)
+{
+	l->len = 0;
+}
 
-	slog(LG_RAWDATA, "<- %.*s", len, buf);
+/* appends s as is */
+void stsline_cat(stsline_t *l, const char *s)
+{
+	size_t n;
 
-	return 0;
+	if (s == NULL)
+		return;
+
+	n = strlen(s);
+	if (n > STSLINE_MAX - l->len)
+		n = STSLINE_MAX - l->len;
+
+	memcpy(l->buf + l->len, s, n);
+	l->len += n;
+}
+
+/* appends ":source", which must come first */
+void stsline_source(stsline_t *l, const char *source)
+{
+	stsline_cat(l, ":");
+	stsline_cat(l, source);
+}
+
+/* appends a parameter, separated from what came before by a space */
+void stsline_add(stsline_t *l, const char *word)
+{
+	if (l->len != 0)
+		stsline_cat(l, " ");
+	stsline_cat(l, word);
+}
+
+/* appends a number, such as a TS, as a parameter */
+void stsline_add_uint(stsline_t *l, unsigned long n)
+{
+	char buf[3 * sizeof n + 1];
+	char *p = buf + sizeof buf;
+
+	*--p = '\0';
+	do
+	{
+		*--p = '0' + n % 10;
+		n /= 10;
+	} while (n != 0);
+
+	stsline_add(l, p);
+}
+
+/* appends the final parameter, which may contain spaces */
+void stsline_text(stsline_t *l, const char *text)
+{
+	stsline_add(l, ":");
+	stsline_cat(l, text);
+}
+
+/* sends the line to the uplink */
+void stsline_send(stsline_t *l)
+{
+	if (!me.connected)
+		return;
+
+	return_if_fail(curr_uplink != NULL);
+	return_if_fail(curr_uplink->conn != NULL);
+
+	sts_write(l->buf, l->len);
 }
 
 /*
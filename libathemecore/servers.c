@@ -28,6 +28,9 @@ mowgli_patricia_t *servlist;
 mowgli_list_t tldlist;
 
 mowgli_heap_t *serv_heap;
+
+/* servers whose SID the UID provider can decode */
+static uid_index_t sid_table;
 mowgli_heap_t *tld_heap;
 
 static void server_delete_serv(server_t *s);
@@ -85,6 +88,7 @@ server_t *server_add(const char *name, unsigned int hops, server_t *uplink, cons
 {
 	server_t *s;
 	const char *tld;
+	uint64_t key;
 
 	/* Masked servers must have a SID */
 	return_val_if_fail(name != NULL || id != NULL, NULL);
@@ -109,6 +113,9 @@ server_t *server_add(const char *name, unsigned int hops, server_t *uplink, cons
 	{
 		s->sid = sstrdup(id);
 		mowgli_patricia_add(sidlist, s->sid, s);
+
+		if (uid_index_key(s->sid, &key))
+			uid_index_add(&sid_table, key, s);
 	}
 
 	/* check to see if it's hidden */
@@ -152,6 +159,62 @@ server_t *server_add(const char *name, unsigned int hops, server_t *uplink, cons
 	return s;
 }
 
+/*
+ * server_split_collect(server_t *s, hook_users_split_t *hdata)
+ *
+ * Marks a server and everything behind it as splitting and gathers the
+ * users and the channels they are on for the users_split hook.
+ */
+static void server_split_collect(server_t *s, hook_users_split_t *hdata)
+{
+	mowgli_node_t *n, *n2;
+	user_t *u;
+	chanuser_t *cu;
+	unsigned int size;
+
+	if (s->sid)
+		slog(me.connected ? LG_NETWORK : LG_DEBUG, "server_delete(): %s (%s), uplink %s (%d users)",
+				s->name, s->sid,
+				s->uplink != NULL ? s->uplink->name : "<none>",
+				s->users);
+	else
+		slog(me.connected ? LG_NETWORK : LG_DEBUG, "server_delete(): %s, uplink %s (%d users)",
+				s->name, s->uplink != NULL ? s->uplink->name : "<none>",
+				s->users);
+
+	hook_call_server_delete((&(hook_server_delete_t){ .s = s }));
+
+	size = hdata->nusers + MOWGLI_LIST_LENGTH(&s->userlist);
+	if (size > 0)
+		hdata->users = srealloc(hdata->users, size * sizeof(user_t *));
+
+	MOWGLI_ITER_FOREACH(n, s->userlist.head)
+	{
+		u = n->data;
+		u->flags |= UF_SPLIT;
+		hdata->users[hdata->nusers++] = u;
+
+		MOWGLI_ITER_FOREACH(n2, u->channels.head)
+		{
+			cu = n2->data;
+			if (cu->chan->flags & CHAN_SPLIT)
+				continue;
+
+			cu->chan->flags |= CHAN_SPLIT;
+
+			/* 16 entries, then doubled whenever a power of two is full */
+			if (hdata->nchannels == 0)
+				hdata->channels = smalloc(16 * sizeof(channel_t *));
+			else if (hdata->nchannels >= 16 && (hdata->nchannels & (hdata->nchannels - 1)) == 0)
+				hdata->channels = srealloc(hdata->channels, hdata->nchannels * 2 * sizeof(channel_t *));
+			hdata->channels[hdata->nchannels++] = cu->chan;
+		}
+	}
+
+	MOWGLI_ITER_FOREACH(n, s->children.head)
+		server_split_collect(n->data, hdata);
+}
+
 /*
  * server_delete(const char *name)
  *
@@ -164,11 +227,17 @@ server_t *server_add(const char *name, unsigned int hops, server_t *uplink, cons
  *     - nothing
  *
  * Side Effects:
- *     - all users and servers attached to the target are recursively deleted
+ *     - the server_delete hook is called for the server and each server
+ *       behind it, then the users_split hook once for all their users
+ *     - all users and servers attached to the target are deleted; the
+ *       users leave their channels one channel at a time
  */
 void server_delete(const char *name)
 {
 	server_t *s = server_find(name);
+	hook_users_split_t hdata = { .s = s };
+	unsigned int i;
+	user_t *u;
 
 	if (!s)
 	{
@@ -176,14 +245,6 @@ void server_delete(const char *name)
 
 		return;
 	}
-	server_delete_serv(s);
-}
-
-static void server_delete_serv(server_t *s)
-{
-	server_t *child;
-	user_t *u;
-	mowgli_node_t *n, *tn;
 
 	if (s == me.me)
 	{
@@ -195,22 +256,16 @@ static void server_delete_serv(server_t *s)
 		return;
 	}
 
-	if (s->sid)
-		slog(me.connected ? LG_NETWORK : LG_DEBUG, "server_delete(): %s (%s), uplink %s (%d users)",
-				s->name, s->sid,
-				s->uplink != NULL ? s->uplink->name : "<none>",
-				s->users);
-	else
-		slog(me.connected ? LG_NETWORK : LG_DEBUG, "server_delete(): %s, uplink %s (%d users)",
-				s->name, s->uplink != NULL ? s->uplink->name : "<none>",
-				s->users);
+	server_split_collect(s, &hdata);
 
-	hook_call_server_delete((&(hook_server_delete_t){ .s = s }));
+	hook_call_users_split(&hdata);
 
-	/* first go through it's users and kill all of them */
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, s->userlist.head)
+	for (i = 0; i < hdata.nchannels; i++)
+		chanuser_delete_split(hdata.channels[i]);
+
+	for (i = 0; i < hdata.nusers; i++)
 	{
-		u = (user_t *)n->data;
+		u = hdata.users[i];
 		/* This user split, allow bursted logins for the account.
 		 * XXX should we do this here?
 		 * -- jilles */
@@ -219,6 +274,21 @@ static void server_delete_serv(server_t *s)
 		user_delete(u, "*.net *.split");
 	}
 
+	free(hdata.users);
+	free(hdata.channels);
+
+	server_delete_serv(s);
+}
+
+/* unlinks a server and its children once all their users are gone */
+static void server_delete_serv(server_t *s)
+{
+	server_t *child;
+	mowgli_node_t *n, *tn;
+	uint64_t key;
+
+	soft_assert(MOWGLI_LIST_LENGTH(&s->userlist) == 0);
+
 	MOWGLI_ITER_FOREACH_SAFE(n, tn, s->children.head)
 	{
 		child = n->data;
@@ -230,8 +300,13 @@ static void server_delete_serv(server_t *s)
 		mowgli_patricia_delete(servlist, s->name);
 
 	if (s->sid)
+	{
 		mowgli_patricia_delete(sidlist, s->sid);
 
+		if (uid_index_key(s->sid, &key))
+			uid_index_delete(&sid_table, key);
+	}
+
 	if (s->uplink)
 	{
 		n = mowgli_node_find(s, &s->uplink->children);
@@ -273,8 +348,12 @@ static void server_delete_serv(server_t *s)
 server_t *server_find(const char *name)
 {
 	server_t *s;
+	uint64_t key;
 
-	s = mowgli_patricia_retrieve(sidlist, name);
+	if (uid_index_key(name, &key))
+		s = uid_index_find(&sid_table, key);
+	else
+		s = mowgli_patricia_retrieve(sidlist, name);
 	if (s != NULL)
 		return s;
 
@@ -39,6 +39,129 @@ const char *uid_get(void)
 	return NULL;
 }
 
+/*
+ * uid_index_key(const char *id, uint64_t *key)
+ *
+ * Decodes a SID or UID with the UID provider, for use with the
+ * uid_index_*() functions.
+ *
+ * Inputs:
+ *       - a SID, UID or anything else a message could be from
+ *       - where to store the key
+ *
+ * Outputs:
+ *       - false if the provider cannot decode it, in which case it can
+ *         only be found by name
+ */
+bool uid_index_key(const char *id, uint64_t *key)
+{
+	if (uid_provider_impl == NULL || uid_provider_impl->uid_decode == NULL)
+		return false;
+
+	return uid_provider_impl->uid_decode(id, key);
+}
+
+static inline unsigned int uid_index_slot(const uid_index_t *idx, uint64_t key)
+{
+	return (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (idx->size - 1);
+}
+
+static void uid_index_resize(uid_index_t *idx, unsigned int size)
+{
+	uint64_t *keys = idx->keys;
+	void **values = idx->values;
+	unsigned int oldsize = idx->size, i, slot;
+
+	idx->keys = scalloc(size, sizeof(uint64_t));
+	idx->values = scalloc(size, sizeof(void *));
+	idx->size = size;
+
+	for (i = 0; i < oldsize; i++)
+	{
+		if (keys[i] == 0)
+			continue;
+
+		for (slot = uid_index_slot(idx, keys[i]); idx->keys[slot] != 0; slot = (slot + 1) & (size - 1))
+			;
+
+		idx->keys[slot] = keys[i];
+		idx->values[slot] = values[i];
+	}
+
+	free(keys);
+	free(values);
+}
+
+void uid_index_add(uid_index_t *idx, uint64_t key, void *value)
+{
+	unsigned int slot;
+
+	return_if_fail(idx != NULL);
+	return_if_fail(key != 0);
+
+	/* keep it at most half full so that probes stay short */
+	if ((idx->count + 1) * 2 > idx->size)
+		uid_index_resize(idx, idx->size != 0 ? idx->size * 2 : 64);
+
+	for (slot = uid_index_slot(idx, key); idx->keys[slot] != 0; slot = (slot + 1) & (idx->size - 1))
+	{
+		if (idx->keys[slot] == key)
+		{
+			idx->values[slot] = value;
+			return;
+		}
+	}
+
+	idx->keys[slot] = key;
+	idx->values[slot] = value;
+	idx->count++;
+}
+
+void uid_index_delete(uid_index_t *idx, uint64_t key)
+{
+	unsigned int slot, next, home;
+
+	return_if_fail(idx != NULL);
+
+	if (idx->size == 0)
+		return;
+
+	for (slot = uid_index_slot(idx, key); idx->keys[slot] != key; slot = (slot + 1) & (idx->size - 1))
+		if (idx->keys[slot] == 0)
+			return;
+
+	/* pull later entries of the same run back, so no lookup stops early */
+	for (next = (slot + 1) & (idx->size - 1); idx->keys[next] != 0; next = (next + 1) & (idx->size - 1))
+	{
+		home = uid_index_slot(idx, idx->keys[next]);
+
+		if (((next - home) & (idx->size - 1)) >= ((next - slot) & (idx->size - 1)))
+		{
+			idx->keys[slot] = idx->keys[next];
+			idx->values[slot] = idx->values[next];
+			slot = next;
+		}
+	}
+
+	idx->keys[slot] = 0;
+	idx->values[slot] = NULL;
+	idx->count--;
+}
+
+void *uid_index_find(const uid_index_t *idx, uint64_t key)
+{
+	unsigned int slot;
+
+	if (idx->size == 0)
+		return NULL;
+
+	for (slot = uid_index_slot(idx, key); idx->keys[slot] != 0; slot = (slot + 1) & (idx->size - 1))
+		if (idx->keys[slot] == key)
+			return idx->values[slot];
+
+	return NULL;
+}
+
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
  * vim:ts=8
  * vim:sw=8
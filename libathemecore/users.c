@@ -28,6 +28,9 @@ mowgli_heap_t *user_heap;
 mowgli_patricia_t *userlist;
 mowgli_patricia_t *uidlist;
 
+/* users whose UID the UID provider can decode, so user_find() need not canonicalize */
+static uid_index_t uid_table;
+
 /*
  * init_users()
  *
@@ -86,6 +89,7 @@ user_t *user_add(const char *nick, const char *user, const char *host,
 	server_t *server, time_t ts)
 {
 	user_t *u, *u2;
+	uint64_t key;
 	hook_user_nick_t hdata;
 
 	slog(LG_DEBUG, "user_add(): %s (%s@%s) -> %s", nick, user, host, server->name);
@@ -157,6 +161,9 @@ user_t *user_add(const char *nick, const char *user, const char *host,
 	{
 		u->uid = strshare_get(uid);
 		mowgli_patricia_add(uidlist, u->uid, u);
+
+		if (uid_index_key(u->uid, &key))
+			uid_index_add(&uid_table, key, u);
 	}
 
 	u->nick = strshare_get(nick);
@@ -168,6 +175,7 @@ user_t *user_add(const char *nick, const char *user, const char *host,
 
 	if (ip && strcmp(ip, "0") && strcmp(ip, "0.0.0.0") && strcmp(ip, "255.255.255.255"))
 		u->ip = strshare_get(ip);
+	cidr_parse_addr(u->ip, &u->ipaddr);
 
 	u->server = server;
 	u->server->users++;
@@ -208,6 +216,7 @@ void user_delete(user_t *u, const char *comment)
 	mynick_t *mn;
 	char oldnick[NICKLEN];
 	bool doenforcer = false;
+	uint64_t key;
 
 	return_if_fail(u != NULL);
 
@@ -247,8 +256,13 @@ void user_delete(user_t *u, const char *comment)
 	mowgli_patricia_delete(userlist, u->nick);
 
 	if (u->uid != NULL)
+	{
 		mowgli_patricia_delete(uidlist, u->uid);
 
+		if (uid_index_key(u->uid, &key))
+			uid_index_delete(&uid_table, key);
+	}
+
 	mowgli_node_delete(&u->snode, &u->server->userlist);
 
 	if (u->myuser)
@@ -278,6 +292,8 @@ void user_delete(user_t *u, const char *comment)
 	strshare_unref(u->chost);
 	strshare_unref(u->ip);
 
+	hostmask_target_free(u);
+
 	mowgli_heap_free(user_heap, u);
 
 	cnt.user--;
@@ -304,12 +320,16 @@ void user_delete(user_t *u, const char *comment)
 user_t *user_find(const char *nick)
 {
 	user_t *u;
+	uint64_t key;
 
 	return_val_if_fail(nick != NULL, NULL);
 
 	if (ircd->uses_uid)
 	{
-		u = mowgli_patricia_retrieve(uidlist, nick);
+		if (uid_index_key(nick, &key))
+			u = uid_index_find(&uid_table, key);
+		else
+			u = mowgli_patricia_retrieve(uidlist, nick);
 
 		if (u != NULL)
 			return u;
@@ -364,16 +384,28 @@ user_t *user_find_named(const char *nick)
  */
 void user_changeuid(user_t *u, const char *uid)
 {
+	uint64_t key;
+
 	return_if_fail(u != NULL);
 
 	if (u->uid != NULL)
+	{
 		mowgli_patricia_delete(uidlist, u->uid);
 
+		if (uid_index_key(u->uid, &key))
+			uid_index_delete(&uid_table, key);
+	}
+
 	strshare_unref(u->uid);
 	u->uid = strshare_get(uid);
 
 	if (u->uid != NULL)
+	{
 		mowgli_patricia_add(uidlist, u->uid, u);
+
+		if (uid_index_key(u->uid, &key))
+			uid_index_add(&uid_table, key, u);
+	}
 }
 
 /*
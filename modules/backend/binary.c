@@ -0,0 +1,905 @@
+/*
+ * Copyright (c) 2005-2014 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * This file contains a binary database backend for Atheme.  It stores the
+ * same rows and cells as OpenSEX, but with interned row types, varint numbers
+ * and length-prefixed strings, so neither loading nor saving has to format or
+ * parse any text.  Use dbverify to convert between this and OpenSEX.
+ *
+ * File layout:
+ *   magic "ATHBDB\r\n", varint format version
+ *   records: varint 0, varint length, type name      -- defines the next type id
+ *            varint 0, varint 0                      -- forgets all type ids
+ *            varint type id, varint length, cells    -- a row
+ *   cells:   BDB_CELL_STR, varint length, bytes
+ *            BDB_CELL_INT, zigzag varint
+ *            BDB_CELL_UINT, varint
+ */
+
+#include "atheme.h"
+
+#ifndef MOWGLI_OS_WIN
+# include <sys/mman.h>
+#endif
+
+DECLARE_MODULE_V1
+(
+	"backend/binary", true, _modinit, NULL,
+	PACKAGE_STRING,
+	"Atheme Development Group <http://www.atheme.org>"
+);
+
+#define BDB_MAGIC		"ATHBDB\r\n"
+#define BDB_MAGICLEN		8
+#define BDB_VERSION		1
+
+#define BDB_CELL_STR		1
+#define BDB_CELL_INT		2
+#define BDB_CELL_UINT		3
+
+/* worst case expansion of a cell when it is decoded as text */
+#define BDB_CELL_EXPANSION	11
+
+typedef struct binary_ {
+	/* Reading state */
+	unsigned char *map;
+	size_t maplen;
+	bool mapped;
+	const unsigned char *pos;
+	const unsigned char *end;
+	const unsigned char *rowend;
+	char **types;
+	database_handler_f *handlers;
+	unsigned int ntypes;
+	unsigned int rowtype;
+	char *buf;
+	size_t bufsize;
+	size_t bufpos;
+	char *pending;
+
+	/* Writing state */
+	FILE *f;
+	mowgli_patricia_t *typeids;
+	unsigned char *wbuf;
+	size_t wbufsize;
+	size_t wbuflen;
+	unsigned int rowid;
+} binary_t;
+
+static void binary_corrupt(database_handle_t *db, const char *what)
+{
+	slog(LG_ERROR, "binary-read: %s at %s row %d", what, db->file, db->line);
+	slog(LG_ERROR, "binary-read: exiting to avoid data loss");
+	exit(EXIT_FAILURE);
+}
+
+/* a journal row cut short by a crash is dropped, so that appending carries on after the last whole one */
+static void binary_drop_torn(database_handle_t *db, const unsigned char *rec)
+{
+	binary_t *bs = (binary_t *)db->priv;
+
+	slog(LG_ERROR, "binary-read: dropping a torn row at the end of %s after row %d", db->file, db->line);
+
+	if (truncate(db->file, rec - bs->map) < 0)
+		slog(LG_ERROR, "binary-read: cannot truncate %s: %s", db->file, strerror(errno));
+
+	bs->pos = bs->end = rec;
+}
+
+/* whether a whole record starts at p, checked without giving up on a torn one */
+static bool binary_record_complete(const unsigned char *p, const unsigned char *end)
+{
+	uint64_t v = 0;
+	unsigned int i, shift;
+
+	for (i = 0; i < 2; i++)
+	{
+		for (v = 0, shift = 0; ; shift += 7)
+		{
+			if (p == end || shift >= 64)
+				return false;
+			v |= (uint64_t)(*p & 0x7f) << shift;
+			if (!(*p++ & 0x80))
+				break;
+		}
+	}
+
+	return v <= (uint64_t)(end - p);
+}
+
+static uint64_t binary_get_varint(database_handle_t *db, const unsigned char *end)
+{
+	binary_t *bs = (binary_t *)db->priv;
+	uint64_t v = 0;
+	unsigned int shift = 0;
+
+	while (bs->pos < end && shift < 64)
+	{
+		unsigned char c = *bs->pos++;
+
+		v |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return v;
+		shift += 7;
+	}
+
+	binary_corrupt(db, "truncated number");
+	return 0;
+}
+
+static void binary_db_parse(database_handle_t *db)
+{
+	binary_t *bs = (binary_t *)db->priv;
+	database_handler_f fun;
+
+	while (db_read_next_row(db))
+	{
+		/* types are interned, so each one is looked up only once */
+		if ((fun = bs->handlers[bs->rowtype]) == NULL)
+		{
+			fun = bs->handlers[bs->rowtype] = db_find_type_handler(bs->types[bs->rowtype]);
+			if (fun == NULL)
+				continue;
+		}
+
+		fun(db, bs->types[bs->rowtype]);
+	}
+}
+
+/***************************************************************************************************/
+
+static bool binary_read_next_row(database_handle_t *db)
+{
+	binary_t *bs = (binary_t *)db->priv;
+	uint64_t id, len;
+
+	/* skip whatever the previous handler did not consume */
+	if (bs->rowend != NULL)
+		bs->pos = bs->rowend;
+
+	while (bs->pos < bs->end)
+	{
+		if (!binary_record_complete(bs->pos, bs->end))
+		{
+			/* the journal is not fsync()ed, so its last row may be torn; the database never is */
+			if (db->txn != DB_REPLAY)
+				binary_corrupt(db, "truncated record");
+			binary_drop_torn(db, bs->pos);
+			break;
+		}
+
+		id = binary_get_varint(db, bs->end);
+		len = binary_get_varint(db, bs->end);
+
+		if (id == 0 && len == 0)
+		{
+			/* a journal reopened for appending starts its type ids over */
+			for (; bs->ntypes > 0; bs->ntypes--)
+				free(bs->types[bs->ntypes]);
+			continue;
+		}
+
+		if (id == 0)
+		{
+			bs->types = srealloc(bs->types, (bs->ntypes + 2) * sizeof(char *));
+			bs->handlers = srealloc(bs->handlers, (bs->ntypes + 2) * sizeof(database_handler_f));
+			bs->handlers[bs->ntypes + 1] = NULL;
+			bs->types[++bs->ntypes] = smalloc(len + 1);
+			memcpy(bs->types[bs->ntypes], bs->pos, len);
+			bs->types[bs->ntypes][len] = '\0';
+			bs->pos += len;
+			continue;
+		}
+
+		if (id > bs->ntypes)
+			binary_corrupt(db, "undefined row type");
+
+		if (len * BDB_CELL_EXPANSION + 1 > bs->bufsize)
+		{
+			bs->bufsize = len * BDB_CELL_EXPANSION + 1;
+			bs->buf = srealloc(bs->buf, bs->bufsize);
+		}
+
+		bs->rowtype = id;
+		bs->rowend = bs->pos + len;
+		bs->bufpos = 0;
+		bs->pending = NULL;
+
+		db->line++;
+		db->token = 0;
+		return true;
+	}
+
+	bs->rowend = NULL;
+	return false;
+}
+
+/* decodes the next cell as text into the row buffer */
+static char *binary_next_cell(database_handle_t *db)
+{
+	binary_t *bs = (binary_t *)db->priv;
+	char *res = bs->buf + bs->bufpos;
+	uint64_t v, len;
+	int n;
+
+	switch (*bs->pos++)
+	{
+		case BDB_CELL_STR:
+			len = binary_get_varint(db, bs->rowend);
+			if (len > (uint64_t)(bs->rowend - bs->pos))
+				binary_corrupt(db, "truncated string");
+			memcpy(res, bs->pos, len);
+			res[len] = '\0';
+			bs->pos += len;
+			bs->bufpos += len + 1;
+			return res;
+		case BDB_CELL_INT:
+			v = binary_get_varint(db, bs->rowend);
+			n = snprintf(res, bs->bufsize - bs->bufpos, "%lld", (long long)((v >> 1) ^ -(v & 1)));
+			break;
+		case BDB_CELL_UINT:
+			v = binary_get_varint(db, bs->rowend);
+			n = snprintf(res, bs->bufsize - bs->bufpos, "%llu", (unsigned long long)v);
+			break;
+		default:
+			binary_corrupt(db, "unknown cell type");
+			return NULL;
+	}
+
+	bs->bufpos += n + 1;
+	return res;
+}
+
+static const char *binary_read_word(database_handle_t *db)
+{
+	binary_t *bs = (binary_t *)db->priv;
+	char *res, *sp;
+
+	if (bs->pending != NULL)
+		res = bs->pending;
+	else if (bs->pos < bs->rowend)
+		res = binary_next_cell(db);
+	else
+		return NULL;
+
+	/* a multiword cell read as words splits just like it would in OpenSEX */
+	if ((sp = strchr(res, ' ')) != NULL)
+	{
+		*sp = '\0';
+		bs->pending = sp + 1;
+	}
+	else
+		bs->pending = NULL;
+
+	db->token++;
+
+	return res;
+}
+
+static const char *binary_read_str(database_handle_t *db)
+{
+	binary_t *bs = (binary_t *)db->priv;
+	char *res;
+
+	/* OpenSEX rows end in a space, so the remainder of a fully read row is "" */
+	if (bs->pending != NULL)
+		res = bs->pending;
+	else if (bs->pos < bs->rowend)
+		res = binary_next_cell(db);
+	else
+	{
+		res = bs->buf + bs->bufpos;
+		*res = '\0';
+	}
+
+	/* cells are decoded back to back, so joining them only means turning the NULs into spaces */
+	while (bs->pos < bs->rowend)
+	{
+		bs->buf[bs->bufpos - 1] = ' ';
+		binary_next_cell(db);
+	}
+
+	bs->pending = NULL;
+	db->token++;
+
+	return res;
+}
+
+static bool binary_read_number(database_handle_t *db, uint64_t *res)
+{
+	binary_t *bs = (binary_t *)db->priv;
+
+	if (bs->pending != NULL || bs->pos >= bs->rowend)
+		return false;
+
+	switch (*bs->pos)
+	{
+		case BDB_CELL_INT:
+			bs->pos++;
+			*res = binary_get_varint(db, bs->rowend);
+			*res = (*res >> 1) ^ -(*res & 1);
+			break;
+		case BDB_CELL_UINT:
+			bs->pos++;
+			*res = binary_get_varint(db, bs->rowend);
+			break;
+		default:
+			return false;
+	}
+
+	db->token++;
+	return true;
+}
+
+static bool binary_read_int(database_handle_t *db, int *res)
+{
+	const char *s;
+	char *rp;
+	uint64_t v;
+
+	if (binary_read_number(db, &v))
+	{
+		*res = (int)(int64_t)v;
+		return true;
+	}
+
+	/* not written as a number; parse it like OpenSEX would */
+	if ((s = binary_read_word(db)) == NULL)
+		return false;
+
+	*res = strtol(s, &rp, 0);
+	return *s && !*rp;
+}
+
+static bool binary_read_uint(database_handle_t *db, unsigned int *res)
+{
+	const char *s;
+	char *rp;
+	uint64_t v;
+
+	if (binary_read_number(db, &v))
+	{
+		*res = (unsigned int)v;
+		return true;
+	}
+
+	if ((s = binary_read_word(db)) == NULL)
+		return false;
+
+	*res = strtoul(s, &rp, 0);
+	return *s && !*rp;
+}
+
+static bool binary_read_time(database_handle_t *db, time_t *res)
+{
+	const char *s;
+	char *rp;
+	uint64_t v;
+
+	if (binary_read_number(db, &v))
+	{
+		*res = (time_t)(int64_t)v;
+		return true;
+	}
+
+	if ((s = binary_read_word(db)) == NULL)
+		return false;
+
+	*res = strtoul(s, &rp, 0);
+	return *s && !*rp;
+}
+
+/***************************************************************************************************/
+
+static void binary_reserve(binary_t *bs, size_t len)
+{
+	if (bs->wbuflen + len <= bs->wbufsize)
+		return;
+
+	while (bs->wbuflen + len > bs->wbufsize)
+		bs->wbufsize *= 2;
+
+	bs->wbuf = srealloc(bs->wbuf, bs->wbufsize);
+}
+
+static void binary_put_varint(binary_t *bs, uint64_t v)
+{
+	binary_reserve(bs, 10);
+
+	while (v >= 0x80)
+	{
+		bs->wbuf[bs->wbuflen++] = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	bs->wbuf[bs->wbuflen++] = (unsigned char)v;
+}
+
+static void binary_put_bytes(binary_t *bs, const void *data, size_t len)
+{
+	binary_reserve(bs, len);
+	memcpy(bs->wbuf + bs->wbuflen, data, len);
+	bs->wbuflen += len;
+}
+
+static void binary_put_varint_file(binary_t *bs, uint64_t v)
+{
+	unsigned char buf[10];
+	size_t n = 0;
+
+	while (v >= 0x80)
+	{
+		buf[n++] = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	buf[n++] = (unsigned char)v;
+
+	fwrite(buf, 1, n, bs->f);
+}
+
+static bool binary_start_row(database_handle_t *db, const char *type)
+{
+	binary_t *bs;
+	size_t len;
+
+	return_val_if_fail(db != NULL, false);
+	return_val_if_fail(type != NULL, false);
+	bs = (binary_t *)db->priv;
+
+	bs->rowid = (uintptr_t)mowgli_patricia_retrieve(bs->typeids, type);
+	if (bs->rowid == 0)
+	{
+		bs->rowid = ++bs->ntypes;
+		mowgli_patricia_add(bs->typeids, type, (void *)(uintptr_t)bs->rowid);
+
+		len = strlen(type);
+		binary_put_varint_file(bs, 0);
+		binary_put_varint_file(bs, len);
+		fwrite(type, 1, len, bs->f);
+	}
+
+	bs->wbuflen = 0;
+
+	return true;
+}
+
+static bool binary_write_cell(database_handle_t *db, const char *data)
+{
+	binary_t *bs;
+	size_t len;
+
+	return_val_if_fail(db != NULL, false);
+	bs = (binary_t *)db->priv;
+
+	if (data == NULL)
+		data = "*";
+
+	len = strlen(data);
+	binary_reserve(bs, 1);
+	bs->wbuf[bs->wbuflen++] = BDB_CELL_STR;
+	binary_put_varint(bs, len);
+	binary_put_bytes(bs, data, len);
+
+	return true;
+}
+
+static bool binary_write_word(database_handle_t *db, const char *word)
+{
+	return binary_write_cell(db, word);
+}
+
+static bool binary_write_str(database_handle_t *db, const char *str)
+{
+	return binary_write_cell(db, str);
+}
+
+static bool binary_write_int(database_handle_t *db, int num)
+{
+	binary_t *bs;
+	int64_t v = num;
+
+	return_val_if_fail(db != NULL, false);
+	bs = (binary_t *)db->priv;
+
+	binary_reserve(bs, 1);
+	bs->wbuf[bs->wbuflen++] = BDB_CELL_INT;
+	binary_put_varint(bs, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+
+	return true;
+}
+
+static bool binary_write_uint(database_handle_t *db, unsigned int num)
+{
+	binary_t *bs;
+
+	return_val_if_fail(db != NULL, false);
+	bs = (binary_t *)db->priv;
+
+	binary_reserve(bs, 1);
+	bs->wbuf[bs->wbuflen++] = BDB_CELL_UINT;
+	binary_put_varint(bs, num);
+
+	return true;
+}
+
+static bool binary_write_time(database_handle_t *db, time_t tm)
+{
+	binary_t *bs;
+
+	return_val_if_fail(db != NULL, false);
+	bs = (binary_t *)db->priv;
+
+	binary_reserve(bs, 1);
+	bs->wbuf[bs->wbuflen++] = BDB_CELL_UINT;
+	binary_put_varint(bs, (uint64_t)(int64_t)tm);
+
+	return true;
+}
+
+static bool binary_commit_row(database_handle_t *db)
+{
+	binary_t *bs;
+
+	return_val_if_fail(db != NULL, false);
+	bs = (binary_t *)db->priv;
+
+	binary_put_varint_file(bs, bs->rowid);
+	binary_put_varint_file(bs, bs->wbuflen);
+	fwrite(bs->wbuf, 1, bs->wbuflen, bs->f);
+
+	/* journal rows must reach the kernel before the change is acknowledged */
+	if (db->txn == DB_JOURNAL && fflush(bs->f) != 0)
+	{
+		slog(LG_ERROR, "db-commit-row: cannot write journal '%s': %s", db->file, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+static database_vtable_t binary_vt = {
+	.name = "binary",
+
+	.read_next_row = binary_read_next_row,
+
+	.read_word = binary_read_word,
+	.read_str = binary_read_str,
+	.read_int = binary_read_int,
+	.read_uint = binary_read_uint,
+	.read_time = binary_read_time,
+
+	.start_row = binary_start_row,
+	.write_word = binary_write_word,
+	.write_str = binary_write_str,
+	.write_int = binary_write_int,
+	.write_uint = binary_write_uint,
+	.write_time = binary_write_time,
+	.commit_row = binary_commit_row
+};
+
+static database_handle_t *binary_db_open_read(const char *filename, database_transaction_t txn)
+{
+	database_handle_t *db;
+	binary_t *bs;
+	FILE *f;
+	int errno1;
+	size_t len;
+	struct stat sb;
+	char path[BUFSIZE];
+
+	snprintf(path, BUFSIZE, "%s/%s", datadir, filename != NULL ? filename : "services.db");
+	f = fopen(path, "rb");
+	if (!f)
+	{
+		errno1 = errno;
+
+		/* ENOENT can happen if the database does not exist yet. */
+		if (errno == ENOENT)
+		{
+			slog(LG_ERROR, "db-open-read: database '%s' does not yet exist; a new one will be created.", path);
+			return NULL;
+		}
+
+		slog(LG_ERROR, "db-open-read: cannot open '%s' for reading: %s", path, strerror(errno1));
+		wallops(_("\2DATABASE ERROR\2: db-open-read: cannot open '%s' for reading: %s"), path, strerror(errno1));
+		return NULL;
+	}
+
+	if (fstat(fileno(f), &sb) < 0)
+	{
+		slog(LG_ERROR, "db-open-read: cannot stat '%s': %s", path, strerror(errno));
+		slog(LG_ERROR, "db-open-read: exiting to avoid data loss");
+		exit(EXIT_FAILURE);
+	}
+
+	bs = scalloc(sizeof(binary_t), 1);
+	bs->maplen = sb.st_size;
+
+#ifndef MOWGLI_OS_WIN
+	if (bs->maplen > 0)
+	{
+		bs->map = mmap(NULL, bs->maplen, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+		if (bs->map != MAP_FAILED)
+		{
+			bs->mapped = true;
+			madvise(bs->map, bs->maplen, MADV_SEQUENTIAL);
+		}
+		else
+			bs->map = NULL;
+	}
+#endif
+
+	if (!bs->mapped)
+	{
+		bs->map = smalloc(bs->maplen + 1);
+		len = fread(bs->map, 1, bs->maplen, f);
+		if (len != bs->maplen)
+		{
+			slog(LG_ERROR, "db-open-read: error reading '%s': %s", path, strerror(errno));
+			slog(LG_ERROR, "db-open-read: exiting to avoid data loss");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	fclose(f);
+
+	/* a journal torn before its header was complete has nothing to replay */
+	if (txn == DB_REPLAY && bs->maplen <= BDB_MAGICLEN && !memcmp(bs->map, BDB_MAGIC, bs->maplen))
+	{
+		slog(LG_ERROR, "db-open-read: dropping the torn header of %s", path);
+		if (truncate(path, 0) < 0)
+			slog(LG_ERROR, "db-open-read: cannot truncate %s: %s", path, strerror(errno));
+#ifndef MOWGLI_OS_WIN
+		if (bs->mapped)
+			munmap(bs->map, bs->maplen);
+		else
+#endif
+			free(bs->map);
+		free(bs);
+		return NULL;
+	}
+
+	if (bs->maplen < BDB_MAGICLEN || memcmp(bs->map, BDB_MAGIC, BDB_MAGICLEN))
+	{
+		slog(LG_ERROR, "db-open-read: '%s' is not a binary database; convert it with dbverify -o binary", path);
+		slog(LG_ERROR, "db-open-read: exiting to avoid data loss");
+		exit(EXIT_FAILURE);
+	}
+
+	bs->pos = bs->map + BDB_MAGICLEN;
+	bs->end = bs->map + bs->maplen;
+	bs->types = smalloc(sizeof(char *));
+	bs->types[0] = NULL;
+	bs->handlers = smalloc(sizeof(database_handler_f));
+	bs->handlers[0] = NULL;
+	bs->bufsize = 512;
+	bs->buf = smalloc(bs->bufsize);
+
+	db = scalloc(sizeof(database_handle_t), 1);
+	db->priv = bs;
+	db->vt = &binary_vt;
+	db->txn = txn;
+	db->file = sstrdup(path);
+	db->line = 0;
+	db->token = 0;
+
+	if (binary_get_varint(db, bs->end) != BDB_VERSION)
+	{
+		slog(LG_ERROR, "db-open-read: '%s' has an unsupported binary format version", path);
+		slog(LG_ERROR, "db-open-read: exiting to avoid data loss");
+		exit(EXIT_FAILURE);
+	}
+
+	return db;
+}
+
+static database_handle_t *binary_db_open_write(const char *filename, database_transaction_t txn)
+{
+	database_handle_t *db;
+	binary_t *bs;
+	FILE *f;
+	int errno1;
+	char bpath[BUFSIZE], path[BUFSIZE];
+
+	snprintf(bpath, BUFSIZE, "%s/%s", datadir, filename != NULL ? filename : "services.db");
+
+	mowgli_strlcpy(path, bpath, sizeof path);
+	mowgli_strlcat(path, ".new", sizeof path);
+
+	f = fopen(path, "wb");
+	if (!f)
+	{
+		errno1 = errno;
+		slog(LG_ERROR, "db-open-write: cannot open '%s' for writing: %s", path, strerror(errno1));
+		wallops(_("\2DATABASE ERROR\2: db-open-write: cannot open '%s' for writing: %s"), path, strerror(errno1));
+		return NULL;
+	}
+
+	bs = scalloc(sizeof(binary_t), 1);
+	bs->f = f;
+	bs->typeids = mowgli_patricia_create(NULL);
+	bs->wbufsize = 512;
+	bs->wbuf = smalloc(bs->wbufsize);
+
+	fwrite(BDB_MAGIC, 1, BDB_MAGICLEN, f);
+	binary_put_varint_file(bs, BDB_VERSION);
+
+	db = scalloc(sizeof(database_handle_t), 1);
+	db->priv = bs;
+	db->vt = &binary_vt;
+	db->txn = txn;
+	db->file = sstrdup(bpath);
+	db->line = 0;
+	db->token = 0;
+
+	return db;
+}
+
+static database_handle_t *binary_db_open_journal(const char *filename)
+{
+	database_handle_t *db;
+	binary_t *bs;
+	FILE *f;
+	struct stat sb;
+	char path[BUFSIZE];
+
+	snprintf(path, BUFSIZE, "%s/%s", datadir, filename);
+
+	f = fopen(path, "ab");
+	if (!f || fstat(fileno(f), &sb) < 0)
+	{
+		slog(LG_ERROR, "db-open-journal: cannot open '%s' for appending: %s", path, strerror(errno));
+		if (f)
+			fclose(f);
+		return NULL;
+	}
+
+	bs = scalloc(sizeof(binary_t), 1);
+	bs->f = f;
+	bs->typeids = mowgli_patricia_create(NULL);
+	bs->wbufsize = 512;
+	bs->wbuf = smalloc(bs->wbufsize);
+
+	if (sb.st_size == 0)
+	{
+		fwrite(BDB_MAGIC, 1, BDB_MAGICLEN, f);
+		binary_put_varint_file(bs, BDB_VERSION);
+	}
+	else
+	{
+		binary_put_varint_file(bs, 0);
+		binary_put_varint_file(bs, 0);
+	}
+
+	db = scalloc(sizeof(database_handle_t), 1);
+	db->priv = bs;
+	db->vt = &binary_vt;
+	db->txn = DB_JOURNAL;
+	db->file = sstrdup(path);
+	db->line = 0;
+	db->token = 0;
+
+	return db;
+}
+
+static database_handle_t *binary_db_open(const char *filename, database_transaction_t txn)
+{
+	if (txn == DB_READ || txn == DB_REPLAY)
+		return binary_db_open_read(filename, txn);
+	if (txn == DB_JOURNAL)
+		return binary_db_open_journal(filename);
+	return binary_db_open_write(filename, txn);
+}
+
+static void binary_db_close(database_handle_t *db)
+{
+	binary_t *bs;
+	int errno1;
+	bool failed;
+	unsigned int i;
+	char oldpath[BUFSIZE], newpath[BUFSIZE];
+
+	return_if_fail(db != NULL);
+	bs = db->priv;
+
+	if (db->txn == DB_READ || db->txn == DB_REPLAY)
+	{
+#ifndef MOWGLI_OS_WIN
+		if (bs->mapped)
+			munmap(bs->map, bs->maplen);
+		else
+#endif
+			free(bs->map);
+
+		for (i = 1; i <= bs->ntypes; i++)
+			free(bs->types[i]);
+		free(bs->types);
+		free(bs->handlers);
+		free(bs->buf);
+		free(bs);
+		free(db->file);
+		free(db);
+		return;
+	}
+
+	mowgli_strlcpy(oldpath, db->file, sizeof oldpath);
+	mowgli_strlcat(oldpath, ".new", sizeof oldpath);
+
+	mowgli_strlcpy(newpath, db->file, sizeof newpath);
+
+	/* a write that failed before the final flush only shows in the error flag */
+	failed = ferror(bs->f) != 0;
+	if (fclose(bs->f) != 0)
+		failed = true;
+
+	if (db->txn == DB_JOURNAL)
+	{
+		if (failed)
+			slog(LG_ERROR, "db-close: cannot write journal '%s': %s", db->file, strerror(errno));
+	}
+	else if (db->txn == DB_SNAPSHOT)
+	{
+		/* we are the snapshot child; the parent learns the result from our exit status */
+		if (failed)
+		{
+			slog(LG_ERROR, "db_save(): cannot write services.db.new: %s", strerror(errno));
+			log_flush(NULL);
+			_exit(EXIT_FAILURE);
+		}
+
+		if (srename(oldpath, newpath) < 0)
+		{
+			slog(LG_ERROR, "db_save(): cannot rename services.db.new to services.db: %s", strerror(errno));
+			log_flush(NULL);
+			_exit(EXIT_FAILURE);
+		}
+	}
+	else
+	{
+		/* a short services.db.new must never replace the last good database */
+		if (failed)
+		{
+			errno1 = errno;
+			slog(LG_ERROR, "db_save(): cannot write services.db.new, keeping the old services.db: %s", strerror(errno1));
+			wallops(_("\2DATABASE ERROR\2: db_save(): cannot write services.db.new, keeping the old services.db: %s"), strerror(errno1));
+		}
+		/* now, replace the old database with the new one, using an atomic rename */
+		else if (srename(oldpath, newpath) < 0)
+		{
+			errno1 = errno;
+			slog(LG_ERROR, "db_save(): cannot rename services.db.new to services.db: %s", strerror(errno1));
+			wallops(_("\2DATABASE ERROR\2: db_save(): cannot rename services.db.new to services.db: %s"), strerror(errno1));
+		}
+		else
+			hook_call_db_saved();
+	}
+
+	mowgli_patricia_destroy(bs->typeids, NULL, NULL);
+	free(bs->wbuf);
+	free(bs);
+	free(db->file);
+	free(db);
+}
+
+static database_module_t binary_mod = {
+	.db_open = binary_db_open,
+	.db_close = binary_db_close,
+	.db_parse = binary_db_parse,
+};
+
+void _modinit(module_t *m)
+{
+	MODULE_TRY_REQUEST_DEPENDENCY(m, "backend/corestorage");
+
+	m->mflags = MODTYPE_CORE;
+
+	db_mod = &binary_mod;
+
+	backend_loaded = true;
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
@@ -18,6 +18,10 @@
 
 #include "atheme.h"
 
+#ifndef MOWGLI_OS_WIN
+# include <sys/wait.h>
+#endif
+
 DECLARE_MODULE_V1
 (
 	"backend/corestorage", true, _modinit, NULL,
@@ -48,6 +52,7 @@ corestorage_db_save(database_handle_t *db)
 	mowgli_node_t *n, *tn;
 	mowgli_patricia_iteration_state_t state;
 	myentity_iteration_state_t mestate;
+	metadata_iteration_state_t mdstate;
 
 	errno = 0;
 
@@ -97,7 +102,7 @@ corestorage_db_save(database_handle_t *db)
 
 		if (object(mu)->metadata)
 		{
-			MOWGLI_PATRICIA_FOREACH(md, &state, object(mu)->metadata)
+			METADATA_FOREACH(md, &mdstate, mu)
 			{
 				db_start_row(db, "MDU");
 				db_write_word(db, entity(mu)->name);
@@ -166,7 +171,7 @@ corestorage_db_save(database_handle_t *db)
 
 	MOWGLI_PATRICIA_FOREACH(mc, &state, mclist)
 	{
-		mowgli_patricia_iteration_state_t state2;
+		metadata_iteration_state_t state2;
 
 		char *flags = gflags_tostr(mc_flags, mc->flags);
 		/* find a founder */
@@ -206,7 +211,7 @@ corestorage_db_save(database_handle_t *db)
 
 			if (object(ca)->metadata)
 			{
-				MOWGLI_PATRICIA_FOREACH(md, &state2, object(ca)->metadata)
+				METADATA_FOREACH(md, &state2, ca)
 				{
 					db_start_row(db, "MDA");
 					db_write_word(db, ca->mychan->name);
@@ -220,7 +225,7 @@ corestorage_db_save(database_handle_t *db)
 
 		if (object(mc)->metadata)
 		{
-			MOWGLI_PATRICIA_FOREACH(md, &state2, object(mc)->metadata)
+			METADATA_FOREACH(md, &state2, mc)
 			{
 				db_start_row(db, "MDC");
 				db_write_word(db, mc->name);
@@ -234,7 +239,7 @@ corestorage_db_save(database_handle_t *db)
 	/* Old names */
 	MOWGLI_PATRICIA_FOREACH(mun, &state, oldnameslist)
 	{
-		mowgli_patricia_iteration_state_t state2;
+		metadata_iteration_state_t state2;
 
 		db_start_row(db, "NAM");
 		db_write_word(db, mun->name);
@@ -242,7 +247,7 @@ corestorage_db_save(database_handle_t *db)
 
 		if (object(mun)->metadata)
 		{
-			MOWGLI_PATRICIA_FOREACH(md, &state2, object(mun)->metadata)
+			METADATA_FOREACH(md, &state2, mun)
 			{
 				db_start_row(db, "MDN");
 				db_write_word(db, mun->name);
@@ -836,8 +841,7 @@ static void corestorage_h_kl(database_handle_t *db, const char *type)
 	strip(buf);
 
 	k = kline_add_with_id(user, host, buf, duration, setby, id ? id : ++me.kline_id);
-	k->settime = settime;
-	k->expires = k->settime + k->duration;
+	kline_settime(k, settime);
 }
 
 static void corestorage_h_xid(database_handle_t *db, const char *type)
@@ -867,8 +871,7 @@ static void corestorage_h_xl(database_handle_t *db, const char *type)
 	strip(buf);
 
 	x = xline_add(realname, buf, duration, setby);
-	x->settime = settime;
-	x->expires = x->settime + x->duration;
+	xline_settime(x, settime);
 
 	if (id)
 		x->number = id;
@@ -901,8 +904,7 @@ static void corestorage_h_ql(database_handle_t *db, const char *type)
 	strip(buf);
 
 	q = qline_add(mask, buf, duration, setby);
-	q->settime = settime;
-	q->expires = q->settime + q->duration;
+	qline_settime(q, settime);
 
 	if (id)
 		q->number = id;
@@ -913,11 +915,248 @@ static void corestorage_ignore_row(database_handle_t *db, const char *type)
 	return;
 }
 
-static void corestorage_db_load(const char *filename)
+/*
+ * Journal rows.  These are written by libathemecore as changes happen and
+ * replayed on top of the last full save, so every handler has to cope with
+ * the change already being present in the database.
+ */
+static void corestorage_h_jmu(database_handle_t *db, const char *type)
+{
+	const char *uid, *name, *pass, *email;
+	time_t reg;
+	unsigned int flags;
+	myuser_t *mu;
+
+	uid = db_sread_word(db);
+	name = db_sread_word(db);
+	pass = db_sread_word(db);
+	email = db_sread_word(db);
+	reg = db_sread_time(db);
+	flags = db_sread_uint(db);
+
+	if ((mu = myuser_find(name)) == NULL)
+	{
+		mu = myuser_add_id(uid, name, pass, email, flags);
+		mu->registered = reg;
+		return;
+	}
+
+	mowgli_strlcpy(mu->pass, pass, PASSLEN);
+	if (strcmp(mu->email, email))
+		myuser_set_email(mu, email);
+	mu->registered = reg;
+	mu->flags = flags & ~MU_ENFORCE;
+}
+
+static void corestorage_h_jmud(database_handle_t *db, const char *type)
+{
+	myuser_t *mu;
+
+	if ((mu = myuser_find(db_sread_word(db))) != NULL)
+		object_dispose(mu);
+}
+
+static void corestorage_h_jmur(database_handle_t *db, const char *type)
+{
+	const char *oldname = db_sread_word(db);
+	const char *newname = db_sread_word(db);
+	myuser_t *mu;
+
+	if ((mu = myuser_find(oldname)) != NULL && myuser_find(newname) == NULL)
+		myuser_rename(mu, newname);
+}
+
+static void corestorage_h_jmc(database_handle_t *db, const char *type)
+{
+	char buf[4096];
+	time_t reg;
+	mychan_t *mc;
+
+	mowgli_strlcpy(buf, db_sread_word(db), sizeof buf);
+	reg = db_sread_time(db);
+
+	if ((mc = mychan_find(buf)) == NULL)
+		mc = mychan_add(buf);
+
+	mc->registered = reg;
+}
+
+static void corestorage_h_jmcd(database_handle_t *db, const char *type)
+{
+	mychan_t *mc;
+
+	if ((mc = mychan_find(db_sread_word(db))) != NULL)
+		object_dispose(mc);
+}
+
+static void corestorage_h_jnamd(database_handle_t *db, const char *type)
+{
+	myuser_name_t *mun;
+
+	if ((mun = myuser_name_find(db_sread_word(db))) != NULL)
+		object_dispose(mun);
+}
+
+static void corestorage_h_jca(database_handle_t *db, const char *type)
+{
+	const char *chan, *target;
+	unsigned int flags;
+	time_t tmod;
+	mychan_t *mc;
+	myentity_t *mt, *setter;
+	chanacs_t *ca;
+
+	chan = db_sread_word(db);
+	target = db_sread_word(db);
+	flags = flags_to_bitmask(db_sread_word(db), 0);
+	tmod = db_sread_time(db);
+	setter = myentity_find(db_sread_word(db));
+
+	if ((mc = mychan_find(chan)) == NULL)
+	{
+		slog(LG_DEBUG, "db-h-jca: line %d: chanacs for nonexistent channel %s", db->line, chan);
+		return;
+	}
+
+	if ((mt = myentity_find(target)) != NULL)
+		ca = chanacs_find_literal(mc, mt, 0);
+	else if (validhostmask(target))
+		ca = chanacs_find_host_literal(mc, target, 0);
+	else
+	{
+		slog(LG_DEBUG, "db-h-jca: line %d: chanacs for nonexistent target %s", db->line, target);
+		return;
+	}
+
+	if (ca == NULL)
+	{
+		if (flags == 0)
+			return;
+
+		if (mt != NULL)
+			chanacs_add(mc, mt, flags, tmod, setter);
+		else
+			chanacs_add_host(mc, target, flags, tmod, setter);
+		return;
+	}
+
+	if (flags == 0)
+	{
+		object_unref(ca);
+		return;
+	}
+
+	ca->level = flags;
+	ca->tmodified = tmod;
+	if (ca->setter != NULL)
+		strshare_unref(ca->setter);
+	ca->setter = setter != NULL ? strshare_ref(setter->name) : NULL;
+}
+
+static void corestorage_h_jmd(database_handle_t *db, const char *type)
+{
+	const char *kind, *name, *mask = NULL, *prop;
+	myentity_t *mt;
+	void *obj = NULL;
+
+	kind = db_sread_word(db);
+	name = db_sread_word(db);
+	if (!strcmp(kind, "A"))
+		mask = db_sread_word(db);
+	prop = db_sread_word(db);
+
+	if (!strcmp(kind, "U"))
+		obj = myuser_find(name);
+	else if (!strcmp(kind, "C"))
+		obj = mychan_find(name);
+	else if (!strcmp(kind, "G"))
+	{
+		mt = myentity_find(name);
+		obj = isgroup(mt) ? mt : NULL;
+	}
+	else if (!strcmp(kind, "N"))
+	{
+		/* old names exist only to carry metadata, as with NAM/MDN */
+		if ((obj = myuser_name_find(name)) == NULL && !strcmp(type, "JMD"))
+			obj = myuser_name_add(name);
+	}
+	else if (mask != NULL)
+		obj = chanacs_find_by_mask(mychan_find(name), mask, CA_NONE);
+
+	if (obj == NULL)
+	{
+		slog(LG_DEBUG, "db-h-jmd: line %d: %s property for nonexistent object %s", db->line, prop, name);
+		return;
+	}
+
+	if (!strcmp(type, "JMD"))
+		metadata_add(obj, prop, db_sread_str(db));
+	else
+		metadata_delete(obj, prop);
+}
+
+static void corestorage_h_jkl(database_handle_t *db, const char *type)
+{
+	char buf[4096];
+	const char *user, *host, *setby;
+	unsigned int id;
+	time_t settime;
+	long duration;
+	kline_t *k;
+
+	id = db_sread_uint(db);
+	user = db_sread_word(db);
+	host = db_sread_word(db);
+	duration = db_sread_uint(db);
+	settime = db_sread_time(db);
+	setby = db_sread_word(db);
+	mowgli_strlcpy(buf, db_sread_str(db), sizeof buf);
+
+	if (id > me.kline_id)
+		me.kline_id = id;
+
+	if (kline_find_num(id) != NULL)
+		return;
+
+	k = kline_add_with_id(user, host, buf, duration, setby, id);
+	kline_settime(k, settime);
+}
+
+static void corestorage_h_jkld(database_handle_t *db, const char *type)
+{
+	kline_t *k;
+
+	if ((k = kline_find_num(db_sread_uint(db))) != NULL)
+		kline_delete(k);
+}
+
+static bool journal_loaded = false;
+static bool journal_compact = false;
+
+static void corestorage_journal_path(char *buf, size_t len, const char *file)
+{
+	snprintf(buf, len, "%s/%s", datadir, file);
+}
+
+static bool corestorage_journal_exists(const char *file)
+{
+	struct stat sb;
+	char path[BUFSIZE];
+
+	corestorage_journal_path(path, sizeof path, file);
+	return stat(path, &sb) == 0;
+}
+
+static void corestorage_journal_replay(const char *file)
 {
 	database_handle_t *db;
 
-	db = db_open(filename, DB_READ);
+	if (!corestorage_journal_exists(file))
+		return;
+
+	slog(LG_INFO, "corestorage: replaying changes from %s", file);
+
+	db = db_open(file, DB_REPLAY);
 	if (db == NULL)
 		return;
 
@@ -925,16 +1164,195 @@ static void corestorage_db_load(const char *filename)
 	db_close(db);
 }
 
+static void corestorage_journal_update(void *unused)
+{
+	if (!journal_loaded)
+		return;
+
+	db_journal_enabled = config_options.db_journal && !readonly;
+	if (!db_journal_enabled)
+		db_journal_close();
+}
+
+/* a full save now holds everything the journal did */
+static void corestorage_journal_saved(void *unused)
+{
+	char path[BUFSIZE];
+
+	if (!journal_compact)
+		return;
+
+	db_journal_close();
+
+	corestorage_journal_path(path, sizeof path, DB_JOURNAL_OLD_FILE);
+	if (unlink(path) < 0 && errno != ENOENT)
+		slog(LG_ERROR, "db_save(): cannot remove %s: %s", path, strerror(errno));
+
+	corestorage_journal_path(path, sizeof path, DB_JOURNAL_FILE);
+	if (unlink(path) < 0 && errno != ENOENT)
+		slog(LG_ERROR, "db_save(): cannot remove %s: %s", path, strerror(errno));
+}
+
+static void corestorage_db_load(const char *filename)
+{
+	database_handle_t *db;
+
+	db = db_open(filename, DB_READ);
+	if (db != NULL)
+	{
+		db_parse(db);
+		db_close(db);
+	}
+
+	if (filename != NULL)
+		return;
+
+	/* a journal rotated away by a snapshot that never finished comes first */
+	corestorage_journal_replay(DB_JOURNAL_OLD_FILE);
+	corestorage_journal_replay(DB_JOURNAL_FILE);
+
+	journal_loaded = true;
+	corestorage_journal_update(NULL);
+}
+
+#ifndef MOWGLI_OS_WIN
+static pid_t snapshot_pid = 0;
+
+static void corestorage_db_snapshot_done(pid_t pid, int status, void *data)
+{
+	char path[BUFSIZE];
+
+	snapshot_pid = 0;
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		slog(LG_ERROR, "db_save(): snapshot process %d failed; database was not written", (int)pid);
+		wallops(_("\2DATABASE ERROR\2: db_save(): snapshot process failed; database was not written"));
+		return;
+	}
+
+	slog(LG_DEBUG, "db_save(): snapshot process %d finished", (int)pid);
+
+	/* the snapshot covers everything journaled before the fork */
+	corestorage_journal_path(path, sizeof path, DB_JOURNAL_OLD_FILE);
+	if (unlink(path) < 0 && errno != ENOENT)
+		slog(LG_ERROR, "db_save(): cannot remove %s: %s", path, strerror(errno));
+
+	hook_call_db_saved();
+}
+
+/* wait for a running snapshot, so a synchronous write does not race its .new file */
+static void corestorage_db_snapshot_wait(void)
+{
+	pid_t pid;
+	int status;
+
+	if (snapshot_pid == 0)
+		return;
+
+	pid = snapshot_pid;
+	slog(LG_DEBUG, "db_save(): waiting for snapshot process %d", (int)pid);
+
+	while (waitpid(pid, &status, 0) < 0)
+	{
+		if (errno != EINTR)
+		{
+			slog(LG_ERROR, "db_save(): waitpid(%d): %s", (int)pid, strerror(errno));
+			childproc_delete_all(corestorage_db_snapshot_done);
+			snapshot_pid = 0;
+			return;
+		}
+	}
+
+	childproc_delete_all(corestorage_db_snapshot_done);
+	corestorage_db_snapshot_done(pid, status, NULL);
+}
+
+static bool corestorage_db_snapshot(void)
+{
+	database_handle_t *db;
+	pid_t pid;
+
+	char oldpath[BUFSIZE], newpath[BUFSIZE];
+
+	if (snapshot_pid != 0)
+	{
+		slog(LG_INFO, "db_save(): snapshot process %d still running; skipping this write", (int)snapshot_pid);
+		return true;
+	}
+
+	/*
+	 * set the journal aside so that changes made while the child writes
+	 * go to a fresh one.  a journal left over from a failed snapshot is
+	 * not yet in any database, so fold it in with a synchronous write.
+	 */
+	if (corestorage_journal_exists(DB_JOURNAL_OLD_FILE))
+		return false;
+
+	db_journal_close();
+
+	corestorage_journal_path(oldpath, sizeof oldpath, DB_JOURNAL_FILE);
+	corestorage_journal_path(newpath, sizeof newpath, DB_JOURNAL_OLD_FILE);
+	if (srename(oldpath, newpath) < 0 && errno != ENOENT)
+	{
+		slog(LG_ERROR, "db_save(): cannot rename %s: %s; writing synchronously", oldpath, strerror(errno));
+		return false;
+	}
+
+	log_flush(NULL);
+	switch (pid = fork())
+	{
+		case -1:
+			slog(LG_ERROR, "db_save(): cannot fork snapshot process: %s; writing synchronously", strerror(errno));
+			return false;
+		case 0:
+			connection_close_all_fds();
+
+			/* _exit() drops stdio buffers, so flush anything we logged first */
+			db = db_open(NULL, DB_SNAPSHOT);
+			if (db == NULL)
+			{
+				log_flush(NULL);
+				_exit(EXIT_FAILURE);
+			}
+
+			corestorage_db_save(db);
+			hook_call_db_write(db);
+
+			db_close(db);
+			log_flush(NULL);
+			_exit(EXIT_SUCCESS);
+	}
+
+	snapshot_pid = pid;
+	childproc_add(pid, "db_snapshot", corestorage_db_snapshot_done, NULL);
+
+	return true;
+}
+#endif
+
 static void corestorage_db_write(void *filename)
 {
 	database_handle_t *db;
 
+#ifndef MOWGLI_OS_WIN
+	if (config_options.db_snapshot && filename == NULL && !(runflags & (RF_SHUTDOWN | RF_RESTART)))
+	{
+		if (corestorage_db_snapshot())
+			return;
+	}
+
+	corestorage_db_snapshot_wait();
+#endif
+
 	db = db_open(filename, DB_WRITE);
 
 	corestorage_db_save(db);
 	hook_call_db_write(db);
 
+	journal_compact = filename == NULL;
 	db_close(db);
+	journal_compact = false;
 }
 
 void _modinit(module_t *m)
@@ -974,6 +1392,23 @@ void _modinit(module_t *m)
 
 	db_register_type_handler("DE", corestorage_ignore_row);
 
+	db_register_type_handler("JMU", corestorage_h_jmu);
+	db_register_type_handler("JMUD", corestorage_h_jmud);
+	db_register_type_handler("JMUR", corestorage_h_jmur);
+	db_register_type_handler("JMC", corestorage_h_jmc);
+	db_register_type_handler("JMCD", corestorage_h_jmcd);
+	db_register_type_handler("JCA", corestorage_h_jca);
+	db_register_type_handler("JMD", corestorage_h_jmd);
+	db_register_type_handler("JMDD", corestorage_h_jmd);
+	db_register_type_handler("JNAMD", corestorage_h_jnamd);
+	db_register_type_handler("JKL", corestorage_h_jkl);
+	db_register_type_handler("JKLD", corestorage_h_jkld);
+
+	hook_add_event("config_ready");
+	hook_add_config_ready(corestorage_journal_update);
+	hook_add_event("db_saved");
+	hook_add_db_saved(corestorage_journal_saved);
+
 	db_register_type_handler("???", corestorage_h_unknown);
 
 	backend_loaded = true;
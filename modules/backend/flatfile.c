@@ -624,9 +624,7 @@ static void flatfile_db_load(const char *filename)
 			strip(reason);
 
 			k = kline_add(user, host, reason, duration, setby);
-			k->settime = settime;
-			/* XXX this is not nice, oh well -- jilles */
-			k->expires = k->settime + k->duration;
+			kline_settime(k, settime);
 
 			kin++;
 		}
@@ -653,10 +651,7 @@ static void flatfile_db_load(const char *filename)
 			strip(reason);
 
 			x = xline_add(realname, reason, duration, setby);
-			x->settime = settime;
-
-			/* XXX this is not nice, oh well -- jilles */
-			x->expires = x->settime + x->duration;
+			xline_settime(x, settime);
 
 			xin++;
 		}
@@ -683,10 +678,7 @@ static void flatfile_db_load(const char *filename)
 			strip(reason);
 
 			q = qline_add(mask, reason, duration, setby);
-			q->settime = settime;
-
-			/* XXX this is not nice, oh well -- jilles */
-			q->expires = q->settime + q->duration;
+			qline_settime(q, settime);
 
 			qin++;
 		}
@@ -10,6 +10,15 @@
 
 #include "atheme.h"
 
+#ifndef MOWGLI_OS_WIN
+# include <sys/mman.h>
+#endif
+
+#if defined(HAVE_PTHREAD) && !defined(MOWGLI_OS_WIN)
+# define OPENSEX_USE_THREADS
+# include <pthread.h>
+#endif
+
 DECLARE_MODULE_V1
 (
 	"backend/opensex", true, _modinit, NULL,
@@ -17,6 +26,65 @@ DECLARE_MODULE_V1
 	"Atheme Development Group <http://www.atheme.org>"
 );
 
+/* size of the reads used when the database cannot be mmap()ed */
+#define OPENSEX_CHUNKSIZE	(1024 * 1024)
+
+/* longest row type whose handler is remembered between rows */
+#define OPENSEX_TYPELEN		16
+
+/* digits an unsigned long can always hold without overflow */
+#define OPENSEX_ULONG_DIGITS	(sizeof(unsigned long) >= 8 ? 19 : 9)
+
+/* databases smaller than this are not worth starting load threads for */
+#define OPENSEX_THREAD_MINSIZE	(4 * 1024 * 1024)
+
+/* chunks each load thread may have tokenized ahead of the main thread */
+#define OPENSEX_THREAD_AHEAD	2
+
+#ifdef OPENSEX_USE_THREADS
+/* a word of a row tokenized by a load thread */
+typedef struct {
+	unsigned int start;		/* offset in the chunk's text */
+	unsigned int len : 31;		/* the byte after the word is a NUL that was a space */
+	unsigned int isnum : 1;		/* num is the word parsed by opensex_parse_ulong() */
+	unsigned long num;
+} opensex_token_t;
+
+typedef struct {
+	unsigned int line;		/* line number within the chunk */
+	unsigned int tok;		/* index of the row type in the chunk's tokens */
+	unsigned int ntok;
+} opensex_row_t;
+
+/* a row-aligned piece of the mapped file, tokenized by one load thread */
+typedef struct {
+	const char *src;
+	size_t len;
+
+	char *text;
+	opensex_row_t *rows;
+	size_t nrows;
+	opensex_token_t *toks;
+	size_t ntoks;
+	unsigned int lines;
+
+	bool done;
+	bool failed;
+} opensex_chunk_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t ready;		/* a load thread finished a chunk */
+	pthread_cond_t space;		/* the main thread finished a chunk */
+
+	opensex_chunk_t *chunks;
+	size_t nchunks;
+	size_t next;			/* next chunk for a load thread to take */
+	size_t consumed;		/* chunks the main thread is done with */
+	size_t ahead;			/* chunks that may be tokenized but not consumed */
+} opensex_loader_t;
+#endif
+
 typedef struct opensex_ {
 	/* Lexing state */
 	char *buf;
@@ -24,18 +92,62 @@ typedef struct opensex_ {
 	char *token;
 	FILE *f;
 
+	/* Input window: the whole file if mapped, else the last chunk read */
+	char *map;
+	size_t maplen;
+	char *chunk;
+	const char *pos;
+	const char *end;
+
+#ifdef OPENSEX_USE_THREADS
+	/* The row being handled when the load threads tokenized it */
+	char *rowtext;
+	opensex_token_t *tok;
+	opensex_token_t *tokend;
+#endif
+
 	/* Interpreting state */
 	unsigned int grver;
+	char lastcmd[OPENSEX_TYPELEN];
+	database_handler_f lastfun;
 } opensex_t;
 
+#ifdef OPENSEX_USE_THREADS
+static bool opensex_db_parse_threaded(database_handle_t *db);
+#endif
+
+static void opensex_process(database_handle_t *db, const char *cmd)
+{
+	opensex_t *rs = (opensex_t *)db->priv;
+
+	/* rows come in runs of the same type, so only look up a new one */
+	if (rs->lastfun == NULL || strcmp(cmd, rs->lastcmd))
+	{
+		rs->lastfun = db_find_type_handler(cmd);
+		if (rs->lastfun == NULL)
+			return;
+		if (mowgli_strlcpy(rs->lastcmd, cmd, sizeof rs->lastcmd) >= sizeof rs->lastcmd)
+			*rs->lastcmd = '\0';
+	}
+
+	rs->lastfun(db, cmd);
+}
+
 static void opensex_db_parse(database_handle_t *db)
 {
 	const char *cmd;
+
+#ifdef OPENSEX_USE_THREADS
+	if (opensex_db_parse_threaded(db))
+		return;
+#endif
+
 	while (db_read_next_row(db))
 	{
 		cmd = db_read_word(db);
 		if (!cmd || !*cmd || strchr("#\n\t \r", *cmd)) continue;
-		db_process(db, cmd);
+
+		opensex_process(db, cmd);
 	}
 }
 
@@ -51,33 +163,75 @@ static void opensex_h_grver(database_handle_t *db, const char *type)
 
 /***************************************************************************************************/
 
+static bool opensex_fill(database_handle_t *hdl)
+{
+	opensex_t *rs = (opensex_t *)hdl->priv;
+	size_t n;
+
+	/* a mapped file is consumed in one window */
+	if (rs->chunk == NULL)
+		return false;
+
+	n = fread(rs->chunk, 1, OPENSEX_CHUNKSIZE, rs->f);
+	if (n == 0 && ferror(rs->f))
+	{
+		slog(LG_ERROR, "opensex-read-next-row: error at %s line %d: %s", hdl->file, hdl->line, strerror(errno));
+		slog(LG_ERROR, "opensex-read-next-row: exiting to avoid data loss");
+		exit(EXIT_FAILURE);
+	}
+
+	rs->pos = rs->chunk;
+	rs->end = rs->chunk + n;
+
+	return n > 0;
+}
+
 static bool opensex_read_next_row(database_handle_t *hdl)
 {
-	int c = 0;
-	unsigned int n = 0;
+	const char *nl;
+	size_t len, n = 0;
+	bool eol = false;
 	opensex_t *rs = (opensex_t *)hdl->priv;
 
-	while ((c = getc(rs->f)) != EOF && c != '\n')
+	while (!eol)
 	{
-		rs->buf[n++] = c;
-		if (n == rs->bufsize)
+		if (rs->pos == rs->end && !opensex_fill(hdl))
+			break;
+
+		nl = memchr(rs->pos, '\n', rs->end - rs->pos);
+		len = (nl != NULL ? nl : rs->end) - rs->pos;
+
+		if (n + len >= rs->bufsize)
 		{
-			rs->bufsize *= 2;
+			while (n + len >= rs->bufsize)
+				rs->bufsize *= 2;
 			rs->buf = srealloc(rs->buf, rs->bufsize);
 		}
+
+		memcpy(rs->buf + n, rs->pos, len);
+		n += len;
+		rs->pos += len;
+
+		if (nl != NULL)
+		{
+			rs->pos++;
+			eol = true;
+		}
 	}
 	rs->buf[n] = '\0';
 	rs->token = rs->buf;
 
-	if (c == EOF && ferror(rs->f))
-	{
-		slog(LG_ERROR, "opensex-read-next-row: error at %s line %d: %s", hdl->file, hdl->line, strerror(errno));
-		slog(LG_ERROR, "opensex-read-next-row: exiting to avoid data loss");
-		exit(EXIT_FAILURE);
-	}
+	if (!eol && n == 0)
+		return false;
 
-	if (c == EOF && n == 0)
+	/* the journal is not fsync()ed, so a crash can leave its last row without a newline */
+	if (!eol && hdl->txn == DB_REPLAY)
+	{
+		slog(LG_ERROR, "opensex-read-next-row: dropping a torn row at the end of %s line %d", hdl->file, hdl->line + 1);
+		if (truncate(hdl->file, (rs->map != NULL ? (off_t)rs->maplen : ftello(rs->f)) - n) < 0)
+			slog(LG_ERROR, "opensex-read-next-row: cannot truncate %s: %s", hdl->file, strerror(errno));
 		return false;
+	}
 
 	hdl->line++;
 	hdl->token = 0;
@@ -120,37 +274,91 @@ static const char *opensex_read_str(database_handle_t *db)
 	return res;
 }
 
-static bool opensex_read_int(database_handle_t *db, int *res)
+/* decimal fast path; anything else (sign, 0x, octal, overflow) goes to strtoul() */
+static inline bool opensex_parse_ulong(const char *s, unsigned long *res)
 {
-	const char *s = db_read_word(db);
+	const char *p = s;
+	unsigned long v = 0;
 	char *rp;
 
-	if (!s) return false;
+	if (*p != '0' || p[1] == '\0')
+	{
+		while (*p >= '0' && *p <= '9' && (size_t)(p - s) < OPENSEX_ULONG_DIGITS)
+			v = v * 10 + (*p++ - '0');
+
+		if (p != s && *p == '\0')
+		{
+			*res = v;
+			return true;
+		}
+	}
+
+	*res = strtoul(s, &rp, 0);
+	return *s && !*rp;
+}
+
+static bool opensex_parse_int(const char *s, int *res)
+{
+	unsigned long v;
+	char *rp;
+
+	/* anything outside the range of a long is left to strtol() to clamp */
+	if (*s == '-' && s[1] >= '1' && s[1] <= '9')
+	{
+		if (opensex_parse_ulong(s + 1, &v) && v <= (unsigned long)LONG_MAX + 1)
+		{
+			*res = v > LONG_MAX ? LONG_MIN : -(long)v;
+			return true;
+		}
+	}
+	else if (*s >= '0' && *s <= '9')
+	{
+		if (opensex_parse_ulong(s, &v) && v <= LONG_MAX)
+		{
+			*res = (long)v;
+			return true;
+		}
+	}
 
 	*res = strtol(s, &rp, 0);
 	return *s && !*rp;
 }
 
+static bool opensex_read_int(database_handle_t *db, int *res)
+{
+	const char *s = opensex_read_word(db);
+
+	if (!s) return false;
+
+	return opensex_parse_int(s, res);
+}
+
 static bool opensex_read_uint(database_handle_t *db, unsigned int *res)
 {
-	const char *s = db_read_word(db);
-	char *rp;
+	const char *s = opensex_read_word(db);
+	unsigned long v;
 
 	if (!s) return false;
 
-	*res = strtoul(s, &rp, 0);
-	return *s && !*rp;
+	if (!opensex_parse_ulong(s, &v))
+		return false;
+
+	*res = v;
+	return true;
 }
 
 static bool opensex_read_time(database_handle_t *db, time_t *res)
 {
-	const char *s = db_read_word(db);
-	char *rp;
+	const char *s = opensex_read_word(db);
+	unsigned long v;
 
 	if (!s) return false;
 
-	*res = strtoul(s, &rp, 0);
-	return *s && !*rp;
+	if (!opensex_parse_ulong(s, &v))
+		return false;
+
+	*res = v;
+	return true;
 }
 
 static bool opensex_start_row(database_handle_t *db, const char *type)
@@ -220,6 +428,13 @@ static bool opensex_commit_row(database_handle_t *db)
 
 	fprintf(rs->f, "\n");
 
+	/* journal rows must reach the kernel before the change is acknowledged */
+	if (db->txn == DB_JOURNAL && fflush(rs->f) != 0)
+	{
+		slog(LG_ERROR, "db-commit-row: cannot write journal '%s': %s", db->file, strerror(errno));
+		return false;
+	}
+
 	return true;
 }
 
@@ -243,13 +458,394 @@ static database_vtable_t opensex_vt = {
 	.commit_row = opensex_commit_row
 };
 
-static database_handle_t *opensex_db_open_read(const char *filename)
+#ifdef OPENSEX_USE_THREADS
+/*
+ * Threaded loading: the mapped file is cut into row-aligned chunks, which
+ * load threads copy, split into words and scan for numbers.  The main thread
+ * takes the chunks back in file order and runs the row handlers, so objects
+ * are still built in the order the rows were written (MU before MDU, MC
+ * before CA, and so on) and no handler ever runs off the main thread.
+ */
+static opensex_token_t *opensex_row_next(database_handle_t *db)
+{
+	opensex_t *rs = (opensex_t *)db->priv;
+	opensex_token_t *t;
+
+	if (rs->tok == rs->tokend)
+		return NULL;
+
+	t = rs->tok++;
+
+	/* opensex_row_read_str() may have put the space back */
+	rs->rowtext[t->start + t->len] = '\0';
+
+	db->token++;
+
+	return t;
+}
+
+static const char *opensex_row_read_word(database_handle_t *db)
+{
+	opensex_t *rs = (opensex_t *)db->priv;
+	opensex_token_t *t = opensex_row_next(db);
+
+	return t != NULL ? rs->rowtext + t->start : NULL;
+}
+
+static const char *opensex_row_read_str(database_handle_t *db)
+{
+	opensex_t *rs = (opensex_t *)db->priv;
+	opensex_token_t *t;
+
+	db->token++;
+
+	if (rs->tok == rs->tokend)
+		return NULL;
+
+	/* the rest of the row, as opensex_read_str() would return it */
+	for (t = rs->tok; t < rs->tokend - 1; t++)
+		rs->rowtext[t->start + t->len] = ' ';
+
+	return rs->rowtext + rs->tok->start;
+}
+
+static bool opensex_row_read_int(database_handle_t *db, int *res)
+{
+	opensex_t *rs = (opensex_t *)db->priv;
+	opensex_token_t *t = opensex_row_next(db);
+
+	if (!t) return false;
+
+	if (t->isnum && t->num <= LONG_MAX)
+	{
+		*res = (long)t->num;
+		return true;
+	}
+
+	return opensex_parse_int(rs->rowtext + t->start, res);
+}
+
+static bool opensex_row_read_uint(database_handle_t *db, unsigned int *res)
+{
+	opensex_t *rs = (opensex_t *)db->priv;
+	opensex_token_t *t = opensex_row_next(db);
+
+	if (!t) return false;
+
+	if (!t->isnum && !opensex_parse_ulong(rs->rowtext + t->start, &t->num))
+		return false;
+
+	*res = t->num;
+	return true;
+}
+
+static bool opensex_row_read_time(database_handle_t *db, time_t *res)
+{
+	opensex_t *rs = (opensex_t *)db->priv;
+	opensex_token_t *t = opensex_row_next(db);
+
+	if (!t) return false;
+
+	if (!t->isnum && !opensex_parse_ulong(rs->rowtext + t->start, &t->num))
+		return false;
+
+	*res = t->num;
+	return true;
+}
+
+static bool opensex_row_read_next_row(database_handle_t *db)
+{
+	/* the main thread hands out the rows itself */
+	return false;
+}
+
+static database_vtable_t opensex_row_vt = {
+	.name = "opensex",
+
+	.read_next_row = opensex_row_read_next_row,
+
+	.read_word = opensex_row_read_word,
+	.read_str = opensex_row_read_str,
+	.read_int = opensex_row_read_int,
+	.read_uint = opensex_row_read_uint,
+	.read_time = opensex_row_read_time,
+};
+
+/* load threads must not slog() or smalloc(), so running out of memory is reported with false */
+static bool opensex_grow(void **p, size_t *alloc, size_t size)
+{
+	void *np = realloc(*p, *alloc * 2 * size);
+
+	if (np == NULL)
+		return false;
+
+	*p = np;
+	*alloc *= 2;
+	return true;
+}
+
+static bool opensex_tokenize_chunk(opensex_chunk_t *c)
+{
+	char *p, *end, *lend, *sep;
+	size_t rowsalloc = c->len / 64 + 16, toksalloc = c->len / 8 + 64;
+	opensex_row_t *row;
+	opensex_token_t *t;
+
+	c->text = malloc(c->len + 1);
+	c->rows = malloc(rowsalloc * sizeof *c->rows);
+	c->toks = malloc(toksalloc * sizeof *c->toks);
+	if (c->text == NULL || c->rows == NULL || c->toks == NULL)
+		return false;
+
+	memcpy(c->text, c->src, c->len);
+	c->text[c->len] = '\0';
+
+	for (p = c->text, end = p + c->len; p < end; p = lend + 1)
+	{
+		lend = memchr(p, '\n', end - p);
+		if (lend == NULL)
+			lend = end;
+		*lend = '\0';
+		c->lines++;
+
+		/* the same rows opensex_db_parse() skips */
+		if (!*p || strchr("#\t \r", *p))
+			continue;
+
+		if (c->nrows == rowsalloc && !opensex_grow((void **)&c->rows, &rowsalloc, sizeof *c->rows))
+			return false;
+
+		row = &c->rows[c->nrows++];
+		row->line = c->lines;
+		row->tok = c->ntoks;
+
+		for (;;)
+		{
+			if (c->ntoks == toksalloc && !opensex_grow((void **)&c->toks, &toksalloc, sizeof *c->toks))
+				return false;
+
+			sep = memchr(p, ' ', lend - p);
+			if (sep != NULL)
+				*sep = '\0';
+
+			t = &c->toks[c->ntoks++];
+			t->start = p - c->text;
+			t->len = (sep != NULL ? sep : lend) - p;
+			t->isnum = *p >= '0' && *p <= '9' && opensex_parse_ulong(p, &t->num);
+
+			if (sep == NULL)
+				break;
+			p = sep + 1;
+		}
+
+		row->ntok = c->ntoks - row->tok;
+	}
+
+	return true;
+}
+
+static void *opensex_load_worker(void *arg)
+{
+	opensex_loader_t *l = arg;
+	opensex_chunk_t *c;
+	bool ok;
+
+	pthread_mutex_lock(&l->lock);
+
+	while (l->next < l->nchunks)
+	{
+		/* do not pile up more chunks than the main thread is about to use */
+		if (l->next >= l->consumed + l->ahead)
+		{
+			pthread_cond_wait(&l->space, &l->lock);
+			continue;
+		}
+
+		c = &l->chunks[l->next++];
+		pthread_mutex_unlock(&l->lock);
+
+		ok = opensex_tokenize_chunk(c);
+
+		pthread_mutex_lock(&l->lock);
+		c->failed = !ok;
+		c->done = true;
+		pthread_cond_broadcast(&l->ready);
+	}
+
+	pthread_mutex_unlock(&l->lock);
+
+	return NULL;
+}
+
+/*
+ * opensex_db_parse_threaded(database_handle_t *db)
+ *
+ * Reads a mapped database with the help of general::db_load_threads
+ * load threads.
+ *
+ * Inputs:
+ *       - a database handle opened for reading
+ *
+ * Outputs:
+ *       - false if the database is to be read on the main thread alone
+ *
+ * Side Effects:
+ *       - all rows are passed to their handlers, on the main thread
+ */
+static bool opensex_db_parse_threaded(database_handle_t *db)
+{
+	opensex_t *rs = (opensex_t *)db->priv;
+	opensex_loader_t l;
+	opensex_chunk_t *c;
+	opensex_row_t *r;
+	database_vtable_t *vt;
+	pthread_t *threads;
+	unsigned int nthreads, i, line = 0;
+	const char *p, *nl, *cmd;
+	sigset_t all, old;
+	long ncpus;
+	int err;
+
+	/* journals are small, and their torn last row is dealt with by opensex_read_next_row() */
+	if (db->txn != DB_READ || rs->map == NULL || (size_t)(rs->end - rs->pos) < OPENSEX_THREAD_MINSIZE || config_options.db_load_threads == 0)
+		return false;
+
+	memset(&l, 0, sizeof l);
+	l.chunks = scalloc(rs->maplen / OPENSEX_CHUNKSIZE + 1, sizeof *l.chunks);
+
+	/* every chunk ends with a newline, except perhaps the last */
+	for (p = rs->pos; p < rs->end; p += c->len)
+	{
+		c = &l.chunks[l.nchunks++];
+		c->src = p;
+
+		if ((size_t)(rs->end - p) <= OPENSEX_CHUNKSIZE)
+			c->len = rs->end - p;
+		else if ((nl = memchr(p + OPENSEX_CHUNKSIZE - 1, '\n', rs->end - p - OPENSEX_CHUNKSIZE + 1)) != NULL)
+			c->len = nl + 1 - p;
+		else
+			c->len = rs->end - p;
+	}
+
+	nthreads = config_options.db_load_threads;
+	if (nthreads > l.nchunks)
+		nthreads = l.nchunks;
+#ifdef _SC_NPROCESSORS_ONLN
+	/* the main thread needs a CPU of its own to gain anything */
+	if ((ncpus = sysconf(_SC_NPROCESSORS_ONLN)) > 0 && (long)nthreads >= ncpus)
+		nthreads = ncpus - 1;
+#endif
+	if (nthreads == 0)
+	{
+		free(l.chunks);
+		return false;
+	}
+
+	threads = smalloc(nthreads * sizeof *threads);
+	l.ahead = nthreads * OPENSEX_THREAD_AHEAD;
+
+	pthread_mutex_init(&l.lock, NULL);
+	pthread_cond_init(&l.ready, NULL);
+	pthread_cond_init(&l.space, NULL);
+
+	/* signals are for the main thread to handle */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+
+	for (i = 0; i < nthreads; i++)
+	{
+		if ((err = pthread_create(&threads[i], NULL, opensex_load_worker, &l)) != 0)
+		{
+			slog(LG_ERROR, "db-parse: cannot start a load thread: %s", strerror(err));
+			break;
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	nthreads = i;
+	if (nthreads == 0)
+	{
+		pthread_cond_destroy(&l.space);
+		pthread_cond_destroy(&l.ready);
+		pthread_mutex_destroy(&l.lock);
+		free(threads);
+		free(l.chunks);
+		return false;
+	}
+
+	slog(LG_DEBUG, "db-parse: reading '%s' in %zu chunks with %u load threads", db->file, l.nchunks, nthreads);
+
+	vt = db->vt;
+	db->vt = &opensex_row_vt;
+
+	for (c = l.chunks; c < l.chunks + l.nchunks; c++)
+	{
+		pthread_mutex_lock(&l.lock);
+		while (!c->done)
+			pthread_cond_wait(&l.ready, &l.lock);
+		pthread_mutex_unlock(&l.lock);
+
+		if (c->failed)
+		{
+			slog(LG_ERROR, "db-parse: out of memory reading %s after line %u", db->file, line);
+			slog(LG_ERROR, "db-parse: exiting to avoid data loss");
+			exit(EXIT_FAILURE);
+		}
+
+		rs->rowtext = c->text;
+
+		for (r = c->rows; r < c->rows + c->nrows; r++)
+		{
+			db->line = line + r->line;
+			db->token = 0;
+			rs->tok = &c->toks[r->tok];
+			rs->tokend = rs->tok + r->ntok;
+
+			cmd = db_read_word(db);
+			opensex_process(db, cmd);
+		}
+
+		line += c->lines;
+
+		free(c->text);
+		free(c->rows);
+		free(c->toks);
+
+		pthread_mutex_lock(&l.lock);
+		l.consumed++;
+		pthread_cond_broadcast(&l.space);
+		pthread_mutex_unlock(&l.lock);
+	}
+
+	db->vt = vt;
+	rs->rowtext = NULL;
+	rs->tok = rs->tokend = NULL;
+	rs->pos = rs->end;
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_cond_destroy(&l.space);
+	pthread_cond_destroy(&l.ready);
+	pthread_mutex_destroy(&l.lock);
+	free(threads);
+	free(l.chunks);
+
+	return true;
+}
+#endif
+
+static database_handle_t *opensex_db_open_read(const char *filename, database_transaction_t txn)
 {
 	database_handle_t *db;
 	opensex_t *rs;
 	FILE *f;
 	int errno1;
 	char path[BUFSIZE];
+#ifndef MOWGLI_OS_WIN
+	struct stat sb;
+#endif
 
 	snprintf(path, BUFSIZE, "%s/%s", datadir, filename != NULL ? filename : "services.db");
 	f = fopen(path, "r");
@@ -276,10 +872,38 @@ static database_handle_t *opensex_db_open_read(const char *filename)
 	rs->token = NULL;
 	rs->f = f;
 
+#ifndef MOWGLI_OS_WIN
+	if (fstat(fileno(f), &sb) == 0 && sb.st_size > 0)
+	{
+		rs->map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+		if (rs->map != MAP_FAILED)
+		{
+			rs->maplen = sb.st_size;
+			madvise(rs->map, rs->maplen, MADV_SEQUENTIAL);
+		}
+		else
+		{
+			slog(LG_DEBUG, "db-open-read: cannot mmap '%s' (%s), falling back to buffered reads", path, strerror(errno));
+			rs->map = NULL;
+		}
+	}
+#endif
+
+	if (rs->map != NULL)
+	{
+		rs->pos = rs->map;
+		rs->end = rs->map + rs->maplen;
+	}
+	else
+	{
+		rs->chunk = smalloc(OPENSEX_CHUNKSIZE);
+		rs->pos = rs->end = rs->chunk;
+	}
+
 	db = scalloc(sizeof(database_handle_t), 1);
 	db->priv = rs;
 	db->vt = &opensex_vt;
-	db->txn = DB_READ;
+	db->txn = txn;
 	db->file = sstrdup(path);
 	db->line = 0;
 	db->token = 0;
@@ -328,17 +952,58 @@ static database_handle_t *opensex_db_open_write(const char *filename)
 	return db;
 }
 
+static database_handle_t *opensex_db_open_journal(const char *filename)
+{
+	database_handle_t *db;
+	opensex_t *rs;
+	FILE *f;
+	char path[BUFSIZE];
+
+	snprintf(path, BUFSIZE, "%s/%s", datadir, filename);
+
+	f = fopen(path, "a");
+	if (!f)
+	{
+		slog(LG_ERROR, "db-open-journal: cannot open '%s' for appending: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	rs = scalloc(sizeof(opensex_t), 1);
+	rs->f = f;
+	rs->grver = 1;
+
+	db = scalloc(sizeof(database_handle_t), 1);
+	db->priv = rs;
+	db->vt = &opensex_vt;
+	db->txn = DB_JOURNAL;
+	db->file = sstrdup(path);
+	db->line = 0;
+	db->token = 0;
+
+	return db;
+}
+
 static database_handle_t *opensex_db_open(const char *filename, database_transaction_t txn)
 {
-	if (txn == DB_WRITE)
-		return opensex_db_open_write(filename);
-	return opensex_db_open_read(filename);
+	database_handle_t *db;
+
+	if (txn == DB_READ || txn == DB_REPLAY)
+		return opensex_db_open_read(filename, txn);
+	if (txn == DB_JOURNAL)
+		return opensex_db_open_journal(filename);
+
+	db = opensex_db_open_write(filename);
+	if (db != NULL)
+		db->txn = txn;
+
+	return db;
 }
 
 static void opensex_db_close(database_handle_t *db)
 {
 	opensex_t *rs;
 	int errno1;
+	bool failed;
 	char oldpath[BUFSIZE], newpath[BUFSIZE];
 
 	return_if_fail(db != NULL);
@@ -349,21 +1014,59 @@ static void opensex_db_close(database_handle_t *db)
 
 	mowgli_strlcpy(newpath, db->file, sizeof newpath);
 
-	fclose(rs->f);
+	/* a write that failed before the final flush only shows in the error flag */
+	failed = ferror(rs->f) != 0;
+	if (fclose(rs->f) != 0)
+		failed = true;
 
-	if (db->txn == DB_WRITE)
+	if (db->txn == DB_JOURNAL)
 	{
-		/* now, replace the old database with the new one, using an atomic rename */
+		if (failed)
+			slog(LG_ERROR, "db-close: cannot write journal '%s': %s", db->file, strerror(errno));
+	}
+	else if (db->txn == DB_SNAPSHOT)
+	{
+		/* we are the snapshot child; the parent learns the result from our exit status */
+		if (failed)
+		{
+			slog(LG_ERROR, "db_save(): cannot write services.db.new: %s", strerror(errno));
+			log_flush(NULL);
+			_exit(EXIT_FAILURE);
+		}
+
 		if (srename(oldpath, newpath) < 0)
+		{
+			slog(LG_ERROR, "db_save(): cannot rename services.db.new to services.db: %s", strerror(errno));
+			log_flush(NULL);
+			_exit(EXIT_FAILURE);
+		}
+	}
+	else if (db->txn == DB_WRITE)
+	{
+		/* a short services.db.new must never replace the last good database */
+		if (failed)
+		{
+			errno1 = errno;
+			slog(LG_ERROR, "db_save(): cannot write services.db.new, keeping the old services.db: %s", strerror(errno1));
+			wallops(_("\2DATABASE ERROR\2: db_save(): cannot write services.db.new, keeping the old services.db: %s"), strerror(errno1));
+		}
+		/* now, replace the old database with the new one, using an atomic rename */
+		else if (srename(oldpath, newpath) < 0)
 		{
 			errno1 = errno;
 			slog(LG_ERROR, "db_save(): cannot rename services.db.new to services.db: %s", strerror(errno1));
 			wallops(_("\2DATABASE ERROR\2: db_save(): cannot rename services.db.new to services.db: %s"), strerror(errno1));
 		}
-
-		hook_call_db_saved();
+		else
+			hook_call_db_saved();
 	}
 
+#ifndef MOWGLI_OS_WIN
+	if (rs->map != NULL)
+		munmap(rs->map, rs->maplen);
+#endif
+
+	free(rs->chunk);
 	free(rs->buf);
 	free(rs);
 	free(db->file);
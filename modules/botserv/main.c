@@ -18,6 +18,7 @@ DECLARE_MODULE_V1
 
 static void bs_join(hook_channel_joinpart_t *hdata);
 static void bs_part(hook_channel_joinpart_t *hdata);
+static void bs_users_split(hook_users_split_t *hdata);
 
 static void bs_cmd_bot(sourceinfo_t *si, int parc, char *parv[]);
 static void bs_cmd_add(sourceinfo_t *si, int parc, char *parv[]);
@@ -38,6 +39,8 @@ fn_botserv_bot_find botserv_bot_find;
 
 service_t *botsvs;
 
+static metadata_key_t *md_botassigned;
+
 unsigned int min_users = 0;
 
 E mowgli_list_t mychan;
@@ -56,7 +59,7 @@ static botserv_bot_t *bs_mychan_find_bot(mychan_t *mc)
 	metadata_t *md;
 	botserv_bot_t *bot;
 
-	md = metadata_find(mc, "private:botserv:bot-assigned");
+	md = metadata_find_key(mc, md_botassigned);
 	bot = md != NULL ? botserv_bot_find(md->value) : NULL;
 	if (bot != NULL && !user_find_named(bot->nick))
 		bot = NULL;
@@ -173,7 +176,7 @@ bs_modestack_mode_simple(const char *source, channel_t *channel, int dir, int fl
 	if (source != NULL && chansvs.nick != NULL &&
 			!strcmp(source, chansvs.nick) &&
 			(mc = MYCHAN_FROM(channel)) != NULL &&
-			(bs = metadata_find(mc, "private:botserv:bot-assigned")) != NULL)
+			(bs = metadata_find_key(mc, md_botassigned)) != NULL)
 		bot = user_find_named(bs->value);
 
 	modestack_mode_simple_real(bot ? bot->nick : source, channel, dir, flags);
@@ -192,7 +195,7 @@ bs_modestack_mode_limit(const char *source, channel_t *channel, int dir, unsigne
 	if (source != NULL && chansvs.nick != NULL &&
 			!strcmp(source, chansvs.nick) &&
 			(mc = MYCHAN_FROM(channel)) != NULL &&
-			(bs = metadata_find(mc, "private:botserv:bot-assigned")) != NULL)
+			(bs = metadata_find_key(mc, md_botassigned)) != NULL)
 		bot = user_find_named(bs->value);
 
 	modestack_mode_limit_real(bot ? bot->nick : source, channel, dir, limit);
@@ -211,7 +214,7 @@ bs_modestack_mode_ext(const char *source, channel_t *channel, int dir, unsigned
 	if (source != NULL && chansvs.nick != NULL &&
 			!strcmp(source, chansvs.nick) &&
 			(mc = MYCHAN_FROM(channel)) != NULL &&
-			(bs = metadata_find(mc, "private:botserv:bot-assigned")) != NULL)
+			(bs = metadata_find_key(mc, md_botassigned)) != NULL)
 		bot = user_find_named(bs->value);
 
 	modestack_mode_ext_real(bot ? bot->nick : source, channel, dir, i, value);
@@ -230,7 +233,7 @@ bs_modestack_mode_param(const char *source, channel_t *channel, int dir, char ty
 	if (source != NULL && chansvs.nick != NULL &&
 			!strcmp(source, chansvs.nick) &&
 			(mc = MYCHAN_FROM(channel)) != NULL &&
-			(bs = metadata_find(mc, "private:botserv:bot-assigned")) != NULL)
+			(bs = metadata_find_key(mc, md_botassigned)) != NULL)
 		bot = user_find_named(bs->value);
 
 	modestack_mode_param_real(bot ? bot->nick : source, channel, dir, type, value);
@@ -249,7 +252,7 @@ bs_try_kick(user_t *source, channel_t *chan, user_t *target, const char *reason)
 	if (source != chansvs.me->me)
 		return try_kick_real(source, chan, target, reason);
 
-	if ((mc = MYCHAN_FROM(chan)) != NULL && (bs = metadata_find(mc, "private:botserv:bot-assigned")) != NULL)
+	if ((mc = MYCHAN_FROM(chan)) != NULL && (bs = metadata_find_key(mc, md_botassigned)) != NULL)
 		bot = user_find_named(bs->value);
 
 	try_kick_real(bot ? bot : source, chan, target, reason);
@@ -270,7 +273,7 @@ bs_join_registered(bool all)
 
 	MOWGLI_PATRICIA_FOREACH(mc, &state, mclist)
 	{
-		if ((md = metadata_find(mc, "private:botserv:bot-assigned")) == NULL)
+		if ((md = metadata_find_key(mc, md_botassigned)) == NULL)
 			continue;
 
 		if (all)
@@ -347,7 +350,7 @@ botserv_channel_handler(sourceinfo_t *si, int parc, char *parv[])
 		return;
 	}
 
-	md = metadata_find(mc, "private:botserv:bot-assigned");
+	md = metadata_find_key(mc, md_botassigned);
 	if (md == NULL)
 	{
 		/* we received this, but have no record of a bot assigned. WTF */
@@ -668,7 +671,7 @@ static void bs_cmd_change(sourceinfo_t *si, int parc, char *parv[])
 	/* join it back and also update the metadata */
 	MOWGLI_PATRICIA_FOREACH(mc, &state, mclist)
 	{
-		if ((md = metadata_find(mc, "private:botserv:bot-assigned")) == NULL)
+		if ((md = metadata_find_key(mc, md_botassigned)) == NULL)
 			continue;
 
 		if (!irccasecmp(md->value, parv[0]))
@@ -779,7 +782,7 @@ static void bs_cmd_delete(sourceinfo_t *si, int parc, char *parv[])
 
 	MOWGLI_PATRICIA_FOREACH(mc, &state, mclist)
 	{
-		if ((md = metadata_find(mc, "private:botserv:bot-assigned")) == NULL)
+		if ((md = metadata_find_key(mc, md_botassigned)) == NULL)
 			continue;
 
 		if (!irccasecmp(md->value, bot->nick))
@@ -884,7 +887,7 @@ static void bs_cmd_assign(sourceinfo_t *si, int parc, char *parv[])
 		return;
 	}
 
-	md = metadata_find(mc, "private:botserv:bot-assigned");
+	md = metadata_find_key(mc, md_botassigned);
 
 	bot = botserv_bot_find(parv[1]);
 	if (bot == NULL)
@@ -949,7 +952,7 @@ static void bs_cmd_unassign(sourceinfo_t *si, int parc, char *parv[])
 		return;
 	}
 
-	if ((md = metadata_find(mc, "private:botserv:bot-assigned")) == NULL)
+	if ((md = metadata_find_key(mc, md_botassigned)) == NULL)
 	{
 		command_fail(si, fault_nosuch_key, _("\2%s\2 does not have a bot assigned."), mc->name);
 		return;
@@ -977,6 +980,8 @@ void _modinit(module_t *m)
 		return;
 	}
 
+	md_botassigned = metadata_key_register("private:botserv:bot-assigned");
+
 	hook_add_event("config_ready");
 	hook_add_config_ready(botserv_config_ready);
 
@@ -999,6 +1004,7 @@ void _modinit(module_t *m)
 	service_bind_command(botsvs, &bs_botlist);
 	hook_add_event("channel_join");
 	hook_add_event("channel_part");
+	hook_add_event("users_split");
 	hook_add_event("channel_register");
 	hook_add_event("channel_add");
 	hook_add_event("channel_can_change_topic");
@@ -1006,6 +1012,7 @@ void _modinit(module_t *m)
 	hook_add_operserv_info(osinfo_hook);
 	hook_add_first_channel_join(bs_join);
 	hook_add_channel_part(bs_part);
+	hook_add_users_split(bs_users_split);
 
 	modestack_mode_simple = bs_modestack_mode_simple;
 	modestack_mode_limit  = bs_modestack_mode_limit;
@@ -1043,6 +1050,7 @@ void _moddeinit(module_unload_intent_t intent)
 	del_conf_item("MIN_USERS", &botsvs->conf_table);
 	hook_del_channel_join(bs_join);
 	hook_del_channel_part(bs_part);
+	hook_del_users_split(bs_users_split);
 	hook_del_channel_drop(bs_channel_drop);
 	hook_del_shutdown(on_shutdown);
 	hook_del_config_ready(botserv_config_ready);
@@ -1103,7 +1111,7 @@ static void bs_join(hook_channel_joinpart_t *hdata)
 		return;
 
 	/* chanserv's function handles those */
-	if (metadata_find(mc, "private:botserv:bot-assigned") == NULL)
+	if (metadata_find_key(mc, md_botassigned) == NULL)
 		return;
 
 	bot = bs_mychan_find_bot(mc);
@@ -1144,7 +1152,7 @@ bs_part(hook_channel_joinpart_t *hdata)
 		return;
 
 	/* chanserv's function handles those */
-	if (metadata_find(mc, "private:botserv:bot-assigned") == NULL)
+	if (metadata_find_key(mc, md_botassigned) == NULL)
 		return;
 
 	bot = bs_mychan_find_bot(mc);
@@ -1172,6 +1180,53 @@ bs_part(hook_channel_joinpart_t *hdata)
 	}
 }
 
+/* bs_part() for a whole netsplit, once per channel rather than per member */
+static void
+bs_users_split(hook_users_split_t *hdata)
+{
+	channel_t *c;
+	chanuser_t *cu;
+	mychan_t *mc;
+	botserv_bot_t *bot;
+	mowgli_node_t *n;
+	unsigned int i, remaining;
+
+	for (i = 0; i < hdata->nchannels; i++)
+	{
+		c = hdata->channels[i];
+		mc = MYCHAN_FROM(c);
+		if (mc == NULL)
+			continue;
+
+		/* chanserv's function handles those */
+		if (metadata_find_key(mc, md_botassigned) == NULL)
+			continue;
+
+		bot = bs_mychan_find_bot(mc);
+
+		remaining = 0;
+		MOWGLI_ITER_FOREACH(n, c->members.head)
+		{
+			cu = n->data;
+			if (!(cu->user->flags & UF_SPLIT))
+				remaining++;
+			else if (CURRTIME - mc->used >= 3600)
+				if (chanacs_user_flags(mc, cu->user) & CA_USEDUPDATE)
+					mc->used = CURRTIME;
+		}
+
+		if (config_options.leave_chans
+				&& !(mc->flags & MC_INHABIT)
+				&& remaining <= 1)
+		{
+			if (bot)
+				part(c->name, bot->nick);
+			else
+				part(c->name, chansvs.nick);
+		}
+	}
+}
+
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
  * vim:ts=8
  * vim:sw=8
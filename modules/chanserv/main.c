@@ -20,17 +20,26 @@ DECLARE_MODULE_V1
 
 static void cs_join(hook_channel_joinpart_t *hdata);
 static void cs_part(hook_channel_joinpart_t *hdata);
+static void cs_users_split(hook_users_split_t *hdata);
 static void cs_register(hook_channel_req_t *mc);
 static void cs_succession(hook_channel_succession_req_t *data);
 static void cs_newchan(channel_t *c);
 static void cs_keeptopic_topicset(channel_t *c);
 static void cs_topiccheck(hook_channel_topic_check_t *data);
 static void cs_tschange(channel_t *c);
+static void cs_server_eob(server_t *s);
+static void cs_channel_drop(mychan_t *mc);
 static void cs_leave_empty(void *unused);
 static void on_shutdown(void *unused);
 
 static mowgli_eventloop_timer_t *cs_leave_empty_timer = NULL;
 
+/* registered channels with members waiting for the end of a burst */
+static mowgli_list_t cs_burst_joins;
+
+/* looked up on every join */
+static metadata_key_t *md_botassigned, *md_reason, *md_entrymsg, *md_url;
+
 static void join_registered(bool all)
 {
 	mychan_t *mc;
@@ -40,7 +49,7 @@ static void join_registered(bool all)
 	{
 		if (!(mc->flags & MC_GUARD))
 			continue;
-		if (metadata_find(mc, "private:botserv:bot-assigned") != NULL)
+		if (metadata_find_key(mc, md_botassigned) != NULL)
 			continue;
 
 		if (all)
@@ -265,6 +274,11 @@ static int c_ci_templates(mowgli_config_file_entry_t *ce)
 
 void _modinit(module_t *m)
 {
+	md_botassigned = metadata_key_register("private:botserv:bot-assigned");
+	md_reason = metadata_key_register("reason");
+	md_entrymsg = metadata_key_register("private:entrymsg");
+	md_url = metadata_key_register("url");
+
 	hook_add_event("config_ready");
 	hook_add_config_ready(chanserv_config_ready);
 
@@ -272,6 +286,7 @@ void _modinit(module_t *m)
 
 	hook_add_event("channel_join");
 	hook_add_event("channel_part");
+	hook_add_event("users_split");
 	hook_add_event("channel_register");
 	hook_add_event("channel_succession");
 	hook_add_event("channel_add");
@@ -279,15 +294,20 @@ void _modinit(module_t *m)
 	hook_add_event("channel_can_change_topic");
 	hook_add_event("channel_tschange");
 	hook_add_event("user_identify");
+	hook_add_event("server_eob");
+	hook_add_event("channel_drop");
 	hook_add_event("shutdown");
 	hook_add_channel_join(cs_join);
 	hook_add_channel_part(cs_part);
+	hook_add_users_split(cs_users_split);
 	hook_add_channel_register(cs_register);
 	hook_add_channel_succession(cs_succession);
 	hook_add_channel_add(cs_newchan);
 	hook_add_channel_topic(cs_keeptopic_topicset);
 	hook_add_channel_can_change_topic(cs_topiccheck);
 	hook_add_channel_tschange(cs_tschange);
+	hook_add_server_eob(cs_server_eob);
+	hook_add_channel_drop(cs_channel_drop);
 	hook_add_shutdown(on_shutdown);
 
 	cs_leave_empty_timer = mowgli_timer_add(base_eventloop, "cs_leave_empty", cs_leave_empty, NULL, 300);
@@ -313,6 +333,9 @@ void _modinit(module_t *m)
 
 void _moddeinit(module_unload_intent_t intent)
 {
+	mowgli_node_t *n, *tn;
+	mychan_t *mc;
+
 	if (chansvs.me)
 	{
 		chansvs.nick = NULL;
@@ -326,56 +349,37 @@ void _moddeinit(module_unload_intent_t intent)
 	hook_del_config_ready(chanserv_config_ready);
 	hook_del_channel_join(cs_join);
 	hook_del_channel_part(cs_part);
+	hook_del_users_split(cs_users_split);
 	hook_del_channel_register(cs_register);
 	hook_del_channel_succession(cs_succession);
 	hook_del_channel_add(cs_newchan);
 	hook_del_channel_topic(cs_keeptopic_topicset);
 	hook_del_channel_can_change_topic(cs_topiccheck);
 	hook_del_channel_tschange(cs_tschange);
+	hook_del_server_eob(cs_server_eob);
+	hook_del_channel_drop(cs_channel_drop);
 	hook_del_shutdown(on_shutdown);
 
 	mowgli_timer_destroy(base_eventloop, cs_leave_empty_timer);
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, cs_burst_joins.head)
+	{
+		mc = n->data;
+		mc->flags &= ~MC_BURSTJOIN;
+		mowgli_node_delete(n, &cs_burst_joins);
+		mowgli_node_free(n);
+	}
 }
 
-static void cs_join(hook_channel_joinpart_t *hdata)
+/* the AKICK, RESTRICTED and +i checks of cs_join(); true if the user was kicked */
+static bool cs_join_kick(mychan_t *mc, chanuser_t *cu, unsigned int flags, bool guard)
 {
-	chanuser_t *cu = hdata->cu;
-	user_t *u;
-	channel_t *chan;
-	mychan_t *mc;
-	unsigned int flags;
-	bool noop;
-	bool secure;
-	bool guard;
+	user_t *u = cu->user;
+	channel_t *chan = cu->chan;
 	metadata_t *md;
 	chanacs_t *ca2;
 	char akickreason[120] = "User is banned from this channel", *p;
 
-	if (cu == NULL || is_internal_client(cu->user))
-		return;
-	u = cu->user;
-	chan = cu->chan;
-
-	/* first check if this is a registered channel at all */
-	mc = mychan_find(chan->name);
-	if (mc == NULL)
-		return;
-
-	flags = chanacs_user_flags(mc, u);
-	noop = mc->flags & MC_NOOP || (u->myuser != NULL &&
-			u->myuser->flags & MU_NOOP);
-	/* attempt to deop people recreating channels, if the more
-	 * sophisticated mechanism is disabled */
-	secure = mc->flags & MC_SECURE || (!chansvs.changets &&
-			chan->nummembers == 1 && chan->ts > CURRTIME - 300);
-	/* chanserv or a botserv bot should join */
-	guard = mc->flags & MC_GUARD ||
-		metadata_find(mc, "private:botserv:bot-assigned") != NULL;
-
-	if (chan->nummembers == 1 && mc->flags & MC_GUARD &&
-		metadata_find(mc, "private:botserv:bot-assigned") == NULL)
-		join(chan->name, chansvs.nick);
-
 	/*
 	 * CS SET RESTRICTED: if they don't have any access (excluding AKICK)
 	 * or special privs to join restricted chans, boot them. -- w00t
@@ -402,8 +406,7 @@ static void cs_join(hook_channel_joinpart_t *hdata)
 			remove_ban_exceptions(chansvs.me->me, chan, u);
 		}
 		try_kick(chansvs.me->me, chan, u, "You are not authorized to be on this channel");
-		hdata->cu = NULL;
-		return;
+		return true;
 	}
 
 	if (flags & CA_AKICK && !(flags & CA_EXEMPT))
@@ -435,7 +438,7 @@ static void cs_join(hook_channel_joinpart_t *hdata)
 		remove_ban_exceptions(chansvs.me->me, chan, u);
 		if (ca2 != NULL)
 		{
-			md = metadata_find(ca2, "reason");
+			md = metadata_find_key(ca2, md_reason);
 			if (md != NULL && *md->value != '|')
 			{
 				snprintf(akickreason, sizeof akickreason,
@@ -454,8 +457,7 @@ static void cs_join(hook_channel_joinpart_t *hdata)
 			}
 		}
 		try_kick(chansvs.me->me, chan, u, akickreason);
-		hdata->cu = NULL;
-		return;
+		return true;
 	}
 
 	/* Kick out users who may be recreating channels mlocked +i.
@@ -484,22 +486,21 @@ static void cs_join(hook_channel_joinpart_t *hdata)
 			check_modes(mc, true);
 		modestack_flush_channel(chan);
 		try_kick(chansvs.me->me, chan, u, "Invite only channel");
-		hdata->cu = NULL;
-		return;
+		return true;
 	}
 
-	/* A second user joined and was not kicked; we do not need
-	 * to stay on the channel artificially.
-	 * If there is only one user, stay in the channel to avoid
-	 * triggering autocycle-for-ops scripts and immediately
-	 * destroying channels with kick on split riding.
-	 */
-	if (mc->flags & MC_INHABIT && chan->nummembers >= 3)
-	{
-		mc->flags &= ~MC_INHABIT;
-		if (!(mc->flags & MC_GUARD) && !(chan->flags & CHAN_LOG) && chanuser_find(chan, chansvs.me->me))
-			part(chan->name, chansvs.nick);
-	}
+	return false;
+}
+
+/* the status modes cs_join() gives or takes, left on the modestack */
+static void cs_join_modes(mychan_t *mc, chanuser_t *cu, unsigned int flags, bool secure)
+{
+	user_t *u = cu->user;
+	channel_t *chan = cu->chan;
+	bool noop;
+
+	noop = mc->flags & MC_NOOP || (u->myuser != NULL &&
+			u->myuser->flags & MU_NOOP);
 
 	if (ircd->uses_owner)
 	{
@@ -574,23 +575,223 @@ static void cs_join(hook_channel_joinpart_t *hdata)
 			cu->modes |= CSTATUS_VOICE;
 		}
 	}
+}
+
+/* A second user joined and was not kicked; we do not need
+ * to stay on the channel artificially.
+ * If there is only one user, stay in the channel to avoid
+ * triggering autocycle-for-ops scripts and immediately
+ * destroying channels with kick on split riding.
+ */
+static void cs_join_uninhabit(mychan_t *mc, channel_t *chan)
+{
+	if (mc->flags & MC_INHABIT && chan->nummembers >= 3)
+	{
+		mc->flags &= ~MC_INHABIT;
+		if (!(mc->flags & MC_GUARD) && !(chan->flags & CHAN_LOG) && chanuser_find(chan, chansvs.me->me))
+			part(chan->name, chansvs.nick);
+	}
+}
+
+/*
+ * The server whose end of burst a user waits for: its own, unless that is
+ * a P10 server which has finished but waits for its uplink (SF_EOB2).
+ * The user is bursting until this server has SF_EOB.
+ */
+static server_t *cs_burst_server(user_t *u)
+{
+	server_t *s = u->server;
+
+	while (s->flags & SF_EOB2 && !(s->flags & SF_EOB) && s->uplink != NULL && s->uplink != me.me)
+		s = s->uplink;
+
+	return s;
+}
+
+static void cs_join(hook_channel_joinpart_t *hdata)
+{
+	chanuser_t *cu = hdata->cu;
+	user_t *u;
+	channel_t *chan;
+	mychan_t *mc;
+	unsigned int flags;
+	bool secure;
+	bool guard;
+	metadata_t *md;
+
+	if (cu == NULL || is_internal_client(cu->user))
+		return;
+	u = cu->user;
+	chan = cu->chan;
+
+	/* first check if this is a registered channel at all */
+	mc = MYCHAN_FROM(chan);
+	if (mc == NULL)
+		return;
+
+	/* bursted joins are handled a channel at a time at end of burst,
+	 * see cs_server_eob() */
+	if (!(cs_burst_server(u)->flags & SF_EOB))
+	{
+		if (!(mc->flags & MC_BURSTJOIN))
+		{
+			mc->flags |= MC_BURSTJOIN;
+			mowgli_node_add(mc, mowgli_node_create(), &cs_burst_joins);
+		}
+		return;
+	}
 
-	if (u->server->flags & SF_EOB && (md = metadata_find(mc, "private:entrymsg")))
+	flags = chanacs_user_flags(mc, u);
+	/* attempt to deop people recreating channels, if the more
+	 * sophisticated mechanism is disabled */
+	secure = mc->flags & MC_SECURE || (!chansvs.changets &&
+			chan->nummembers == 1 && chan->ts > CURRTIME - 300);
+	/* chanserv or a botserv bot should join */
+	guard = mc->flags & MC_GUARD ||
+		metadata_find_key(mc, md_botassigned) != NULL;
+
+	if (chan->nummembers == 1 && mc->flags & MC_GUARD &&
+		metadata_find_key(mc, md_botassigned) == NULL)
+		join(chan->name, chansvs.nick);
+
+	if (cs_join_kick(mc, cu, flags, guard))
+	{
+		hdata->cu = NULL;
+		return;
+	}
+
+	cs_join_uninhabit(mc, chan);
+
+	cs_join_modes(mc, cu, flags, secure);
+
+	if (u->server->flags & SF_EOB && (md = metadata_find_key(mc, md_entrymsg)))
 	{
-		if (metadata_find(mc, "private:botserv:bot-assigned") == NULL)
+		if (metadata_find_key(mc, md_botassigned) == NULL)
 		{
 			if (!u->myuser || !(u->myuser->flags & MU_NOGREET))
 				notice(chansvs.nick, cu->user->nick, "[%s] %s", mc->name, md->value);
 		}
 	}
 
-	if (u->server->flags & SF_EOB && (md = metadata_find(mc, "url")))
+	if (u->server->flags & SF_EOB && (md = metadata_find_key(mc, md_url)))
 		numeric_sts(me.me, 328, cu->user, "%s :%s", mc->name, md->value);
 
 	if (flags & CA_USEDUPDATE)
 		mc->used = CURRTIME;
 }
 
+/*
+ * cs_join() for the members of a channel that came in the burst s just
+ * finished.  Bursted joins never got entry messages, so all that is left
+ * is kicking and status modes: the kicks go first, so the remaining
+ * members are counted correctly, then the modes for everyone are flushed
+ * together.  Returns true if members from another burst are still waiting.
+ */
+static bool cs_join_burst(mychan_t *mc, server_t *s)
+{
+	channel_t *chan = mc->chan;
+	mowgli_node_t *n, *tn, *first;
+	chanuser_t *cu;
+	server_t *bs;
+	bool guard, recreated, pending = false;
+	unsigned int flags, njoined = 0, i;
+	struct {
+		chanuser_t *cu;
+		unsigned int flags;
+		bool secure;
+	} *joined;
+
+	if (chan == NULL || chan->nummembers == 0)
+		return false;
+
+	guard = mc->flags & MC_GUARD ||
+		metadata_find_key(mc, md_botassigned) != NULL;
+	/* only the first member can be someone recreating the channel,
+	 * cs_join() would have seen it alone */
+	recreated = !chansvs.changets && chan->ts > CURRTIME - 300;
+	first = chan->members.head;
+
+	if (mc->flags & MC_GUARD && metadata_find_key(mc, md_botassigned) == NULL)
+		join(chan->name, chansvs.nick);
+
+	joined = smalloc(chan->nummembers * sizeof *joined);
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, chan->members.head)
+	{
+		cu = n->data;
+		if (is_internal_client(cu->user))
+			continue;
+
+		/* not from a burst, or from one finished earlier */
+		bs = cs_burst_server(cu->user);
+		if (bs->flags & SF_EOB)
+			continue;
+
+		if (bs != s)
+		{
+			pending = true;
+			continue;
+		}
+
+		flags = chanacs_user_flags(mc, cu->user);
+
+		if (cs_join_kick(mc, cu, flags, guard))
+			continue;
+
+		if (flags & CA_USEDUPDATE)
+			mc->used = CURRTIME;
+
+		joined[njoined].cu = cu;
+		joined[njoined].flags = flags;
+		joined[njoined].secure = mc->flags & MC_SECURE || (recreated && n == first);
+		njoined++;
+	}
+
+	if (mc->chan == chan && njoined > 0)
+	{
+		cs_join_uninhabit(mc, chan);
+
+		for (i = 0; i < njoined; i++)
+			cs_join_modes(mc, joined[i].cu, joined[i].flags, joined[i].secure);
+
+		modestack_flush_channel(chan);
+	}
+
+	free(joined);
+
+	return pending && mc->chan == chan;
+}
+
+static void cs_server_eob(server_t *s)
+{
+	mowgli_node_t *n, *tn;
+	mychan_t *mc;
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, cs_burst_joins.head)
+	{
+		mc = n->data;
+
+		if (cs_join_burst(mc, s))
+			continue;
+
+		mc->flags &= ~MC_BURSTJOIN;
+		mowgli_node_delete(n, &cs_burst_joins);
+		mowgli_node_free(n);
+	}
+}
+
+static void cs_channel_drop(mychan_t *mc)
+{
+	mowgli_node_t *n;
+
+	if (!(mc->flags & MC_BURSTJOIN))
+		return;
+
+	n = mowgli_node_find(mc, &cs_burst_joins);
+	mowgli_node_delete(n, &cs_burst_joins);
+	mowgli_node_free(n);
+}
+
 static void cs_part(hook_channel_joinpart_t *hdata)
 {
 	chanuser_t *cu;
@@ -602,7 +803,7 @@ static void cs_part(hook_channel_joinpart_t *hdata)
 	mc = mychan_find(cu->chan->name);
 	if (mc == NULL)
 		return;
-	if (metadata_find(mc, "private:botserv:bot-assigned") != NULL)
+	if (metadata_find_key(mc, md_botassigned) != NULL)
 		return;
 
 	if (CURRTIME - mc->used >= 3600)
@@ -642,13 +843,59 @@ static void cs_part(hook_channel_joinpart_t *hdata)
 	part(cu->chan->name, chansvs.nick);
 }
 
+/* cs_part() for a whole netsplit, once per channel rather than per member */
+static void cs_users_split(hook_users_split_t *hdata)
+{
+	channel_t *c;
+	chanuser_t *cu;
+	mychan_t *mc;
+	mowgli_node_t *n;
+	unsigned int i, remaining;
+
+	for (i = 0; i < hdata->nchannels; i++)
+	{
+		c = hdata->channels[i];
+		mc = MYCHAN_FROM(c);
+		if (mc == NULL)
+			continue;
+		if (metadata_find_key(mc, md_botassigned) != NULL)
+			continue;
+
+		remaining = 0;
+		MOWGLI_ITER_FOREACH(n, c->members.head)
+		{
+			cu = n->data;
+			if (!(cu->user->flags & UF_SPLIT))
+				remaining++;
+			else if (CURRTIME - mc->used >= 3600)
+				if (chanacs_user_flags(mc, cu->user) & CA_USEDUPDATE)
+					mc->used = CURRTIME;
+		}
+
+		if (!config_options.leave_chans)
+			continue;
+
+		/* as in cs_part(), leave if at most we would be left */
+		if (remaining > 1)
+			continue;
+
+		if (mc->flags & MC_INHABIT)
+		{
+			slog(LG_DEBUG, "cs_users_split(): not leaving channel %s due to MC_INHABIT flag", mc->name);
+			continue;
+		}
+
+		part(c->name, chansvs.nick);
+	}
+}
+
 static user_t *get_changets_user(mychan_t *mc)
 {
 	metadata_t *md;
 
 	return_val_if_fail(mc != NULL, chansvs.me->me);
 
-	md = metadata_find(mc, "private:botserv:bot-assigned");
+	md = metadata_find_key(mc, md_botassigned);
 	if (md != NULL)
 	{
 		user_t *u = user_find(md->value);
@@ -670,7 +917,7 @@ static void cs_register(hook_channel_req_t *hdata)
 	{
 		if (mc->flags & MC_GUARD)
 			join(mc->name, chansvs.nick);
-		if (metadata_find(mc, "private:botserv:bot-assigned") != NULL)
+		if (metadata_find_key(mc, md_botassigned) != NULL)
 			return;
 
 		mlock_sts(mc->chan);
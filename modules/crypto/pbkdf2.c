@@ -26,66 +26,123 @@ DECLARE_MODULE_V1("crypto/pbkdf2", false, _modinit, _moddeinit, PACKAGE_VERSION,
 
 #include <openssl/evp.h>
 #include <openssl/sha.h>
-#include <openssl/hmac.h>
 
 #define ROUNDS		(128000)
 #define SALTLEN		(16)
 
 /* This is an implementation of PKCS#5 v2.0 password based encryption key
- * derivation function PBKDF2.
- * SHA1 version verified against test vectors posted by Peter Gutmann
- * <pgut001@cs.auckland.ac.nz> to the PKCS-TNG <pkcs-tng@rsa.com> mailing list.
+ * derivation function PBKDF2 with HMAC-SHA512, giving the same output as
+ * OpenSSL's PKCS5_PBKDF2_HMAC().
+ *
+ * The HMAC key is the password, which stays the same for every round, so
+ * the SHA-512 contexts after its inner and outer padding blocks are computed
+ * once and copied for every message, instead of hashing the padding again
+ * each time.  This goes through EVP only: the low-level SHA512_* calls that
+ * could run the compression function on a saved state directly are
+ * deprecated in OpenSSL 3.0, and copying a keyed EVP context costs little
+ * next to the two blocks hashed after it.
  */
-int PKCS5_PBKDF2_HMAC(const char *pass, int passlen,
-			   const unsigned char *salt, int saltlen, int iter,
-			   const EVP_MD *digest,
-			   int keylen, unsigned char *out)
+typedef struct {
+	EVP_MD_CTX *inner;
+	EVP_MD_CTX *outer;
+	EVP_MD_CTX *ctx;
+} pbkdf2_hmac_t;
+
+static void pbkdf2_hmac_free(pbkdf2_hmac_t *hmac)
+{
+	EVP_MD_CTX_free(hmac->inner);
+	EVP_MD_CTX_free(hmac->outer);
+	EVP_MD_CTX_free(hmac->ctx);
+}
+
+static bool pbkdf2_hmac_init(pbkdf2_hmac_t *hmac, const unsigned char *key, size_t keylen)
 {
-	unsigned char digtmp[EVP_MAX_MD_SIZE], *p, itmp[4];
-	int cplen, j, k, tkeylen, mdlen;
-	unsigned long i = 1;
-	HMAC_CTX hctx;
-
-	mdlen = EVP_MD_size(digest);
-
-	HMAC_CTX_init(&hctx);
-	p = out;
-	tkeylen = keylen;
-	if(!pass)
-		passlen = 0;
-	else if(passlen == -1)
-		passlen = strlen(pass);
-	while(tkeylen)
+	unsigned char k[SHA512_CBLOCK], pad[SHA512_CBLOCK];
+	size_t i;
+	bool ok;
+
+	hmac->inner = EVP_MD_CTX_new();
+	hmac->outer = EVP_MD_CTX_new();
+	hmac->ctx = EVP_MD_CTX_new();
+	if (hmac->inner == NULL || hmac->outer == NULL || hmac->ctx == NULL)
+		return false;
+
+	memset(k, 0, sizeof k);
+	if (keylen > sizeof k)
+		SHA512(key, keylen, k);
+	else
+		memcpy(k, key, keylen);
+
+	for (i = 0; i < sizeof pad; i++)
+		pad[i] = k[i] ^ 0x36;
+	ok = EVP_DigestInit_ex(hmac->inner, EVP_sha512(), NULL) &&
+		EVP_DigestUpdate(hmac->inner, pad, sizeof pad);
+
+	for (i = 0; i < sizeof pad; i++)
+		pad[i] = k[i] ^ 0x5c;
+	ok = ok && EVP_DigestInit_ex(hmac->outer, EVP_sha512(), NULL) &&
+		EVP_DigestUpdate(hmac->outer, pad, sizeof pad);
+
+	memset(k, 0, sizeof k);
+	memset(pad, 0, sizeof pad);
+
+	return ok;
+}
+
+/* HMAC of msg (or of msg || counter, for the first round of a block) into out */
+static bool pbkdf2_hmac(pbkdf2_hmac_t *hmac, const unsigned char *msg, size_t msglen,
+			const unsigned char *counter, unsigned char out[SHA512_DIGEST_LENGTH])
+{
+	return EVP_MD_CTX_copy_ex(hmac->ctx, hmac->inner) &&
+		EVP_DigestUpdate(hmac->ctx, msg, msglen) &&
+		(counter == NULL || EVP_DigestUpdate(hmac->ctx, counter, 4)) &&
+		EVP_DigestFinal_ex(hmac->ctx, out, NULL) &&
+		EVP_MD_CTX_copy_ex(hmac->ctx, hmac->outer) &&
+		EVP_DigestUpdate(hmac->ctx, out, SHA512_DIGEST_LENGTH) &&
+		EVP_DigestFinal_ex(hmac->ctx, out, NULL);
+}
+
+static bool pbkdf2_sha512(const char *pass, size_t passlen, const unsigned char *salt, size_t saltlen,
+			  unsigned int rounds, unsigned char *out, size_t outlen)
+{
+	pbkdf2_hmac_t hmac;
+	unsigned char u[SHA512_DIGEST_LENGTH], acc[SHA512_DIGEST_LENGTH], counter[4];
+	unsigned long blockno;
+	unsigned int round;
+	size_t i, cplen;
+	bool ok;
+
+	ok = pbkdf2_hmac_init(&hmac, (const unsigned char *)pass, passlen);
+
+	for (blockno = 1; ok && outlen > 0; blockno++)
 	{
-		if(tkeylen > mdlen)
-			cplen = mdlen;
-		else
-			cplen = tkeylen;
-		/* We are unlikely to ever use more than 256 blocks (5120 bits!)
-		 * but just in case...
-		 */
-		itmp[0] = (unsigned char)((i >> 24) & 0xff);
-		itmp[1] = (unsigned char)((i >> 16) & 0xff);
-		itmp[2] = (unsigned char)((i >> 8) & 0xff);
-		itmp[3] = (unsigned char)(i & 0xff);
-		HMAC_Init_ex(&hctx, pass, passlen, digest, NULL);
-		HMAC_Update(&hctx, salt, saltlen);
-		HMAC_Update(&hctx, itmp, 4);
-		HMAC_Final(&hctx, digtmp, NULL);
-		memcpy(p, digtmp, cplen);
-		for(j = 1; j < iter; j++)
+		counter[0] = (blockno >> 24) & 0xff;
+		counter[1] = (blockno >> 16) & 0xff;
+		counter[2] = (blockno >> 8) & 0xff;
+		counter[3] = blockno & 0xff;
+
+		ok = pbkdf2_hmac(&hmac, salt, saltlen, counter, u);
+		memcpy(acc, u, sizeof acc);
+
+		for (round = 1; ok && round < rounds; round++)
 		{
-			HMAC(digest, pass, passlen,
-				 digtmp, mdlen, digtmp, NULL);
-			for(k = 0; k < cplen; k++)
-				p[k] ^= digtmp[k];
+			ok = pbkdf2_hmac(&hmac, u, sizeof u, NULL, u);
+
+			for (i = 0; i < sizeof acc; i++)
+				acc[i] ^= u[i];
 		}
-		tkeylen-= cplen;
-		i++;
-		p+= cplen;
+
+		cplen = outlen < sizeof acc ? outlen : sizeof acc;
+		memcpy(out, acc, cplen);
+		out += cplen;
+		outlen -= cplen;
 	}
-	HMAC_CTX_cleanup(&hctx);
-	return 1;
+
+	pbkdf2_hmac_free(&hmac);
+	memset(u, 0, sizeof u);
+	memset(acc, 0, sizeof acc);
+
+	return ok;
 }
 
 /*******************************************************************************************/
@@ -102,21 +159,39 @@ static const char *pbkdf2_salt(void)
 	return buf;
 }
 
+/* safe to call from the crypto worker threads: no static buffers, no random salt */
+static bool pbkdf2_crypt_r(const char *key, const char *salt, char *buf, size_t buflen)
+{
+	unsigned char digestbuf[SHA512_DIGEST_LENGTH];
+	int iter;
+
+	if (strlen(salt) < SALTLEN || buflen < SALTLEN + 2 * SHA512_DIGEST_LENGTH + 1)
+		return false;
+
+	memcpy(buf, salt, SALTLEN);
+
+	if (!pbkdf2_sha512(key, strlen(key), (const unsigned char *)salt, SALTLEN, ROUNDS, digestbuf, sizeof digestbuf))
+		return false;
+
+	for (iter = 0; iter < SHA512_DIGEST_LENGTH; iter++)
+		sprintf(buf + SALTLEN + (iter * 2), "%02x", 255 & digestbuf[iter]);
+
+	return true;
+}
+
 static const char *pbkdf2_crypt(const char *key, const char *salt)
 {
 	static char outbuf[PASSLEN];
-	static unsigned char digestbuf[SHA512_DIGEST_LENGTH];
-	int res, iter;
 
 	if (strlen(salt) < SALTLEN)
 		salt = pbkdf2_salt();
 
-	memcpy(outbuf, salt, SALTLEN);
-
-	res = PKCS5_PBKDF2_HMAC(key, strlen(key), (const unsigned char *)salt, SALTLEN, ROUNDS, EVP_sha512(), SHA512_DIGEST_LENGTH, digestbuf);
-
-	for (iter = 0; iter < SHA512_DIGEST_LENGTH; iter++)
-		sprintf(outbuf + SALTLEN + (iter * 2), "%02x", 255 & digestbuf[iter]);
+	/* an empty hash never matches anything */
+	if (!pbkdf2_crypt_r(key, salt, outbuf, sizeof outbuf))
+	{
+		slog(LG_ERROR, "pbkdf2_crypt(): hashing failed");
+		*outbuf = '\0';
+	}
 
 	return outbuf;
 }
@@ -124,7 +199,8 @@ static const char *pbkdf2_crypt(const char *key, const char *salt)
 static crypt_impl_t pbkdf2_crypt_impl = {
 	.id = "pbkdf2",
 	.crypt = &pbkdf2_crypt,
-	.salt = &pbkdf2_salt
+	.salt = &pbkdf2_salt,
+	.crypt_r = &pbkdf2_crypt_r
 };
 
 void _modinit(module_t *m)
@@ -73,6 +73,7 @@ mygroup_t *mygroup_add_id(const char *id, const char *name)
 
 	mg = mowgli_heap_alloc(mygroup_heap);
 	object_init(object(mg), NULL, (destructor_t) mygroup_delete);
+	object(mg)->mdtype = 'G';
 
 	entity(mg)->type = ENT_GROUP;
 
@@ -23,11 +23,14 @@ static void ns_cmd_freeze(sourceinfo_t *si, int parc, char *parv[]);
 /* FREEZE ON|OFF -- don't pollute the root with THAW */
 command_t ns_freeze = { "FREEZE", N_("Freezes an account."), PRIV_USER_ADMIN, 3, ns_cmd_freeze, { .path = "nickserv/freeze" } };
 
+/* LIST FROZEN checks these for every account */
+static metadata_key_t *md_freezer, *md_freezereason;
+
 static bool is_frozen(const mynick_t *mn, const void *arg)
 {
 	myuser_t *mu = mn->owner;
 
-	return !!metadata_find(mu, "private:freeze:freezer");
+	return !!metadata_find_key(mu, md_freezer);
 }
 
 static bool frozen_match(const mynick_t *mn, const void *arg)
@@ -36,7 +39,7 @@ static bool frozen_match(const mynick_t *mn, const void *arg)
 	metadata_t *mdfrozen;
 
 	myuser_t *mu = mn->owner;
-	mdfrozen = metadata_find(mu, "private:freeze:reason");
+	mdfrozen = metadata_find_key(mu, md_freezereason);
 
 	if (mdfrozen != NULL && !match(frozenpattern, mdfrozen->value))
 		return true;
@@ -46,6 +49,9 @@ static bool frozen_match(const mynick_t *mn, const void *arg)
 
 void _modinit(module_t *m)
 {
+	md_freezer = metadata_key_register("private:freeze:freezer");
+	md_freezereason = metadata_key_register("private:freeze:reason");
+
 	service_named_bind_command("nickserv", &ns_freeze);
 
 	use_nslist_main_symbols(m);
@@ -25,6 +25,7 @@ DECLARE_MODULE_V1
 );
 
 static void ns_cmd_login(sourceinfo_t *si, int parc, char *parv[]);
+static void ns_login_verified(password_req_t *req, bool ok);
 
 #ifdef NICKSERV_LOGIN
 command_t ns_login = { "LOGIN", N_("Authenticates to a services account."), AC_NONE, 2, ns_cmd_login, { .path = "nickserv/login" } };
@@ -43,6 +44,8 @@ void _modinit(module_t *m)
 
 void _moddeinit(module_unload_intent_t intent)
 {
+	password_req_cancel_all(ns_login_verified);
+
 #ifdef NICKSERV_LOGIN
 	service_named_unbind_command("nickserv", &ns_login);
 #else
@@ -54,10 +57,8 @@ static void ns_cmd_login(sourceinfo_t *si, int parc, char *parv[])
 {
 	user_t *u = si->su;
 	myuser_t *mu;
-	mowgli_node_t *n, *tn;
 	const char *target = parv[0];
 	const char *password = parv[1];
-	char lau[BUFSIZE];
 
 	if (si->su == NULL)
 	{
@@ -107,8 +108,40 @@ static void ns_cmd_login(sourceinfo_t *si, int parc, char *parv[])
 		return;
 	}
 
-	if (verify_password(mu, password))
+	/* the rest happens once the password has been checked */
+	verify_password_async(si, mu, password, ns_login_verified, NULL);
+}
+
+static void ns_login_verified(password_req_t *req, bool ok)
+{
+	sourceinfo_t *si = req->si;
+	myuser_t *mu = req->mu;
+	user_t *u;
+	mowgli_node_t *n, *tn;
+	char lau[BUFSIZE];
+
+	/* the user quit or the account was dropped while we were waiting */
+	if (si == NULL || mu == NULL)
+		return;
+
+	u = si->su;
+
+	if (ok)
 	{
+		/* things may have changed while we were waiting */
+		if (u->myuser == mu)
+		{
+			command_fail(si, fault_nochange, _("You are already logged in as \2%s\2."), entity(u->myuser)->name);
+			return;
+		}
+
+		if (metadata_find(mu, "private:freeze:freezer"))
+		{
+			command_fail(si, fault_authfail, nicksvs.no_nick_ownership ? "You cannot login as \2%s\2 because the account has been frozen." : "You cannot identify to \2%s\2 because the nickname has been frozen.", entity(mu)->name);
+			logcommand(si, CMDLOG_LOGIN, "failed " COMMAND_UC " to \2%s\2 (frozen)", entity(mu)->name);
+			return;
+		}
+
 		if (MOWGLI_LIST_LENGTH(&mu->logins) >= me.maxlogins)
 		{
 			command_fail(si, fault_toomany, _("There are already \2%zu\2 sessions logged in to \2%s\2 (maximum allowed: %u)."), MOWGLI_LIST_LENGTH(&mu->logins), entity(mu)->name, me.maxlogins);
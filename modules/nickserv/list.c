@@ -19,6 +19,7 @@ DECLARE_MODULE_V1
 
 static void ns_cmd_list(sourceinfo_t *si, int parc, char *parv[]);
 static mowgli_patricia_t *list_params;
+static metadata_key_t *md_hostactual, *md_hostvhost, *md_freezer;
 
 command_t ns_list = { "LIST", N_("Lists nicknames registered matching a given pattern."), PRIV_USER_AUSPEX, 10, ns_cmd_list, { .path = "nickserv/list" } };
 
@@ -78,10 +79,10 @@ static bool pattern_match(const mynick_t *mn, const void *arg)
 	if (hostpattern)
 	{
 		hostmatch = false;
-		md = metadata_find(mu, "private:host:actual");
+		md = metadata_find_key(mu, md_hostactual);
 		if (md != NULL && !match(hostpattern, md->value))
 			hostmatch = true;
-		md = metadata_find(mu, "private:host:vhost");
+		md = metadata_find_key(mu, md_hostvhost);
 		if (md != NULL && !match(hostpattern, md->value))
 			hostmatch = true;
 		if (!hostmatch)
@@ -108,6 +109,9 @@ static bool has_waitauth(const mynick_t *mn, const void *arg) {
 void _modinit(module_t *m)
 {
 	list_params = mowgli_patricia_create(strcasecanon);
+	md_hostactual = metadata_key_register("private:host:actual");
+	md_hostvhost = metadata_key_register("private:host:vhost");
+	md_freezer = metadata_key_register("private:freeze:freezer");
 	service_named_bind_command("nickserv", &ns_list);
 
 	/* list email */
@@ -208,7 +212,7 @@ static void list_one(sourceinfo_t *si, myuser_t *mu, mynick_t *mn)
 		mu = mn->owner;
 
 	*buf = '\0';
-	if (metadata_find(mu, "private:freeze:freezer")) {
+	if (metadata_find_key(mu, md_freezer)) {
 		if (*buf)
 			mowgli_strlcat(buf, " ", BUFSIZE);
 
@@ -43,6 +43,7 @@ static void ns_cmd_register(sourceinfo_t *si, int parc, char *parv[])
 	char lau[BUFSIZE], lao[BUFSIZE];
 	hook_user_register_check_t hdata;
 	hook_user_req_t req;
+	bool hashed;
 
 	if (si->smu)
 	{
@@ -158,7 +159,13 @@ static void ns_cmd_register(sourceinfo_t *si, int parc, char *parv[])
 		return;
 	}
 
-	mu = myuser_add(account, auth_module_loaded ? "*" : pass, email, config_options.defuflags | MU_NOBURSTLOGIN | (auth_module_loaded ? MU_CRYPTPASS : 0));
+	/* with a crypto module, the password is hashed in the background and
+	 * nothing can log in to the account until then
+	 */
+	hashed = auth_module_loaded || crypto_module_loaded;
+	mu = myuser_add(account, hashed ? "*" : pass, email, config_options.defuflags | MU_NOBURSTLOGIN | (hashed ? MU_CRYPTPASS : 0));
+	if (!auth_module_loaded && crypto_module_loaded)
+		set_password_async(si, mu, pass, NULL, NULL);
 	mu->registered = CURRTIME;
 	mu->lastlogin = CURRTIME;
 	if (!nicksvs.no_nick_ownership)
@@ -20,6 +20,7 @@ DECLARE_MODULE_V1
 mowgli_patricia_t **ns_set_cmdtree;
 
 static void ns_cmd_set_password(sourceinfo_t *si, int parc, char *parv[]);
+static void ns_set_password_done(password_req_t *req, bool ok);
 
 command_t ns_set_password = { "PASSWORD", N_("Changes the password associated with your account."), AC_NONE, 1, ns_cmd_set_password, { .path = "nickserv/set_password" } };
 
@@ -32,6 +33,7 @@ void _modinit(module_t *m)
 
 void _moddeinit(module_unload_intent_t intent)
 {
+	password_req_cancel_all(ns_set_password_done);
 	command_delete(&ns_set_password, *ns_set_cmdtree);
 }
 
@@ -68,11 +70,16 @@ static void ns_cmd_set_password(sourceinfo_t *si, int parc, char *parv[])
 
 	logcommand(si, CMDLOG_SET, "SET:PASSWORD");
 
-	set_password(si->smu, password);
+	set_password_async(si, si->smu, password, ns_set_password_done, NULL);
+}
 
-	command_success_nodata(si, _("The password for \2%s\2 has been changed to \2%s\2."), entity(si->smu)->name, password);
+static void ns_set_password_done(password_req_t *req, bool ok)
+{
+	/* the user quit or the account was dropped while we were hashing */
+	if (req->si == NULL || req->mu == NULL)
+		return;
 
-	return;
+	command_success_nodata(req->si, _("The password for \2%s\2 has been changed to \2%s\2."), entity(req->mu)->name, req->password);
 }
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
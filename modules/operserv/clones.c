@@ -57,6 +57,7 @@ typedef struct cexcept_ cexcept_t;
 struct cexcept_
 {
 	char *ip;
+	cidr_mask_t mask;	/* ip, if it is an address/bits mask */
 	int allowed;
 	int warn;
 	char *reason;
@@ -294,6 +295,7 @@ static void db_h_ex(database_handle_t *db, const char *type)
 
 	cexcept_t *c = (cexcept_t *)smalloc(sizeof(cexcept_t));
 	c->ip = sstrdup(ip);
+	cidr_parse_mask(c->ip, &c->mask);
 	c->allowed = allowed;
 	c->warn = warn;
 	c->expires = expires;
@@ -301,7 +303,7 @@ static void db_h_ex(database_handle_t *db, const char *type)
 	mowgli_node_add(c, mowgli_node_create(), &clone_exempts);
 }
 
-static cexcept_t * find_exempt(const char *ip)
+static cexcept_t * find_exempt(const char *ip, const cidr_addr_t *addr)
 {
 	mowgli_node_t *n;
 
@@ -319,7 +321,7 @@ static cexcept_t * find_exempt(const char *ip)
 	{
 		cexcept_t *c = n->data;
 
-		if (!match_ips(c->ip, ip))
+		if (cidr_match(&c->mask, addr))
 			return c;
 	}
 
@@ -420,7 +422,11 @@ static void os_cmd_clones_list(sourceinfo_t *si, int parc, char *parv[])
 
 		if (k > 3)
 		{
-			cexcept_t *c = find_exempt(he->ip);
+			cidr_addr_t addr;
+			cexcept_t *c;
+
+			cidr_parse_addr(he->ip, &addr);
+			c = find_exempt(he->ip, &addr);
 			if (c)
 				command_success_nodata(si, _("%d from %s (\2EXEMPT\2; allowed %d)"), k, he->ip, c->allowed);
 			else
@@ -554,6 +560,7 @@ static void os_cmd_clones_addexempt(sourceinfo_t *si, int parc, char *parv[])
 
 		c = smalloc(sizeof(cexcept_t));
 		c->ip = sstrdup(ip);
+		cidr_parse_mask(c->ip, &c->mask);
 		c->reason = sstrdup(rreason);
 		mowgli_node_add(c, mowgli_node_create(), &clone_exempts);
 		command_success_nodata(si, _("Added \2%s\2 to clone exempt list."), ip);
@@ -861,7 +868,7 @@ static void clones_newuser(hook_user_nick_t *data)
 	mowgli_node_add(u, mowgli_node_create(), &he->clients);
 	i = MOWGLI_LIST_LENGTH(&he->clients);
 
-	cexcept_t *c = find_exempt(u->ip);
+	cexcept_t *c = find_exempt(u->ip, &u->ipaddr);
 	if (c == 0)
 	{
 		allowed = clones_allowed;
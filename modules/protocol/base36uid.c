@@ -87,9 +87,75 @@ static const char *base36_uid_get(void)
 	return (new_uid);
 }
 
+/* value of a character in a P10 numeric, or -1 */
+static int p10_digit(char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A';
+	if (c >= 'a' && c <= 'z')
+		return c - 'a' + 26;
+	if (c >= '0' && c <= '9')
+		return c - '0' + 52;
+	if (c == '[')
+		return 62;
+	if (c == ']')
+		return 63;
+
+	return -1;
+}
+
+/* value of a character in a TS6 SID or UID, or -1 */
+static int ts6_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+/*
+ * The length goes in the low bits so that IDs differing only in leading
+ * zeroes stay apart; ten base 64 digits and four bits still fit.
+ */
+static bool base36_uid_decode(const char *id, uint64_t *key)
+{
+	uint64_t v = 0;
+	unsigned int len;
+	int d;
+
+	for (len = 0; id[len] != '\0'; len++)
+	{
+		if (len == 10)
+			return false;
+
+		if (ircd->uses_p10)
+		{
+			if ((d = p10_digit(id[len])) < 0)
+				return false;
+			v = v * 64 + d;
+		}
+		else
+		{
+			if ((d = ts6_digit(id[len])) < 0)
+				return false;
+			v = v * 36 + d;
+		}
+	}
+
+	/* TS6 IDs start with a digit, which keeps nicks out */
+	if (len == 0 || (!ircd->uses_p10 && !IsDigit(*id)))
+		return false;
+
+	*key = v << 4 | len;
+	return true;
+}
+
 uid_provider_t base36_gen = {
 	.uid_init = base36_uid_init,
 	.uid_get = base36_uid_get,
+	.uid_decode = base36_uid_decode,
 };
 
 void _modinit(module_t *m)
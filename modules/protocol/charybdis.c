@@ -209,7 +209,7 @@ static mowgli_node_t *charybdis_next_matching_ban(channel_t *c, user_t *u, int t
 		if (p != NULL && p != strippedmask)
 			*p = 0;
 
-		if ((!match(strippedmask, hostbuf) || !match(strippedmask, realbuf) || !match(strippedmask, ipbuf) || !match_cidr(strippedmask, ipbuf)))
+		if ((!match(strippedmask, hostbuf) || !match(strippedmask, realbuf) || !match(strippedmask, ipbuf) || !match_cidr_addr(strippedmask, ipbuf, &u->ipaddr)))
 			return n;
 		if (strippedmask[0] == '$')
 		{
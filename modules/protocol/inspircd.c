@@ -138,7 +138,7 @@ static mowgli_node_t *inspircd_next_matching_ban(channel_t *c, user_t *u, int ty
 		if (cb->type != type)
 			continue;
 
-		if ((!match(cb->mask, hostbuf) || !match(cb->mask, realbuf) || !match(cb->mask, ipbuf)) || !match_cidr(cb->mask, ipbuf))
+		if ((!match(cb->mask, hostbuf) || !match(cb->mask, realbuf) || !match(cb->mask, ipbuf)) || !match_cidr_addr(cb->mask, ipbuf, &u->ipaddr))
 			return n;
 
 		if (cb->mask[1] == ':' && strchr("MRUjrm", cb->mask[0]))
@@ -172,7 +172,7 @@ static mowgli_node_t *inspircd_next_matching_ban(channel_t *c, user_t *u, int ty
 				matched = !match(p, u->gecos);
 				break;
 			case 'm':
-				matched = (!match(p, hostbuf) || !match(p, realbuf) || !match(p, ipbuf)) || !match_cidr(p, ipbuf);
+				matched = (!match(p, hostbuf) || !match(p, realbuf) || !match(p, ipbuf)) || !match_cidr_addr(p, ipbuf, &u->ipaddr);
 				break;
 			default:
 				continue;
@@ -328,7 +328,17 @@ static bool check_delaymsg(const char *value, channel_t *c, mychan_t *mc, user_t
 
 static void inspircd_send_fjoin(channel_t *c, user_t *u, char *modes)
 {
-	sts(":%s FJOIN %s %lu %s :o,%s", me.numeric, c->name, (unsigned long)c->ts, modes, u->uid);
+	stsline_t l;
+
+	stsline_init(&l);
+	stsline_source(&l, me.numeric);
+	stsline_add(&l, "FJOIN");
+	stsline_add(&l, c->name);
+	stsline_add_uint(&l, (unsigned long)c->ts);
+	stsline_add(&l, modes);
+	stsline_text(&l, "o,");
+	stsline_cat(&l, u->uid);
+	stsline_send(&l);
 }
 
 /* login to our uplink */
@@ -366,8 +376,29 @@ static void inspircd_introduce_nick(user_t *u)
 {
 	/* :penguin.omega.org.za UID 497AAAAAB 1188302517 OperServ 127.0.0.1 127.0.0.1 OperServ +s 127.0.0.1 :Operator Server */
 	const char *umode = user_get_umodestr(u);
+	stsline_t l;
+
+	stsline_init(&l);
+	stsline_source(&l, me.numeric);
+	stsline_add(&l, "UID");
+	stsline_add(&l, u->uid);
+	stsline_add_uint(&l, (unsigned long)u->ts);
+	stsline_add(&l, u->nick);
+	stsline_add(&l, u->host);
+	stsline_add(&l, u->host);
+	stsline_add(&l, u->user);
+	stsline_add(&l, "0.0.0.0");
+	stsline_add_uint(&l, (unsigned long)u->ts);
+	stsline_add(&l, umode);
+	if (has_hideopermod)
+		stsline_cat(&l, "H");
+	if (has_hidechansmod)
+		stsline_cat(&l, "I");
+	if (has_servprotectmod)
+		stsline_cat(&l, "k");
+	stsline_text(&l, u->gecos);
+	stsline_send(&l);
 
-	sts(":%s UID %s %lu %s %s %s %s 0.0.0.0 %lu %s%s%s%s :%s", me.numeric, u->uid, (unsigned long)u->ts, u->nick, u->host, u->host, u->user, (unsigned long)u->ts, umode, has_hideopermod ? "H" : "", has_hidechansmod ? "I" : "", has_servprotectmod ? "k" : "", u->gecos);
 	if (is_ircop(u) && !has_servprotectmod)
 		sts(":%s OPERTYPE Service", u->uid);
 }
@@ -406,7 +437,15 @@ static void inspircd_chan_lowerts(channel_t *c, user_t *u)
 /* kicks a user from a channel */
 static void inspircd_kick(user_t *source, channel_t *c, user_t *u, const char *reason)
 {
-	sts(":%s KICK %s %s :%s", source->uid, c->name, u->uid, reason);
+	stsline_t l;
+
+	stsline_init(&l);
+	stsline_source(&l, source->uid);
+	stsline_add(&l, "KICK");
+	stsline_add(&l, c->name);
+	stsline_add(&l, u->uid);
+	stsline_text(&l, reason);
+	stsline_send(&l);
 
 	chanuser_delete(c, u);
 }
@@ -434,7 +473,14 @@ static void inspircd_msg_global_sts(user_t *from, const char *mask, const char *
 /* NOTICE wrapper */
 static void inspircd_notice_user_sts(user_t *from, user_t *target, const char *text)
 {
-	sts(":%s NOTICE %s :%s", from ? from->uid : me.numeric, target->uid, text);
+	stsline_t l;
+
+	stsline_init(&l);
+	stsline_source(&l, from ? from->uid : me.numeric);
+	stsline_add(&l, "NOTICE");
+	stsline_add(&l, target->uid);
+	stsline_text(&l, text);
+	stsline_send(&l);
 }
 
 static void inspircd_notice_global_sts(user_t *from, const char *mask, const char *text)
@@ -566,6 +612,7 @@ static void inspircd_topic_sts(channel_t *c, user_t *source, const char *setter,
 static void inspircd_mode_sts(char *sender, channel_t *target, char *modes)
 {
 	user_t *sender_p;
+	stsline_t l;
 
 	return_if_fail(sender != NULL);
 	return_if_fail(target != NULL);
@@ -575,7 +622,13 @@ static void inspircd_mode_sts(char *sender, channel_t *target, char *modes)
 
 	return_if_fail(sender_p != NULL);
 
-	sts(":%s FMODE %s %lu %s", sender_p->uid, target->name, (unsigned long)target->ts, modes);
+	stsline_init(&l);
+	stsline_source(&l, sender_p->uid);
+	stsline_add(&l, "FMODE");
+	stsline_add(&l, target->name);
+	stsline_add_uint(&l, (unsigned long)target->ts);
+	stsline_add(&l, modes);
+	stsline_send(&l);
 }
 
 /* ping wrapper */
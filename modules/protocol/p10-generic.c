@@ -41,8 +41,22 @@ static unsigned int p10_server_login(void)
 static void p10_introduce_nick(user_t *u)
 {
 	const char *umode = user_get_umodestr(u);
-
-	sts("%s N %s 1 %lu %s %s %sk ]]]]]] %s :%s", me.numeric, u->nick, (unsigned long)u->ts, u->user, u->host, umode, u->uid, u->gecos);
+	stsline_t l;
+
+	stsline_init(&l);
+	stsline_add(&l, me.numeric);
+	stsline_add(&l, "N");
+	stsline_add(&l, u->nick);
+	stsline_add(&l, "1");
+	stsline_add_uint(&l, (unsigned long)u->ts);
+	stsline_add(&l, u->user);
+	stsline_add(&l, u->host);
+	stsline_add(&l, umode);
+	stsline_cat(&l, "k");
+	stsline_add(&l, "]]]]]]");
+	stsline_add(&l, u->uid);
+	stsline_text(&l, u->gecos);
+	stsline_send(&l);
 }
 
 /* invite a user to a channel */
@@ -66,18 +80,31 @@ static void p10_wallops_sts(const char *text)
 /* join a channel */
 static void p10_join_sts(channel_t *c, user_t *u, bool isnew, char *modes)
 {
+	stsline_t l;
+
 	/* If the channel doesn't exist, we need to create it. */
+	stsline_init(&l);
+	stsline_add(&l, u->uid);
+	stsline_add(&l, isnew ? "C" : "J");
+	stsline_add(&l, c->name);
+	stsline_add_uint(&l, (unsigned long)c->ts);
+	stsline_send(&l);
+
+	if (isnew && !(modes[0] && modes[1]))
+		return;
+
+	stsline_init(&l);
+	stsline_add(&l, isnew ? u->uid : me.numeric);
+	stsline_add(&l, "M");
+	stsline_add(&l, c->name);
 	if (isnew)
-	{
-		sts("%s C %s %lu", u->uid, c->name, (unsigned long)c->ts);
-		if (modes[0] && modes[1])
-			sts("%s M %s %s", u->uid, c->name, modes);
-	}
+		stsline_add(&l, modes);
 	else
 	{
-		sts("%s J %s %lu", u->uid, c->name, (unsigned long)c->ts);
-		sts("%s M %s +o %s", me.numeric, c->name, u->uid);
+		stsline_add(&l, "+o");
+		stsline_add(&l, u->uid);
 	}
+	stsline_send(&l);
 }
 
 static void p10_chan_lowerts(channel_t *c, user_t *u)
@@ -92,10 +119,15 @@ static void p10_chan_lowerts(channel_t *c, user_t *u)
 /* kicks a user from a channel */
 static void p10_kick(user_t *source, channel_t *c, user_t *u, const char *reason)
 {
-	if (chanuser_find(c, source))
-		sts("%s K %s %s :%s", source->uid, c->name, u->uid, reason);
-	else
-		sts("%s K %s %s :%s", me.numeric, c->name, u->uid, reason);
+	stsline_t l;
+
+	stsline_init(&l);
+	stsline_add(&l, chanuser_find(c, source) ? source->uid : me.numeric);
+	stsline_add(&l, "K");
+	stsline_add(&l, c->name);
+	stsline_add(&l, u->uid);
+	stsline_text(&l, reason);
+	stsline_send(&l);
 
 	chanuser_delete(c, u);
 }
@@ -137,7 +169,14 @@ static void p10_msg_global_sts(user_t *from, const char *mask, const char *text)
 /* NOTICE wrapper */
 static void p10_notice_user_sts(user_t *from, user_t *target, const char *text)
 {
-	sts("%s O %s :%s", from ? from->uid : me.numeric, target->uid, text);
+	stsline_t l;
+
+	stsline_init(&l);
+	stsline_add(&l, from ? from->uid : me.numeric);
+	stsline_add(&l, "O");
+	stsline_add(&l, target->uid);
+	stsline_text(&l, text);
+	stsline_send(&l);
 }
 
 static void p10_notice_global_sts(user_t *from, const char *mask, const char *text)
@@ -264,6 +303,7 @@ static void p10_topic_sts(channel_t *c, user_t *source, const char *setter, time
 static void p10_mode_sts(char *sender, channel_t *target, char *modes)
 {
 	user_t *fptr;
+	stsline_t l;
 
 	return_if_fail(sender != NULL);
 	return_if_fail(target != NULL);
@@ -273,10 +313,12 @@ static void p10_mode_sts(char *sender, channel_t *target, char *modes)
 
 	return_if_fail(fptr != NULL);
 
-	if (chanuser_find(target, fptr))
-		sts("%s M %s %s", fptr->uid, target->name, modes);
-	else
-		sts("%s M %s %s", me.numeric, target->name, modes);
+	stsline_init(&l);
+	stsline_add(&l, chanuser_find(target, fptr) ? fptr->uid : me.numeric);
+	stsline_add(&l, "M");
+	stsline_add(&l, target->name);
+	stsline_add(&l, modes);
+	stsline_send(&l);
 }
 
 /* ping wrapper */
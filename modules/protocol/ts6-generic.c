@@ -99,13 +99,37 @@ static unsigned int ts6_server_login(void)
 static void ts6_introduce_nick(user_t *u)
 {
 	const char *umode = user_get_umodestr(u);
+	stsline_t l;
 
-	if (ircd->uses_uid && use_euid)
-		sts(":%s EUID %s 1 %lu %s %s %s 0 %s * * :%s", me.numeric, u->nick, (unsigned long)u->ts, umode, u->user, u->host, u->uid, u->gecos);
-	else if (ircd->uses_uid)
-		sts(":%s UID %s 1 %lu %s %s %s 0 %s :%s", me.numeric, u->nick, (unsigned long)u->ts, umode, u->user, u->host, u->uid, u->gecos);
+	stsline_init(&l);
+
+	if (ircd->uses_uid)
+	{
+		stsline_source(&l, me.numeric);
+		stsline_add(&l, use_euid ? "EUID" : "UID");
+	}
+	else
+		stsline_add(&l, "NICK");
+
+	stsline_add(&l, u->nick);
+	stsline_add(&l, "1");
+	stsline_add_uint(&l, (unsigned long)u->ts);
+	stsline_add(&l, umode);
+	stsline_add(&l, u->user);
+	stsline_add(&l, u->host);
+
+	if (ircd->uses_uid)
+	{
+		stsline_add(&l, "0");
+		stsline_add(&l, u->uid);
+		if (use_euid)
+			stsline_add(&l, "* *");
+	}
 	else
-		sts("NICK %s 1 %lu %s %s %s %s :%s", u->nick, (unsigned long)u->ts, umode, u->user, u->host, me.name, u->gecos);
+		stsline_add(&l, me.name);
+
+	stsline_text(&l, u->gecos);
+	stsline_send(&l);
 }
 
 /* invite a user to a channel */
@@ -128,12 +152,17 @@ static void ts6_wallops_sts(const char *text)
 /* join a channel */
 static void ts6_join_sts(channel_t *c, user_t *u, bool isnew, char *modes)
 {
-	if (isnew)
-		sts(":%s SJOIN %lu %s %s :@%s", ME, (unsigned long)c->ts,
-				c->name, modes, CLIENT_NAME(u));
-	else
-		sts(":%s SJOIN %lu %s + :@%s", ME, (unsigned long)c->ts,
-				c->name, CLIENT_NAME(u));
+	stsline_t l;
+
+	stsline_init(&l);
+	stsline_source(&l, ME);
+	stsline_add(&l, "SJOIN");
+	stsline_add_uint(&l, (unsigned long)c->ts);
+	stsline_add(&l, c->name);
+	stsline_add(&l, isnew ? modes : "+");
+	stsline_text(&l, "@");
+	stsline_cat(&l, CLIENT_NAME(u));
+	stsline_send(&l);
 }
 
 static void ts6_chan_lowerts(channel_t *c, user_t *u)
@@ -149,10 +178,15 @@ static void ts6_chan_lowerts(channel_t *c, user_t *u)
 /* kicks a user from a channel */
 static void ts6_kick(user_t *source, channel_t *c, user_t *u, const char *reason)
 {
-	if (c->ts != 0 || chanuser_find(c, source))
-		sts(":%s KICK %s %s :%s", CLIENT_NAME(source), c->name, CLIENT_NAME(u), reason);
-	else
-		sts(":%s KICK %s %s :%s", ME, c->name, CLIENT_NAME(u), reason);
+	stsline_t l;
+
+	stsline_init(&l);
+	stsline_source(&l, c->ts != 0 || chanuser_find(c, source) ? CLIENT_NAME(source) : ME);
+	stsline_add(&l, "KICK");
+	stsline_add(&l, c->name);
+	stsline_add(&l, CLIENT_NAME(u));
+	stsline_text(&l, reason);
+	stsline_send(&l);
 
 	chanuser_delete(c, u);
 }
@@ -202,7 +236,14 @@ static void ts6_msg_global_sts(user_t *from, const char *mask, const char *text)
 /* NOTICE wrapper */
 static void ts6_notice_user_sts(user_t *from, user_t *target, const char *text)
 {
-	sts(":%s NOTICE %s :%s", from ? CLIENT_NAME(from) : ME, CLIENT_NAME(target), text);
+	stsline_t l;
+
+	stsline_init(&l);
+	stsline_source(&l, from ? CLIENT_NAME(from) : ME);
+	stsline_add(&l, "NOTICE");
+	stsline_add(&l, CLIENT_NAME(target));
+	stsline_text(&l, text);
+	stsline_send(&l);
 }
 
 static void ts6_notice_global_sts(user_t *from, const char *mask, const char *text)
@@ -384,6 +425,7 @@ static void ts6_topic_sts(channel_t *c, user_t *source, const char *setter, time
 static void ts6_mode_sts(char *sender, channel_t *target, char *modes)
 {
 	user_t *u;
+	stsline_t l;
 
 	return_if_fail(sender != NULL);
 	return_if_fail(target != NULL);
@@ -393,10 +435,18 @@ static void ts6_mode_sts(char *sender, channel_t *target, char *modes)
 
 	return_if_fail(u != NULL);
 
+	stsline_init(&l);
+	stsline_source(&l, CLIENT_NAME(u));
 	if (ircd->uses_uid)
-		sts(":%s TMODE %lu %s %s", CLIENT_NAME(u), (unsigned long)target->ts, target->name, modes);
+	{
+		stsline_add(&l, "TMODE");
+		stsline_add_uint(&l, (unsigned long)target->ts);
+	}
 	else
-		sts(":%s MODE %s %s", CLIENT_NAME(u), target->name, modes);
+		stsline_add(&l, "MODE");
+	stsline_add(&l, target->name);
+	stsline_add(&l, modes);
+	stsline_send(&l);
 }
 
 /* ping wrapper */
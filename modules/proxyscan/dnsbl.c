@@ -358,7 +358,7 @@ static void initiate_blacklist_dnsquery(struct Blacklist *blptr, user_t *u)
 {
 	struct BlacklistClient *blcptr = malloc(sizeof(struct BlacklistClient));
 	char buf[IRCD_RES_HOSTLEN + 1];
-	int ip[4];
+	const unsigned char *ip = u->ipaddr.addr;
 	mowgli_list_t *l;
 
 	blcptr->blacklist = blptr;
@@ -367,11 +367,8 @@ static void initiate_blacklist_dnsquery(struct Blacklist *blptr, user_t *u)
 	blcptr->dns_query.ptr = blcptr;
 	blcptr->dns_query.callback = blacklist_dns_callback;
 
-	/* A sscanf worked fine for chary for many years, it'll be fine here */
-	sscanf(u->ip, "%d.%d.%d.%d", &ip[3], &ip[2], &ip[1], &ip[0]);
-
 	/* becomes 2.0.0.127.torbl.ahbl.org or whatever */
-	snprintf(buf, sizeof buf, "%d.%d.%d.%d.%s", ip[0], ip[1], ip[2], ip[3], blptr->host);
+	snprintf(buf, sizeof buf, "%u.%u.%u.%u.%s", ip[3], ip[2], ip[1], ip[0], blptr->host);
 
 	gethost_byname_type(buf, &blcptr->dns_query, T_A);
 
@@ -414,6 +411,10 @@ static void lookup_blacklists(user_t *u)
 		if (u == NULL)
 			return;
 
+		/* only IPv4 addresses can be looked up, see initiate_blacklist_dnsquery() */
+		if (!u->ipaddr.valid || u->ipaddr.ip6)
+			return;
+
 		initiate_blacklist_dnsquery(blptr, u);
 	}
 }
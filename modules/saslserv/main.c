@@ -15,7 +15,19 @@ DECLARE_MODULE_V1
 	"Atheme Development Group <http://www.atheme.org>"
 );
 
-mowgli_list_t sessions;
+/*
+ * Sessions are found by UID, and expire on a wheel: each one sits in the
+ * slot that will be swept SASL_WHEEL_SLOTS - 1 ticks after it last made
+ * progress, so a sweep only looks at sessions that are actually stale.
+ */
+#define SASL_WHEEL_TICK		10
+#define SASL_WHEEL_SLOTS	7	/* idle sessions go after 50 to 60 seconds */
+
+static mowgli_patricia_t *sessions;
+static mowgli_heap_t *session_heap;
+static mowgli_list_t session_wheel[SASL_WHEEL_SLOTS];
+static unsigned int session_wheel_pos;
+
 static mowgli_list_t sasl_mechanisms;
 static char mechlist_string[400];
 
@@ -25,18 +37,21 @@ void destroy_session(sasl_session_t *p);
 static void sasl_logcommand(sasl_session_t *p, myuser_t *login, int level, const char *fmt, ...);
 static void sasl_input(sasl_message_t *smsg);
 static void sasl_packet(sasl_session_t *p, char *buf, int len);
+static void sasl_step_result(sasl_session_t *p, int rc, char *out, size_t out_len);
 static void sasl_write(char *target, char *data, int length);
 static bool may_impersonate(myuser_t *source_mu, myuser_t *target_mu);
 static myuser_t *login_user(sasl_session_t *p);
 static void sasl_newuser(hook_user_nick_t *data);
 static void sasl_server_eob(server_t *s);
+static void session_touch(sasl_session_t *p);
 static void delete_stale(void *vptr);
 static void sasl_mech_register(sasl_mechanism_t *mech);
 static void sasl_mech_unregister(sasl_mechanism_t *mech);
+static void sasl_mech_step_done(sasl_session_t *p, int rc);
 static void mechlist_build_string(char *ptr, size_t buflen);
 static void mechlist_do_rebuild();
 
-sasl_mech_register_func_t sasl_mech_register_funcs = { &sasl_mech_register, &sasl_mech_unregister };
+sasl_mech_register_func_t sasl_mech_register_funcs = { &sasl_mech_register, &sasl_mech_unregister, &sasl_mech_step_done };
 
 /* main services client routine */
 static void saslserv(sourceinfo_t *si, int parc, char *parv[])
@@ -94,14 +109,11 @@ static void sasl_mech_unregister(sasl_mechanism_t *mech)
 
 	slog(LG_DEBUG, "sasl_mech_unregister(): unregistering %s", mech->name);
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, sessions.head)
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, mech->sessions.head)
 	{
 		session = n->data;
-		if (session->mechptr == mech)
-		{
-			slog(LG_DEBUG, "sasl_mech_unregister(): destroying session %s", session->uid);
-			destroy_session(session);
-		}
+		slog(LG_DEBUG, "sasl_mech_unregister(): destroying session %s", session->uid);
+		destroy_session(session);
 	}
 
 	MOWGLI_ITER_FOREACH_SAFE(n, tn, sasl_mechanisms.head)
@@ -127,7 +139,10 @@ void _modinit(module_t *m)
 	hook_add_server_eob(sasl_server_eob);
 	hook_add_event("sasl_may_impersonate");
 
-	delete_stale_timer = mowgli_timer_add(base_eventloop, "sasl_delete_stale", delete_stale, NULL, 30);
+	sessions = mowgli_patricia_create(noopcanon);
+	session_heap = mowgli_heap_create(sizeof(sasl_session_t), 256, BH_NOW);
+
+	delete_stale_timer = mowgli_timer_add(base_eventloop, "sasl_delete_stale", delete_stale, NULL, SASL_WHEEL_TICK);
 
 	saslsvs = service_add("saslserv", saslserv);
 	authservice_loaded++;
@@ -135,7 +150,8 @@ void _modinit(module_t *m)
 
 void _moddeinit(module_unload_intent_t intent)
 {
-	mowgli_node_t *n, *tn;
+	mowgli_patricia_iteration_state_t state;
+	sasl_session_t *p;
 
 	hook_del_sasl_input(sasl_input);
 	hook_del_user_add(sasl_newuser);
@@ -148,13 +164,16 @@ void _moddeinit(module_unload_intent_t intent)
 
 	authservice_loaded--;
 
-	if (sessions.head != NULL)
+	if (mowgli_patricia_size(sessions) != 0)
 		slog(LG_DEBUG, "saslserv/main: shutting down with a non-empty session list, a mech did not unregister itself!");
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, sessions.head)
+	MOWGLI_PATRICIA_FOREACH(p, &state, sessions)
 	{
-		destroy_session(n->data);
+		destroy_session(p);
 	}
+
+	mowgli_patricia_destroy(sessions, NULL, NULL);
+	mowgli_heap_destroy(session_heap);
 }
 
 /*
@@ -164,45 +183,44 @@ void _moddeinit(module_unload_intent_t intent)
 /* find an existing session by uid */
 sasl_session_t *find_session(const char *uid)
 {
-	sasl_session_t *p;
-	mowgli_node_t *n;
-
 	if (uid == NULL)
 		return NULL;
 
-	MOWGLI_ITER_FOREACH(n, sessions.head)
-	{
-		p = n->data;
-		if(p->uid != NULL && !strcmp(p->uid, uid))
-			return p;
-	}
-
-	return NULL;
+	return mowgli_patricia_retrieve(sessions, uid);
 }
 
 /* create a new session if it does not already exist */
 sasl_session_t *make_session(const char *uid)
 {
 	sasl_session_t *p = find_session(uid);
-	mowgli_node_t *n;
 
 	if(p)
 		return p;
 
-	p = malloc(sizeof(sasl_session_t));
-	memset(p, 0, sizeof(sasl_session_t));
-	p->uid = strdup(uid);
+	p = mowgli_heap_alloc(session_heap);
+	p->uid = sstrdup(uid);
+
+	mowgli_patricia_add(sessions, p->uid, p);
 
-	n = mowgli_node_create();
-	mowgli_node_add(p, n, &sessions);
+	p->slot = SASL_WHEEL_SLOTS;
+	session_touch(p);
 
 	return p;
 }
 
+/* put a session back at the far end of the expiry wheel */
+static void session_touch(sasl_session_t *p)
+{
+	if (p->slot < SASL_WHEEL_SLOTS)
+		mowgli_node_delete(&p->wheelnode, &session_wheel[p->slot]);
+
+	p->slot = (session_wheel_pos + SASL_WHEEL_SLOTS - 1) % SASL_WHEEL_SLOTS;
+	mowgli_node_add(p, &p->wheelnode, &session_wheel[p->slot]);
+}
+
 /* free a session and all its contents */
 void destroy_session(sasl_session_t *p)
 {
-	mowgli_node_t *n, *tn;
 	myuser_t *mu;
 
 	if (p->flags & ASASL_NEED_LOG && p->username != NULL)
@@ -212,26 +230,23 @@ void destroy_session(sasl_session_t *p)
 			sasl_logcommand(p, mu, CMDLOG_LOGIN, "LOGIN (session timed out)");
 	}
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, sessions.head)
-	{
-		if(n->data == p)
-		{
-			mowgli_node_delete(n, &sessions);
-			mowgli_node_free(n);
-		}
-	}
+	mowgli_patricia_delete(sessions, p->uid);
+	mowgli_node_delete(&p->wheelnode, &session_wheel[p->slot]);
 
 	free(p->uid);
 	free(p->buf);
 	p->buf = p->p = NULL;
 	if(p->mechptr)
+	{
+		mowgli_node_delete(&p->mechnode, &p->mechptr->sessions);
 		p->mechptr->mech_finish(p); /* Free up any mechanism data */
+	}
 	p->mechptr = NULL; /* We're not freeing the mechanism, just "dereferencing" it */
 	free(p->username);
 	free(p->certfp);
 	free(p->authzid);
 
-	free(p);
+	mowgli_heap_free(session_heap, p);
 }
 
 /* interpret an AUTHENTICATE message */
@@ -252,6 +267,14 @@ static void sasl_input(sasl_message_t *smsg)
 	if(smsg->mode != 'S' && smsg->mode != 'C')
 		return;
 
+	/* the client may not say anything more until the mechanism has answered */
+	if(p->flags & ASASL_STEP_PENDING)
+	{
+		sasl_sts(p->uid, 'D', "F");
+		destroy_session(p);
+		return;
+	}
+
 	if(smsg->mode == 'S' && smsg->ext != NULL &&
 			!strcmp(smsg->buf, "EXTERNAL"))
 	{
@@ -355,11 +378,10 @@ static void sasl_packet(sasl_session_t *p, char *buf, int len)
 {
 	int rc;
 	size_t tlen = 0;
-	char *cloak, *out = NULL;
+	char *out = NULL;
 	char temp[BUFSIZE];
 	char mech[61];
 	size_t out_len = 0;
-	metadata_t *md;
 
 	/* First piece of data in a session is the name of
 	 * the SASL mechanism that will be used.
@@ -385,6 +407,8 @@ static void sasl_packet(sasl_session_t *p, char *buf, int len)
 			return;
 		}
 
+		mowgli_node_add(p, &p->mechnode, &p->mechptr->sessions);
+
 		rc = p->mechptr->mech_start(p, &out, &out_len);
 	}else{
 		if(len == 1 && *buf == '+')
@@ -397,10 +421,26 @@ static void sasl_packet(sasl_session_t *p, char *buf, int len)
 			rc = ASASL_FAIL;
 	}
 
+	sasl_step_result(p, rc, out, out_len);
+}
+
+/* act on what the mechanism made of the last message */
+static void sasl_step_result(sasl_session_t *p, int rc, char *out, size_t out_len)
+{
+	char *cloak;
+	char temp[BUFSIZE];
+	metadata_t *md;
+
 	/* Some progress has been made, reset timeout. */
-	p->flags &= ~ASASL_MARKED_FOR_DELETION;
+	session_touch(p);
 
-	if(rc == ASASL_DONE)
+	if(rc == ASASL_PENDING)
+	{
+		p->flags |= ASASL_STEP_PENDING;
+		free(out);
+		return;
+	}
+	else if(rc == ASASL_DONE)
 	{
 		myuser_t *mu = login_user(p);
 		if(mu)
@@ -446,6 +486,15 @@ static void sasl_packet(sasl_session_t *p, char *buf, int len)
 	destroy_session(p);
 }
 
+/* a mechanism that returned ASASL_PENDING reports back */
+static void sasl_mech_step_done(sasl_session_t *p, int rc)
+{
+	return_if_fail(p->flags & ASASL_STEP_PENDING);
+
+	p->flags &= ~ASASL_STEP_PENDING;
+	sasl_step_result(p, rc, NULL, 0);
+}
+
 /* output an arbitrary amount of data to the SASL client */
 static void sasl_write(char *target, char *data, int length)
 {
@@ -634,26 +683,19 @@ static void sasl_newuser(hook_user_nick_t *data)
 	logcommand_user(saslsvs, u, CMDLOG_LOGIN, "LOGIN");
 }
 
-/* This function is run approximately once every 30 seconds.
- * It looks for flagged sessions, and deletes them, while
- * flagging all the others. This way stale sessions are deleted
- * after no more than 60 seconds.
+/* This function is run every SASL_WHEEL_TICK seconds.
+ * It turns the wheel by one slot and deletes the sessions in it,
+ * which have not made any progress for SASL_WHEEL_SLOTS - 1 ticks.
  */
 static void delete_stale(void *vptr)
 {
-	sasl_session_t *p;
 	mowgli_node_t *n, *tn;
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, sessions.head)
+	session_wheel_pos = (session_wheel_pos + 1) % SASL_WHEEL_SLOTS;
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, session_wheel[session_wheel_pos].head)
 	{
-		p = n->data;
-		if(p->flags & ASASL_MARKED_FOR_DELETION)
-		{
-			mowgli_node_delete(n, &sessions);
-			destroy_session(p);
-			mowgli_node_free(n);
-		} else
-			p->flags |= ASASL_MARKED_FOR_DELETION;
+		destroy_session(n->data);
 	}
 }
 
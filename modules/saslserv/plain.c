@@ -19,8 +19,16 @@ sasl_mech_register_func_t *regfuncs;
 static int mech_start(sasl_session_t *p, char **out, size_t *out_len);
 static int mech_step(sasl_session_t *p, char *message, size_t len, char **out, size_t *out_len);
 static void mech_finish(sasl_session_t *p);
+static void plain_verified(password_req_t *req, bool ok);
 sasl_mechanism_t mech = {"PLAIN", &mech_start, &mech_step, &mech_finish};
 
+/* the password check of a session, while it runs */
+typedef struct {
+	password_req_t *req;
+	bool stepping;		/* still inside mech_step() */
+	int rc;
+} plain_check_t;
+
 void _modinit(module_t *m)
 {
 	MODULE_TRY_REQUEST_SYMBOL(m, regfuncs, "saslserv/main", "sasl_mech_register_funcs");
@@ -43,6 +51,7 @@ static int mech_step(sasl_session_t *p, char *message, size_t len, char **out, s
 	char authc[256];
 	char pass[256];
 	myuser_t *mu;
+	plain_check_t *check;
 	char *end;
 
 	/* Copy the authzid */
@@ -84,11 +93,42 @@ static int mech_step(sasl_session_t *p, char *message, size_t len, char **out, s
 
 	p->username = strdup(authc);
 	p->authzid = strdup(authz);
-	return verify_password(mu, pass) ? ASASL_DONE : ASASL_FAIL;
+
+	/* the answer may come straight away, or later from plain_verified() */
+	mech_finish(p);
+	check = p->mechdata = smalloc(sizeof *check);
+	check->stepping = true;
+	check->rc = ASASL_PENDING;
+	check->req = verify_password_async(NULL, mu, pass, plain_verified, p);
+	check->stepping = false;
+
+	return check->rc;
+}
+
+static void plain_verified(password_req_t *req, bool ok)
+{
+	sasl_session_t *p = req->priv;
+	plain_check_t *check = p->mechdata;
+
+	check->req = NULL;
+	check->rc = ok && req->mu != NULL ? ASASL_DONE : ASASL_FAIL;
+
+	if (!check->stepping)
+		regfuncs->mech_step_done(p, check->rc);
 }
 
 static void mech_finish(sasl_session_t *p)
 {
+	plain_check_t *check = p->mechdata;
+
+	if (check == NULL)
+		return;
+
+	if (check->req != NULL)
+		password_req_cancel(check->req);
+
+	free(check);
+	p->mechdata = NULL;
 }
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
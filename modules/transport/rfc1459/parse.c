@@ -26,6 +26,60 @@
 #include "pmodule.h"
 #include "rfc1459.h"
 
+/*
+ * The sourceinfo for the line being parsed.  It is reused for the next
+ * line unless a handler kept a reference to it.
+ */
+static sourceinfo_t *parse_si;
+
+static sourceinfo_t *irc_parse_sourceinfo(void)
+{
+	sourceinfo_t *si = parse_si;
+
+	parse_si = NULL;
+
+	if (si == NULL)
+		return sourceinfo_create();
+
+	memset((char *)si + sizeof(object_t), 0, sizeof(sourceinfo_t) - sizeof(object_t));
+
+	return si;
+}
+
+static void irc_parse_sourceinfo_done(sourceinfo_t *si)
+{
+	object_t *obj = object(si);
+
+	if (parse_si == NULL && obj->refcount == 1 && obj->metadata == NULL && obj->privatedata == NULL)
+		parse_si = si;
+	else
+		object_unref(si);
+}
+
+/*
+ * Finds the server or user a prefix names, asking only the table its
+ * shape points at: server names contain a dot and TS6 SIDs are three
+ * characters starting with a digit, anything else is a UID or a nick.
+ */
+static void irc_parse_origin(sourceinfo_t *si, const char *origin)
+{
+	bool server;
+
+	server = strchr(origin, '.') != NULL ||
+		(ircd->uses_uid && IsDigit(origin[0]) && origin[1] != '\0' && origin[2] != '\0' && origin[3] == '\0');
+
+	if (server)
+	{
+		if ((si->s = server_find(origin)) == NULL)
+			si->su = user_find(origin);
+	}
+	else
+	{
+		if ((si->su = user_find(origin)) == NULL)
+			si->s = server_find(origin);
+	}
+}
+
 /* parses a standard 2.8.21 style IRC stream */
 void irc_parse(char *line)
 {
@@ -35,7 +89,6 @@ void irc_parse(char *line)
 	char *command = NULL;
 	char *message = NULL;
 	char *parv[MAXPARC + 1];
-	static char coreLine[BUFSIZE];
 	int parc = 0;
 	unsigned int i;
 	pcommand_t *pcmd;
@@ -44,7 +97,7 @@ void irc_parse(char *line)
 	for (i = 0; i <= MAXPARC; i++)
 		parv[i] = NULL;
 
-	si = sourceinfo_create();
+	si = irc_parse_sourceinfo();
 	si->connection = curr_uplink->conn;
 	si->output_limit = MAX_IRC_OUTPUT_LINES;
 
@@ -58,10 +111,6 @@ void irc_parse(char *line)
 		if (*line == '\000')
 			goto cleanup;
 
-		/* copy the original line so we know what we crashed on */
-		memset((char *)&coreLine, '\0', BUFSIZE);
-		mowgli_strlcpy(coreLine, line, BUFSIZE);
-
 		slog(LG_RAWDATA, "-> %s", line);
 
 		/* find the first space */
@@ -77,8 +126,7 @@ void irc_parse(char *line)
 			{
                         	origin = line + 1;
 
-				si->s = server_find(origin);
-				si->su = user_find(origin);
+				irc_parse_origin(si, origin);
 
 				if ((message = strchr(pos, ' ')))
 				{
@@ -120,12 +168,12 @@ void irc_parse(char *line)
                 }
 		if (si->s == me.me)
 		{
-                        slog(LG_INFO, "irc_parse(): got message supposedly from myself %s: %s", si->s->name, coreLine);
+                        slog(LG_INFO, "irc_parse(): got message supposedly from myself %s: %s", si->s->name, command);
                         goto cleanup;
 		}
 		if (si->su != NULL && si->su->server == me.me)
 		{
-                        slog(LG_INFO, "irc_parse(): got message supposedly from my own client %s: %s", si->su->nick, coreLine);
+                        slog(LG_INFO, "irc_parse(): got message supposedly from my own client %s: %s", si->su->nick, command);
                         goto cleanup;
 		}
 		si->smu = si->su != NULL ? si->su->myuser : NULL;
@@ -179,7 +227,7 @@ void irc_parse(char *line)
 	}
 
 cleanup:
-	object_unref(si);
+	irc_parse_sourceinfo_done(si);
 }
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
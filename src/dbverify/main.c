@@ -20,6 +20,7 @@
 
 #include "atheme.h"
 #include "libathemecore.h"
+#include <ext/getopt_long.h>
 
 static unsigned int verify_entity_uids(void)
 {
@@ -71,6 +72,7 @@ static void verify_channel_registrations(void)
 			{
 				slog(LG_INFO, "*** phase 3: %s: chanacs entry %p is dangling; unlinking from object store", mc->name, ca);
 				mowgli_node_delete(&ca->cnode, &mc->chanacs);
+				mowgli_node_delete(&ca->inode, &mc->chanacs_hosts);
 				continue;
 			}
 
@@ -78,6 +80,12 @@ static void verify_channel_registrations(void)
 			{
 				slog(LG_INFO, "*** phase 3: %s: chanacs entry '%s' (%p) duplicates chanacs entry %p", mc->name, ca->entity != NULL ? ca->entity->name : ca->host, ca, ca2);
 				mowgli_node_delete(&ca->cnode, &mc->chanacs);
+
+				/* duplicate account entries were never indexed */
+				if (ca->entity == NULL)
+					mowgli_node_delete(&ca->inode, &mc->chanacs_hosts);
+				else if (!isuser(ca->entity))
+					mowgli_node_delete(&ca->inode, &mc->chanacs_validated);
 				continue;
 			}
 
@@ -104,33 +112,97 @@ static void handle_mdep(database_handle_t *db, const char *type)
 	module_load(modname);
 }
 
+static void usage(void)
+{
+	fprintf(stderr, "usage: dbverify [-i backend] [-o backend] [infile [outfile]]\n");
+	fprintf(stderr, "backends: opensex (default), binary\n");
+	exit(EXIT_FAILURE);
+}
+
+static void load_backend(const char *name)
+{
+	char path[BUFSIZE];
+
+	if (strcmp(name, "opensex") && strcmp(name, "binary"))
+		usage();
+
+	snprintf(path, sizeof path, "backend/%s", name);
+	if (module_load(path) == NULL)
+	{
+		slog(LG_ERROR, "dbverify: cannot load %s", path);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void log_size(const char *filename)
+{
+	char path[BUFSIZE];
+	struct stat sb;
+
+	snprintf(path, sizeof path, "%s/%s", datadir, filename);
+	if (stat(path, &sb) == 0)
+		slog(LG_INFO, "%s is %lu bytes", path, (unsigned long)sb.st_size);
+}
+
 int main(int argc, char *argv[])
 {
 	atheme_bootstrap();
 	atheme_init(argv[0], LOGDIR "/dbverify.log");
 	atheme_setup();
-	module_t *m;
 	unsigned int errcnt;
-	char *filename = argv[1] ? argv[1] : "services.db";
+	const char *inbackend = "opensex", *outbackend = NULL;
+	char *filename, *outfilename;
+	clock_t start;
+	int r;
+	mowgli_getopt_option_t long_opts[] = {
+		{ NULL, 0, NULL, 0, 0 },
+	};
+
+	while ((r = mowgli_getopt_long(argc, argv, "i:o:", long_opts, NULL)) != -1)
+	{
+		switch (r)
+		{
+		  case 'i':
+			  inbackend = mowgli_optarg;
+			  break;
+		  case 'o':
+			  outbackend = mowgli_optarg;
+			  break;
+		  default:
+			  usage();
+			  break;
+		}
+	}
+
+	filename = mowgli_optind < argc ? argv[mowgli_optind++] : "services.db";
+	outfilename = mowgli_optind < argc ? argv[mowgli_optind++] : filename;
+
+	if (outbackend == NULL)
+		outbackend = inbackend;
 
 	runflags = RF_LIVE;
 	datadir = DATADIR;
 	strict_mode = false;
 	offline_mode = true;
 
-	slog(LG_INFO, "dbverify is operating on %s", filename);
+	slog(LG_INFO, "dbverify is operating on %s (%s), writing %s (%s)", filename, inbackend, outfilename, outbackend);
 
-	m = module_load("backend/opensex");
+	load_backend(inbackend);
 
 	db_unregister_type_handler("MDEP");
 	db_register_type_handler("MDEP", handle_mdep);
 
-	slog(LG_INFO, "*** phase 1: demarshaling objects from opensex datastore");
+	slog(LG_INFO, "*** phase 1: demarshaling objects from %s datastore", inbackend);
+
+	log_size(filename);
+	start = clock();
 
 	runflags &= ~RF_LIVE;
 	db_load(filename);
 	runflags |= RF_LIVE;
 
+	slog(LG_INFO, "*** phase 1: loaded in %.3f CPU seconds", (double)(clock() - start) / CLOCKS_PER_SEC);
+
 	slog(LG_INFO, "*** phase 2: doing basic atheme database consistency check");
 
 	db_check();
@@ -144,9 +216,18 @@ int main(int argc, char *argv[])
 	while ((errcnt = verify_entity_uids()) != 0)
 		slog(LG_INFO, "*** phase 4: %u error(s) were found; running another pass", errcnt);
 
-	slog(LG_INFO, "*** phase 5: writing corrected state to object store");
+	slog(LG_INFO, "*** phase 5: writing corrected state to %s object store", outbackend);
+
+	/* the backend loaded last provides db_mod */
+	if (strcmp(outbackend, inbackend))
+		load_backend(outbackend);
+
+	start = clock();
+
+	db_save(outfilename);
 
-	db_save(filename);
+	slog(LG_INFO, "*** phase 5: written in %.3f CPU seconds", (double)(clock() - start) / CLOCKS_PER_SEC);
+	log_size(outfilename);
 
 	return EXIT_SUCCESS;
 }
@@ -24,7 +24,22 @@
 #include "pmodule.h"
 #include "conf.h"
 
+/* the world: DRAGON_USERS users, all of them in #lobby, and the first
+ * DRAGON_BOTS of them in each of DRAGON_CHANNELS more channels, the way
+ * bots and opers sit in hundreds of channels */
+#define DRAGON_USERS		100000
+#define DRAGON_BOTS		500
+#define DRAGON_CHANNELS		2000
+
+/* after the burst a hub with DRAGON_SPLIT_USERS users links and splits
+ * DRAGON_SPLIT_ROUNDS times; its users sit in #lobby, in one of the
+ * channels above and, a hundred at a time, in channels of their own */
+#define DRAGON_SPLIT_HUB	"hub.dragon"
+#define DRAGON_SPLIT_USERS	80000
+#define DRAGON_SPLIT_ROUNDS	3
+
 static struct timeval burstbegin;
+static unsigned int burstbout, burstwrites;
 static bool bursting = false;
 
 void bootstrap(void)
@@ -53,13 +68,57 @@ void build_world(void)
 	int i;
 	char userbuf[BUFSIZE];
 
-	for (i = 100000; i > 0; i--)
+	for (i = DRAGON_USERS; i > 0; i--)
 	{
 		snprintf(userbuf, sizeof userbuf, "User%d", i);
 		user_add(userbuf, "user", "localhost", NULL, NULL, ircd->uses_uid ? uid_get() : NULL, "User", me.me, CURRTIME);
 	}
 }
 
+void build_channels(void)
+{
+	int i, j;
+	char chanbuf[BUFSIZE], userbuf[BUFSIZE];
+	channel_t *c;
+
+	for (i = 0; i < DRAGON_CHANNELS; i++)
+	{
+		snprintf(chanbuf, sizeof chanbuf, "#chan%d", i);
+		c = channel_add(chanbuf, CURRTIME, me.me);
+
+		for (j = 1; j <= DRAGON_BOTS; j++)
+		{
+			snprintf(userbuf, sizeof userbuf, "User%d", j);
+			chanuser_add(c, userbuf);
+		}
+	}
+
+	c = channel_add("#lobby", CURRTIME, me.me);
+
+	for (j = 1; j <= DRAGON_USERS; j++)
+	{
+		snprintf(userbuf, sizeof userbuf, "User%d", j);
+		chanuser_add(c, userbuf);
+	}
+}
+
+void burst_channels(void)
+{
+	mowgli_patricia_iteration_state_t state;
+	mowgli_node_t *n;
+	channel_t *c;
+
+	MOWGLI_PATRICIA_FOREACH(c, &state, chanlist)
+	{
+		MOWGLI_ITER_FOREACH(n, c->members.head)
+		{
+			chanuser_t *cu = n->data;
+
+			join_sts(c, cu->user, n == c->members.head, channel_modes(c, true));
+		}
+	}
+}
+
 void burst_world(void)
 {
 	mowgli_node_t *n;
@@ -67,10 +126,14 @@ void burst_world(void)
 	slog(LG_INFO, "handshake complete, starting burst");
 
 	s_time(&burstbegin);
+	burstbout = cnt.bout;
+	burstwrites = cnt.bwrites;
 
 	MOWGLI_ITER_FOREACH(n, me.me->userlist.head)
 		introduce_nick(n->data);
 
+	burst_channels();
+
 	ping_sts();
 	bursting = true;
 }
@@ -86,6 +149,64 @@ void phase_buildworld(void)
 	e_time(ts, &te);
 
 	slog(LG_INFO, "world created in %d msec", tv2ms(&te));
+
+	s_time(&ts);
+	build_channels();
+	e_time(ts, &te);
+
+	slog(LG_INFO, "%u channel memberships created in %d msec", cnt.chanuser, tv2ms(&te));
+}
+
+void build_hub(void)
+{
+	int i;
+	char userbuf[BUFSIZE], chanbuf[BUFSIZE];
+	server_t *hub;
+	channel_t *lobby, *c;
+
+	hub = server_add(DRAGON_SPLIT_HUB, 1, me.me, ircd->uses_uid ? (ircd->uses_p10 ? "DR" : "1DR") : NULL, "dragon split hub");
+	lobby = channel_find("#lobby");
+
+	for (i = 0; i < DRAGON_SPLIT_USERS; i++)
+	{
+		snprintf(userbuf, sizeof userbuf, "Split%d", i);
+		user_add(userbuf, "user", "hub.localhost", NULL, NULL, ircd->uses_uid ? uid_get() : NULL, "Split", hub, CURRTIME);
+
+		chanuser_add(lobby, userbuf);
+
+		snprintf(chanbuf, sizeof chanbuf, "#chan%d", i % DRAGON_CHANNELS);
+		chanuser_add(channel_find(chanbuf), userbuf);
+
+		snprintf(chanbuf, sizeof chanbuf, "#split%d", i / 100);
+		if ((c = channel_find(chanbuf)) == NULL)
+			c = channel_add(chanbuf, CURRTIME, hub);
+		chanuser_add(c, userbuf);
+	}
+}
+
+void phase_split(void)
+{
+	struct timeval ts, te;
+	unsigned int i, chanusers;
+
+	for (i = 1; i <= DRAGON_SPLIT_ROUNDS; i++)
+	{
+		chanusers = cnt.chanuser;
+
+		s_time(&ts);
+		build_hub();
+		e_time(ts, &te);
+
+		slog(LG_INFO, "rejoin %u: %d users, %u channel memberships in %d msec",
+				i, DRAGON_SPLIT_USERS, cnt.chanuser - chanusers, tv2ms(&te));
+
+		s_time(&ts);
+		server_delete(DRAGON_SPLIT_HUB);
+		e_time(ts, &te);
+
+		slog(LG_INFO, "split %u: %u users, %u channels left after %d msec",
+				i, cnt.user, cnt.chan, tv2ms(&te));
+	}
 }
 
 static void m_pong(sourceinfo_t *si, int parc, char *parv[])
@@ -101,6 +222,9 @@ static void m_pong(sourceinfo_t *si, int parc, char *parv[])
 	e_time(burstbegin, &te);
 
 	slog(LG_INFO, "burst took %d msec", tv2ms(&te));
+	slog(LG_INFO, "burst sent %u bytes in %u writes", cnt.bout - burstbout, cnt.bwrites - burstwrites);
+
+	phase_split();
 
 	runflags |= RF_SHUTDOWN;
 }
@@ -12,7 +12,7 @@ int main(int argc, char *argv[])
 {
 	unsigned int usercount = 0, channelcount = 0, membercount = 0,
 		klinecount = 0, qlinecount = 0, xlinecount = 0, regchannelcount = 0,
-		servercount = 0, regusercount = 0;
+		servercount = 0, regusercount = 0, metadatacount = 0;
 	unsigned int i;
 
 	/* make up some statistics */
@@ -31,6 +31,9 @@ int main(int argc, char *argv[])
 	/* 5% of users are probably misbehaving in some way... */
 	klinecount = xlinecount = qlinecount = (usercount * 0.05);
 
+	/* registration times, last quit messages, entrymsgs and the like */
+	metadatacount = regusercount * 4 + regchannelcount * 3;
+
 	printf("footprint for atheme %s (%s)\n", PACKAGE_VERSION, SERNO);
 
 	printf("\n* * *\n\n");
@@ -42,10 +45,13 @@ int main(int argc, char *argv[])
 	printf("%u registered channels\n", regchannelcount);
 	printf("%u memberships\n", membercount);
 	printf("%u klines / xlines / qlines\n", klinecount);
+	printf("%u metadata entries\n", metadatacount);
 
 	printf("\n* * *\n\n");
 
 	printf("sizeof object_t: %zu B\n", sizeof(object_t));
+	printf("sizeof metadata_t: %zu B + %zu B slot --> %zu KB\n", sizeof(metadata_t), sizeof(metadata_t *),
+			(metadatacount * (sizeof(metadata_t) + sizeof(metadata_t *))) / 1024);
 
 	printf("\n* * *\n\n");
 
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2014 Atheme Development Group
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Checks crypto/pbkdf2 against OpenSSL's PKCS5_PBKDF2_HMAC() and a stored
+ * hash, then times both.
+ */
+
+#include "atheme.h"
+#include "libathemecore.h"
+
+#ifdef HAVE_OPENSSL
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+/* these must match modules/crypto/pbkdf2.c */
+#define ROUNDS		(128000)
+#define SALTLEN		(16)
+
+/* hashes in the stored format, salt followed by the hex digest */
+static const struct {
+	const char *key;
+	const char *hash;
+} known[] = {
+	{ "hunter2", "0123456789abcdef"
+		"41061cc5b58fea23e55c3d873f07bdfac703b0d5778c85316fee9fe7ffbdd97c"
+		"9d5fc3218271e7c8d71146201a0695dc75da09ca6c372286bc824725fe7fb801" },
+};
+
+static void reference_crypt(const char *key, const char *salt, char *buf)
+{
+	unsigned char digest[SHA512_DIGEST_LENGTH];
+	int i;
+
+	PKCS5_PBKDF2_HMAC(key, strlen(key), (const unsigned char *)salt, SALTLEN, ROUNDS, EVP_sha512(), sizeof digest, digest);
+
+	memcpy(buf, salt, SALTLEN);
+	for (i = 0; i < SHA512_DIGEST_LENGTH; i++)
+		sprintf(buf + SALTLEN + i * 2, "%02x", digest[i]);
+}
+
+static unsigned int check(const crypt_impl_t *ci)
+{
+	char buf[PASSLEN], ref[PASSLEN], key[300];
+	unsigned int errors = 0;
+	size_t i, len;
+
+	for (i = 0; i < ARRAY_SIZE(known); i++)
+	{
+		if (!ci->crypt_r(known[i].key, known[i].hash, buf, sizeof buf) || strcmp(buf, known[i].hash))
+		{
+			fprintf(stderr, "stored hash for '%s' does not match\n", known[i].key);
+			errors++;
+		}
+	}
+
+	/* keys around the SHA-512 block size are the interesting ones */
+	for (len = 0; len < sizeof key - 1; len += len >= 100 && len < 160 ? 1 : 37)
+	{
+		for (i = 0; i < len; i++)
+			key[i] = 'A' + (i * 7 + len) % 58;
+		key[len] = '\0';
+
+		ci->crypt_r(key, "saltsaltsaltsalt", buf, sizeof buf);
+		reference_crypt(key, "saltsaltsaltsalt", ref);
+
+		if (strcmp(buf, ref))
+		{
+			fprintf(stderr, "%zu byte key does not match OpenSSL\n", len);
+			errors++;
+		}
+	}
+
+	return errors;
+}
+
+static double time_hashes(const crypt_impl_t *ci, unsigned int count)
+{
+	char buf[PASSLEN];
+	clock_t start = clock();
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (ci != NULL)
+			ci->crypt_r("correct horse battery staple", "0123456789abcdef", buf, sizeof buf);
+		else
+			reference_crypt("correct horse battery staple", "0123456789abcdef", buf);
+	}
+
+	return (double)(clock() - start) / CLOCKS_PER_SEC * 1000 / count;
+}
+
+int main(int argc, char *argv[])
+{
+	const crypt_impl_t *ci;
+	unsigned int count, errors;
+	double ours, theirs;
+
+	atheme_bootstrap();
+	atheme_init(argv[0], LOGDIR "/pbkdf2bench.log");
+	atheme_setup();
+
+	count = argc > 1 ? atoi(argv[1]) : 20;
+	if (count == 0)
+	{
+		fprintf(stderr, "usage: %s [hashes]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	runflags = RF_LIVE;
+
+	if (module_load("crypto/pbkdf2") == NULL)
+	{
+		fprintf(stderr, "cannot load crypto/pbkdf2\n");
+		return EXIT_FAILURE;
+	}
+
+	ci = crypt_get_default_provider();
+	if (strcmp(ci->id, "pbkdf2") || ci->crypt_r == NULL)
+	{
+		fprintf(stderr, "crypto/pbkdf2 did not register itself\n");
+		return EXIT_FAILURE;
+	}
+
+	if ((errors = check(ci)) != 0)
+	{
+		fprintf(stderr, "%u mismatches, not benchmarking\n", errors);
+		return EXIT_FAILURE;
+	}
+
+	printf("output matches OpenSSL and stored hashes\n");
+
+	ours = time_hashes(ci, count);
+	theirs = time_hashes(NULL, count);
+
+	printf("crypto/pbkdf2:              %8.2f ms per hash\n", ours);
+	printf("OpenSSL PKCS5_PBKDF2_HMAC:  %8.2f ms per hash\n", theirs);
+
+	return EXIT_SUCCESS;
+}
+
+#else
+
+int main(int argc, char *argv[])
+{
+	printf("I'm sorry, you didn't compile Atheme with OpenSSL support.\n");
+	return EXIT_SUCCESS;
+}
+
+#endif